@@ -22,6 +22,9 @@ in vec2 vTexCoords;
 flat in uint st;
 flat in uint hp;
 
+/* Index into per-submesh draw data (multi-draw-indirect rendering) */
+flat in int drawDataID;
+
 /* Build state bits */
 #define EMPTY 0U
 #define INSIDE_ROOM 1U
@@ -51,7 +54,6 @@ in vec2 cellCoords;
 uniform float automatonTimeDelta;
 
 /*Directional Lights Parts*/
-uniform vec3 viewPos;
 
 struct DirLight{
 	vec3 direction;
@@ -61,7 +63,6 @@ struct DirLight{
 	vec3 specular;
 };
 
-uniform DirLight dirLight;
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
 
 /*Influence and Source Lights*/
@@ -78,29 +79,58 @@ struct PointLightProps{
     float quadratic;
 
 };
-uniform PointLightProps outerInfLightProps;
-uniform PointLightProps sourceLightProps;
 
 #define NR_OUT_INF_LIGHTS 5  
-uniform PointLight outerInfLights[NR_OUT_INF_LIGHTS];
 #define MAX_NR_SOURCE_LIGHTS 15  
-uniform PointLight sourceLights[MAX_NR_SOURCE_LIGHTS];
-uniform int numSourceLights;
 vec3 CalcPointLight(PointLightProps lightProps, PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir); 
 /*Material attributes*/
 struct Material {
     float alpha;
     vec3 ambient;
     float bumpMultiplier;
-    sampler2D bumpTex;
     vec3 diffuse;
-    sampler2D diffuseTex;
     float refraction;
     vec3 specular;
     float specularExponent;
 };
 
-uniform Material material;
+/* Camera and lights of the frame, material of the submesh (std140, see SceneUniforms) */
+layout(std140) uniform LightBlock {
+    vec3 viewPos;
+    DirLight dirLight;
+    PointLightProps outerInfLightProps;
+    PointLightProps sourceLightProps;
+    PointLight outerInfLights[NR_OUT_INF_LIGHTS];
+    PointLight sourceLights[MAX_NR_SOURCE_LIGHTS];
+    int numSourceLights;
+};
+layout(std140) uniform MaterialBlock {
+    Material material;
+};
+
+/* Per-draw data for multi-draw-indirect rendering of the whole mesh pool (see MultiDrawRenderer) */
+#define MAX_DRAWS 1024
+#define MAX_DRAW_DATA 96
+struct DrawData {
+    mat4 subMeshLocalMatrix;
+    vec4 ambientAlpha;
+    vec4 diffuse;
+    vec4 specularExponent; // specular color and exponent
+};
+layout(std140) uniform DrawDataBlock {
+    DrawData drawData[MAX_DRAW_DATA]; // per submesh (shared by its levels of detail and the room-ordered mesh)
+    uvec4 drawDataIndex[MAX_DRAWS / 4]; // entry in drawData of each draw (four per vector)
+};
+uniform int isMultiDraw;
+
+/* Material values used for lighting (from material uniform or from per-draw data) */
+struct SurfaceMaterial {
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+    float specularExponent;
+};
+SurfaceMaterial surface;
 
 /*alternative Shader modes */
 uniform int isDepthPass;
@@ -117,6 +147,19 @@ void main() {
     // In depth pass do not need to do anything because depth is implicitly written
     if(isDepthPass == 1) return;
 
+    if(isMultiDraw == 1) {
+        surface.ambient = drawData[drawDataID].ambientAlpha.rgb;
+        surface.diffuse = drawData[drawDataID].diffuse.rgb;
+        surface.specular = drawData[drawDataID].specularExponent.rgb;
+        surface.specularExponent = drawData[drawDataID].specularExponent.a;
+    }
+    else {
+        surface.ambient = material.ambient;
+        surface.diffuse = material.diffuse;
+        surface.specular = material.specular;
+        surface.specularExponent = material.specularExponent;
+    }
+
     // Debug mode draws white wireframe
     if(isDebugMode == 1) {
         color = vec4(1);
@@ -156,7 +199,7 @@ void main() {
         if((st & INVALID) > 0U) {
             color = vec4(1,0,0, tmpAlpha);
         } else {
-            color = vec4(material.diffuse, tmpAlpha);
+            color = vec4(surface.diffuse, tmpAlpha);
         }
     } else {
 		vec3 norm = normalize(vNormal);
@@ -208,11 +251,11 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir){
 	float diff = max(dot(normal, lightDir),0.0);
 	//specular
 	vec3 reflectDir = reflect(-lightDir, normal);
-	float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.specularExponent);
+	float spec = pow(max(dot(viewDir, reflectDir), 0.0), surface.specularExponent);
 	//combine
-	vec3 ambient = light.ambient * mix(material.diffuse,material.ambient,0.5);
-	vec3 diffuse = light.diffuse * diff * material.diffuse;
-	vec3 specular = light.specular * spec * material.specular;
+	vec3 ambient = light.ambient * mix(surface.diffuse,surface.ambient,0.5);
+	vec3 diffuse = light.diffuse * diff * surface.diffuse;
+	vec3 specular = light.specular * spec * surface.specular;
 	return (ambient + diffuse + specular);
 }
 
@@ -223,15 +266,15 @@ vec3 CalcPointLight(PointLightProps lightProps, PointLight light, vec3 normal, v
     float diff = max(dot(normal, lightDir), 0.0);
     // specular 
     vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.specularExponent);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), surface.specularExponent);
     // attenuation
     float distance    = length(light.position - fragPos);
     float attenuation = 1.0 / (lightProps.constant + lightProps.linear * distance + 
   			     lightProps.quadratic * (distance * distance));    
 	//combine
-	vec3 ambient = lightProps.ambient * material.ambient;
-	vec3 diffuse = lightProps.diffuse * diff * material.diffuse;
-	vec3 specular = lightProps.specular * spec * material.specular;
+	vec3 ambient = lightProps.ambient * surface.ambient;
+	vec3 diffuse = lightProps.diffuse * diff * surface.diffuse;
+	vec3 specular = lightProps.specular * spec * surface.specular;
     ambient  *= attenuation;
     diffuse  *= attenuation;
     specular *= attenuation;
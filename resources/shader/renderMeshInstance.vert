@@ -1,4 +1,5 @@
 #version 330 core
+#extension GL_ARB_shader_draw_parameters : enable
 
 #define M_PI 3.1415926535897932384626433832795
 #define M_HALF_PI 1.5707963267948966192313216916397
@@ -18,6 +19,9 @@
 #define INFECTED 512U
 #define OUTER_INFLUENCE 1024U
 
+/* Max health (should match GridCell::MAX_HEALTH) */
+#define MAX_HEALTH 100U
+
 /* Build state and health for the whole grid (bilinear interpolation enabled) */
 uniform sampler2D curr_grid_state;
 uniform sampler2D last_grid_state;
@@ -27,16 +31,33 @@ layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 normal;
 layout(location = 2) in vec2 texCoords;
 
-// Instance attribs
-layout(location = 3) in vec3 translation;
-layout(location = 4) in float scale;
-layout(location = 5) in uint buildState;
-layout(location = 6) in uint health;
+// Instance attribs (see PerInstanceData)
+#define CELL_BITS 9U
+#define CELL_MASK ((1U << CELL_BITS) - 1U)
+layout(location = 3) in uint instance; // column, row and build state bits of this mesh (packed)
+uint buildState; // unpacked in main
 
 uniform mat4 subMeshLocalMatrix;
 uniform mat3 normalMatrix;
 uniform mat4 viewProjectionMatrix;
 
+/* Per-draw data for multi-draw-indirect rendering of the whole mesh pool (see MultiDrawRenderer) */
+#define MAX_DRAWS 1024
+#define MAX_DRAW_DATA 96
+struct DrawData {
+    mat4 subMeshLocalMatrix;
+    vec4 ambientAlpha;
+    vec4 diffuse;
+    vec4 specularExponent; // specular color and exponent
+};
+layout(std140) uniform DrawDataBlock {
+    DrawData drawData[MAX_DRAW_DATA]; // per submesh (shared by its levels of detail and the room-ordered mesh)
+    uvec4 drawDataIndex[MAX_DRAWS / 4]; // entry in drawData of each draw (four per vector)
+};
+uniform int isMultiDraw;
+uniform int firstDraw; // draws from firstDraw are drawn (gl_DrawIDARB starts at 0)
+flat out int drawDataID; // entry in drawData
+
 uniform vec2 gridDimensions;
 uniform vec3 gridTranslation;
 uniform float gridCellSize;
@@ -81,6 +102,14 @@ out vec2 cellCoords;
 out vec2 causticCoords;
 
 void main() {
+    // Instance transform from the cell (same as the grid: cells start at -1 and are gridCellSize wide)
+    ivec2 cellIndex = ivec2(instance & CELL_MASK, (instance >> CELL_BITS) & CELL_MASK);
+    buildState = instance >> (2U * CELL_BITS);
+    vec3 translation = gridTranslation;
+    translation.xy += vec2(-1) + vec2(cellIndex) * gridCellSize; // + relative cell translation
+    translation.xy += vec2(gridCellSize, -gridCellSize) / 2.0; // + origin to middle of cell
+    float scale = gridCellSize / 1.98; // assume model extends [-1,1]^3
+
     mat4 modelMatrix = mat4(0); // this fixed the glitch
     modelMatrix[3] = vec4(translation, 1);
     modelMatrix[0][0] = scale;
@@ -88,13 +117,25 @@ void main() {
     modelMatrix[2][2] = scale;
 
     st = buildState;
-    hp = health;
+    // health of the cell from the grid state (alpha holds normalized health, no filtering with texelFetch)
+    hp = uint(texelFetch(curr_grid_state, cellIndex, 0).a * float(MAX_HEALTH) + 0.5);
     cellCoords = translation.xy + vec2(1, 1 + gridCellSize) - gridTranslation.xy;
     cellCoords += (texCoords.yx - 0.5) * gridCellSize;
     cellCoords /= gridDimensions;
 
     vec3 pos = position;
 
+    // submesh transform of this draw (from uniform or from per-draw data)
+    mat4 localMatrix = subMeshLocalMatrix;
+    drawDataID = 0;
+#ifdef GL_ARB_shader_draw_parameters
+    if(isMultiDraw == 1) {
+        int draw = firstDraw + gl_DrawIDARB;
+        drawDataID = int(drawDataIndex[draw / 4][draw % 4]);
+        localMatrix = drawData[drawDataID].subMeshLocalMatrix;
+    }
+#endif
+
     if((buildState & INFECTED) > 0U) {
         /*
         const float WATER_WAVE_LENGTH = 5.0;
@@ -108,12 +149,12 @@ void main() {
         pos.y += fluid*3.0f;
     }
 
-    vec4 posV4 = modelMatrix * subMeshLocalMatrix * vec4(rotateZ_step90(pos.x, -pos.z), pos.y, 1);
+    vec4 posV4 = modelMatrix * localMatrix * vec4(rotateZ_step90(pos.x, -pos.z), pos.y, 1);
     vPosition = vec3(posV4);
     vNormal = vec3(rotateZ_step90(normal.x, -normal.z), normal.y); //TODO incorporate sin wave
     vTexCoords = texCoords;
     posV4 = viewProjectionMatrix * posV4;
-    vec4 caustpos = viewProjectionMatrix * modelMatrix * subMeshLocalMatrix * vec4(pos.x, -pos.z, pos.y, 1);
+    vec4 caustpos = viewProjectionMatrix * modelMatrix * localMatrix * vec4(pos.x, -pos.z, pos.y, 1);
     causticCoords = cellCoords + (caustpos - posV4).xy;
     gl_Position = posV4;
 }
\ No newline at end of file
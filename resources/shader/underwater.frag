@@ -26,7 +26,6 @@ struct DirLight{
 	vec3 specular;
 };
 
-uniform DirLight dirLight;
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
 
 /*Influence and Source Lights*/
@@ -43,14 +42,9 @@ struct PointLightProps{
     float quadratic;
 
 };
-uniform PointLightProps outerInfLightProps;
-uniform PointLightProps sourceLightProps;
 
 #define NR_OUT_INF_LIGHTS 5  
-uniform PointLight outerInfLights[NR_OUT_INF_LIGHTS];
 #define MAX_NR_SOURCE_LIGHTS 15  
-uniform PointLight sourceLights[MAX_NR_SOURCE_LIGHTS];
-uniform int numSourceLights;
 vec3 CalcPointLight(PointLightProps lightProps, PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir); 
 
 
@@ -61,15 +55,25 @@ struct Material {
     float alpha;
     vec3 ambient;
     float bumpMultiplier;
-    sampler2D bumpTex;
     vec3 diffuse;
-    sampler2D diffuseTex;
     float refraction;
     vec3 specular;
     float specularExponent;
 };
 
-uniform Material material;
+/* Camera and lights of the frame, material of the submesh (std140, see SceneUniforms) */
+layout(std140) uniform LightBlock {
+    vec3 viewPos;
+    DirLight dirLight;
+    PointLightProps outerInfLightProps;
+    PointLightProps sourceLightProps;
+    PointLight outerInfLights[NR_OUT_INF_LIGHTS];
+    PointLight sourceLights[MAX_NR_SOURCE_LIGHTS];
+    int numSourceLights;
+};
+layout(std140) uniform MaterialBlock {
+    Material material;
+};
 
 
 uniform sampler2DShadow shadowMap;
@@ -77,7 +81,6 @@ uniform float time;
 
 uniform int isDebugMode;
 
-uniform vec3 viewPos;
 
 in vec3 vPosition;
 in vec3 vNormal;
@@ -58,6 +58,7 @@ namespace viscom {
     void ApplicationNodeImplementation::InitOpenGL() {
 
         screenfilling_quad_.init(GetApplication()->GetGPUProgramManager());
+        sceneUniforms_.init();
 
         /* Init mesh pool (mesh and shader resources need to be loaded on all nodes) */
 
@@ -66,7 +67,6 @@ namespace viscom {
         instanceShader_ = GetApplication()->GetGPUProgramManager().GetResource("renderMeshInstance",
             std::initializer_list<std::string>{ "renderMeshInstance.vert", "renderMeshInstance.frag" });
 
-        sourceLightManager_->instanceShader_ = instanceShader_;
         meshpool_.loadShader(GetApplication()->GetGPUProgramManager(),instanceShader_);
 
         meshpool_.addMesh({ GridCell::INSIDE_ROOM },
@@ -116,49 +116,15 @@ namespace viscom {
         automatonUpdater_.currGridStateTexID = current_grid_state_texture_.id;
         automatonUpdater_.lastGridStateTexID = last_grid_state_texture_.id;
 
-        meshpool_.updateUniformEveryFrame("curr_grid_state", [&](GLint uloc) {
-            GLuint texture_unit = GL_TEXTURE0 + 0;
-            glActiveTexture(texture_unit);
-            glBindTexture(GL_TEXTURE_2D, current_grid_state_texture_.id);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-            float border[] = { 0.0f, 0.0f, 0.0f, 1.0f };
-            glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
-            glUniform1i(uloc, 0);
-        });
-
-        meshpool_.updateUniformEveryFrame("last_grid_state", [&](GLint uloc) {
-            GLuint texture_unit = GL_TEXTURE0 + 1;
-            glActiveTexture(texture_unit);
-            glBindTexture(GL_TEXTURE_2D, last_grid_state_texture_.id);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-            float border[] = { 0.0f, 0.0f, 0.0f, 1.0f };
-            glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
-            glUniform1i(uloc, 1);
-        });
-
-        meshpool_.updateUniformEveryFrame("causticTex", [&](GLint uloc) {
-            glActiveTexture(GL_TEXTURE2);
-            glBindTexture(GL_TEXTURE_2D, caustics->getTextureId());
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-            glUniform1i(uloc, 2);
-        });
+        // Sampling state comes from sampler objects (see GLStateCache)
+        meshpool_.bindTextureEveryPass("curr_grid_state", 0, roomgame::GRID_STATE_SAMPLER, [&]() { return current_grid_state_texture_.id; });
+        meshpool_.bindTextureEveryPass("last_grid_state", 1, roomgame::GRID_STATE_SAMPLER, [&]() { return last_grid_state_texture_.id; });
+        meshpool_.bindTextureEveryPass("causticTex", 2, roomgame::LINEAR_REPEAT_SAMPLER, [&]() { return caustics->getTextureId(); });
 
 
         /* Init outer influence */
-        std::shared_ptr<viscom::GPUProgram> outerInfShader = GetApplication()->GetGPUProgramManager().GetResource("stuff",
-            std::initializer_list<std::string>{ "applyTextureAndShadow.vert", "OuterInfl.frag" });
-
-        SynchronizedGameMesh* outerInfluenceMeshComp = new SynchronizedGameMesh(
-            GetApplication()->GetMeshManager().GetResource("/models/roomgame_models/floor.obj"),
-            outerInfShader);
-        outerInfluence_->MeshComponent = outerInfluenceMeshComp;
+        outerInfluence_->MeshComponent = CreateOuterInfluenceMesh();
+        outerInfluence_->Grid = interactiveGrid_;
         glm::mat4 movMat = glm::mat4(1);
         movMat = glm::scale(movMat, glm::vec3(0.1, 0.1, 0.1));
         movMat = glm::translate(movMat, glm::vec3(0, 0, 2));
@@ -170,7 +136,6 @@ namespace viscom {
 
         terrainShader_ = GetApplication()->GetGPUProgramManager().GetResource("underwater",
             std::initializer_list<std::string>{ "underwater.vert", "underwater.frag" });
-        sourceLightManager_->terrainShader_ = terrainShader_;
         std::string desertVersion = "";
 #ifdef _DEBUG
         desertVersion = "/models/roomgame_models/newModels/desert.obj";
@@ -183,6 +148,10 @@ namespace viscom {
         
 
         waterMesh_->scale = glm::vec3(0.5f,0.5f,0.5f);
+        // underwater.vert swaps y and z of the model
+        terrainBounds_ = { glm::vec3(INFINITY), glm::vec3(-INFINITY) };
+        for (const auto& v : waterMesh_->getMesh()->GetVertices())
+            terrainBounds_.extend(waterMesh_->scale * glm::vec3(v.x, -v.z, v.y));
 
         /* Init update manager */
         updateManager_.AddUpdateable(outerInfluence_);
@@ -195,10 +164,8 @@ namespace viscom {
         glm::vec3 specular = glm::vec3(0.7f, 0.7f, 0.7f);
         lightInfo->sun = new DirLight(ambient,diffuse,specular,direction);
         /* Allocate offscreen framebuffer for shadow map */
-        sm_ = new GPUBuffer::Tex{ 0, GL_DEPTH_ATTACHMENT, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT };
-        sm_fbo_ = new GPUBuffer(2048, 2048, { sm_ });
-        sm_lightmatrix_ = glm::ortho(/*left*/-10.0f, /*right*/10.0f, /*bot*/-10.0f, /*top*/10.0f, 0.1f, 100.0f) *
-            glm::lookAt(-direction, glm::vec3(0, 0, -4), glm::vec3(0, 1, 0));
+        shadowMapCache_.init(shadowMapSize_);
+        sm_lightmatrix_ = glm::mat4(1); // fitted to the view in each pass
 
         ambient = glm::vec3(0.01f, 0.01f, 0.01f);
         diffuse = glm::vec3(0.9f, 0.1f, 0.1f);
@@ -226,6 +193,8 @@ namespace viscom {
         currentOffscreenBuffer = GetApplication()->SelectOffscreenBuffer(offscreenBuffers);
         fullScreenQuad = CreateFullscreenQuad("postProcessing.frag");
 
+        RegisterSyncObjects();
+
 
 
     }
@@ -255,10 +224,212 @@ namespace viscom {
     }
 
 
+    /* Single definition of the sync order of all objects that are sent only if they changed
+     * (master and slaves register the same objects in the same order)
+    */
+    void ApplicationNodeImplementation::RegisterSyncObjects() {
+        syncRegistry_.add({ "source lights",
+            [this]() { return sourceLightManager_->generation(); },
+            [this]() { sourceLightManager_->preSync(); },
+            [this](roomgame::SyncStream& out) { sourceLightManager_->encode(out); },
+            [this](roomgame::SyncStream& in) { sourceLightManager_->decode(in); },
+            [this]() { sourceLightManager_->updateSyncedSlave(); },
+            [this]() {
+                auto replica = std::make_shared<roomgame::SourceLightManager>();
+                return roomgame::SyncRegistry::Replica{
+                    [replica](roomgame::SyncStream& in) { replica->decode(in); },
+                    [replica]() { replica->updateSyncedSlave(); },
+                    [this, replica]() { return replica->matchesLive(*sourceLightManager_); } };
+            } });
+        syncRegistry_.add({ "outer influence",
+            [this]() { return static_cast<unsigned long long>(outerInfluence_->getStateNr()); },
+            nullptr, // state is captured by OuterInfluence::preSync
+            [this](roomgame::SyncStream& out) { outerInfluence_->encode(out); },
+            [this](roomgame::SyncStream& in) { outerInfluence_->decode(in); },
+            [this]() { outerInfluence_->updateSyncedSlave(); },
+            [this]() {
+                struct OuterInfluenceReplica {
+                    std::unique_ptr<SynchronizedGameMesh> mesh;
+                    roomgame::OuterInfluence influence{ nullptr }; // attacks run on the master only, no source lights needed
+                };
+                auto replica = std::make_shared<OuterInfluenceReplica>();
+                replica->mesh.reset(CreateOuterInfluenceMesh());
+                replica->influence.MeshComponent = replica->mesh.get();
+                replica->influence.Grid = interactiveGrid_; // cells are looked up, not modified
+                return roomgame::SyncRegistry::Replica{
+                    [replica](roomgame::SyncStream& in) { replica->influence.decode(in); },
+                    [replica]() { replica->influence.updateSyncedSlave(); },
+                    [this, replica]() { return replica->influence.matchesLive(*outerInfluence_); } };
+            } });
+        meshpool_.registerSyncObjects(syncRegistry_);
+        // decode and apply of the plain values below run on the node's objects and on those of its loopback replicas
+        auto decodeGridTranslation = [](roomgame::SyncStream& in, sgct::SharedObject<roomgame::QuantizedPosition>& shared) {
+            in.readObj(&shared);
+        };
+        auto applyGridTranslation = [](sgct::SharedObject<roomgame::QuantizedPosition>& shared, glm::vec3& translation) {
+            translation = roomgame::dequantizePosition(shared.getVal());
+        };
+        syncRegistry_.add({ "grid translation",
+            [this]() { return gridTranslationChanges_.update(grid_translation_); },
+            [this]() { synchronized_grid_translation_.setVal(roomgame::quantizePosition(grid_translation_)); },
+            [this](roomgame::SyncStream& out) { out.writeObj(&synchronized_grid_translation_); },
+            [this, decodeGridTranslation](roomgame::SyncStream& in) { decodeGridTranslation(in, synchronized_grid_translation_); },
+            [this, applyGridTranslation]() { applyGridTranslation(synchronized_grid_translation_, grid_translation_); },
+            [this, decodeGridTranslation, applyGridTranslation]() {
+                struct GridTranslationReplica {
+                    sgct::SharedObject<roomgame::QuantizedPosition> shared;
+                    glm::vec3 translation = glm::vec3(0);
+                };
+                auto replica = std::make_shared<GridTranslationReplica>();
+                return roomgame::SyncRegistry::Replica{
+                    [replica, decodeGridTranslation](roomgame::SyncStream& in) { decodeGridTranslation(in, replica->shared); },
+                    [replica, applyGridTranslation]() { applyGridTranslation(replica->shared, replica->translation); },
+                    [this, replica]() { return roomgame::matchesQuantized(replica->translation, grid_translation_); } };
+            } });
+        automatonUpdater_.registerSyncObjects(syncRegistry_);
+        auto decodeGameLost = [](roomgame::SyncStream& in, sgct::SharedBool& shared) {
+            in.readBool(&shared);
+        };
+        auto applyGameLost = [](sgct::SharedBool& shared, bool& gameLost) {
+            gameLost = shared.getVal();
+        };
+        syncRegistry_.add({ "game lost",
+            [this]() { return gameLostChanges_.update(gameLost_); },
+            [this]() { gameLostShared.setVal(gameLost_); },
+            [this](roomgame::SyncStream& out) { out.writeBool(&gameLostShared); },
+            [this, decodeGameLost](roomgame::SyncStream& in) { decodeGameLost(in, gameLostShared); },
+            [this, applyGameLost]() { applyGameLost(gameLostShared, gameLost_); },
+            [this, decodeGameLost, applyGameLost]() {
+                struct GameLostReplica {
+                    sgct::SharedBool shared;
+                    bool gameLost = false;
+                };
+                auto replica = std::make_shared<GameLostReplica>();
+                return roomgame::SyncRegistry::Replica{
+                    [replica, decodeGameLost](roomgame::SyncStream& in) { decodeGameLost(in, replica->shared); },
+                    [replica, applyGameLost]() { applyGameLost(replica->shared, replica->gameLost); },
+                    [this, replica]() { return replica->gameLost == gameLost_; } };
+            } });
+        auto decodeScores = [](roomgame::SyncStream& in, sgct::SharedInt32& current, sgct::SharedInt32& highest) {
+            in.readInt32(&current);
+            in.readInt32(&highest);
+        };
+        auto applyScores = [](sgct::SharedInt32& current, sgct::SharedInt32& highest, int& currentScore, int& highestScore) {
+            currentScore = current.getVal();
+            highestScore = highest.getVal();
+        };
+        syncRegistry_.add({ "scores",
+            [this]() { return scoreChanges_.update(glm::ivec2(currentScore, highestScoreThisSession)); },
+            [this]() {
+                currentScoreShared.setVal(currentScore);
+                highestScoreThisSessionShared.setVal(highestScoreThisSession);
+            },
+            [this](roomgame::SyncStream& out) {
+                out.writeInt32(&currentScoreShared);
+                out.writeInt32(&highestScoreThisSessionShared);
+            },
+            [this, decodeScores](roomgame::SyncStream& in) { decodeScores(in, currentScoreShared, highestScoreThisSessionShared); },
+            [this, applyScores]() { applyScores(currentScoreShared, highestScoreThisSessionShared, currentScore, highestScoreThisSession); },
+            [this, decodeScores, applyScores]() {
+                struct ScoresReplica {
+                    sgct::SharedInt32 current, highest;
+                    int currentScore = 0, highestScore = 0;
+                };
+                auto replica = std::make_shared<ScoresReplica>();
+                return roomgame::SyncRegistry::Replica{
+                    [replica, decodeScores](roomgame::SyncStream& in) { decodeScores(in, replica->current, replica->highest); },
+                    [replica, applyScores]() { applyScores(replica->current, replica->highest, replica->currentScore, replica->highestScore); },
+                    [this, replica]() { return replica->currentScore == currentScore && replica->highestScore == highestScoreThisSession; } };
+            } });
+    }
+
+    SynchronizedGameMesh* ApplicationNodeImplementation::CreateOuterInfluenceMesh() {
+        std::shared_ptr<viscom::GPUProgram> outerInfShader = GetApplication()->GetGPUProgramManager().GetResource("stuff",
+            std::initializer_list<std::string>{ "applyTextureAndShadow.vert", "OuterInfl.frag" });
+        return new SynchronizedGameMesh(
+            GetApplication()->GetMeshManager().GetResource("/models/roomgame_models/floor.obj"),
+            outerInfShader);
+    }
+
+    /* Write all cluster-wide state to a sync stream (master, after PreSync)
+     * Single definition of the sync order: DecodeSyncedState must read in exactly this order
+    */
+    void ApplicationNodeImplementation::EncodeSyncedState(roomgame::SyncStream& out) {
+        out.writeInt64(&synchronized_generation_);
+        out.writeDouble(&synchronized_sync_time_);
+        syncRegistry_.encode(out);
+    }
+
+    /* Read all cluster-wide state from a sync stream (slaves) */
+    void ApplicationNodeImplementation::DecodeSyncedState(roomgame::SyncStream& in) {
+        DecodeSyncedState(in, synchronized_generation_, synchronized_sync_time_, syncRegistry_);
+    }
+
+    void ApplicationNodeImplementation::DecodeSyncedState(roomgame::SyncStream& in, sgct::SharedInt64& generation, sgct::SharedDouble& syncTime, roomgame::SyncRegistry& registry) {
+        in.readInt64(&generation);
+        in.readDouble(&syncTime);
+        registry.decode(in);
+    }
+
+    /* Snapshot layout: header, grid cells (build state + health), automaton, outer influence,
+     * instance buffers, source lights, grid translation and scores
+    */
+    void ApplicationNodeImplementation::EncodeSnapshot(roomgame::SyncStream& out) {
+        out.writeValue<uint32_t>(SNAPSHOT_MAGIC);
+        out.writeValue<uint32_t>(SNAPSHOT_VERSION);
+        out.writeValue<int64_t>(syncGeneration_);
+        out.writeValue<uint32_t>(static_cast<uint32_t>(GRID_COLS_));
+        out.writeValue<uint32_t>(static_cast<uint32_t>(GRID_ROWS_));
+        // build states fit into 16 bit, health points into 8 bit
+        interactiveGrid_->forEachCell([&](GridCell* cell) {
+            out.writeValue<uint16_t>(static_cast<uint16_t>(cell->getBuildState()));
+            out.writeValue<uint8_t>(static_cast<uint8_t>(cell->getHealthPoints()));
+        });
+        automatonUpdater_.encodeSnapshot(out);
+        outerInfluence_->encodeSnapshot(out);
+        meshpool_.encodeSnapshot(out);
+        sourceLightManager_->encodeSnapshot(out);
+        out.writeValue<glm::vec3>(grid_translation_);
+        out.writeValue<bool>(gameLost_);
+        out.writeValue<int32_t>(currentScore);
+        out.writeValue<int32_t>(highestScoreThisSession);
+    }
+
+    bool ApplicationNodeImplementation::LoadSnapshot(roomgame::SyncStream& in) {
+        if (in.readValue<uint32_t>() != SNAPSHOT_MAGIC || in.readValue<uint32_t>() != SNAPSHOT_VERSION) {
+            std::cerr << "Snapshot has unknown format, ignored." << std::endl;
+            return false;
+        }
+        const auto generation = in.readValue<int64_t>();
+        const auto cols = in.readValue<uint32_t>();
+        const auto rows = in.readValue<uint32_t>();
+        if (cols != static_cast<uint32_t>(GRID_COLS_) || rows != static_cast<uint32_t>(GRID_ROWS_)) {
+            std::cerr << "Snapshot grid size " << cols << "x" << rows << " does not match, ignored." << std::endl;
+            return false;
+        }
+        interactiveGrid_->forEachCell([&](GridCell* cell) {
+            cell->setBuildState(in.readValue<uint16_t>());
+            cell->setHealthPoints(in.readValue<uint8_t>());
+        });
+        automatonUpdater_.loadSnapshot(in);
+        outerInfluence_->loadSnapshot(in);
+        meshpool_.loadSnapshot(in);
+        sourceLightManager_->loadSnapshot(in);
+        grid_translation_ = in.readValue<glm::vec3>();
+        gameLost_ = in.readValue<bool>();
+        currentScore = in.readValue<int32_t>();
+        highestScoreThisSession = in.readValue<int32_t>();
+        std::cout << "Loaded snapshot of generation " << generation << " at generation " << syncGeneration_ << std::endl;
+        return true;
+    }
+
     void ApplicationNodeImplementation::UpdateFrame(double currentTime, double elapsedTime)
     {
 //        camera_.UpdateCamera(elapsedTime, this);
         clock_.set(currentTime);
+        meshpool_.beginFrame();
+        roomgame::GLStateCache::current().beginFrame();
+        outerInfluence_->setSyncedTime(clock_.t_in_sec);
         waterMesh_->setTime(currentTime);
     }
 
@@ -272,30 +443,41 @@ namespace viscom {
 
     void ApplicationNodeImplementation::DrawFrame(FrameBuffer& fbo)
     {
+        // the framework changes GL state between frames and viewports
+        roomgame::GLStateCache& glState = roomgame::GLStateCache::current();
+        glState.invalidate();
         glm::mat4 viewProj = GetCamera()->GetViewPerspectiveMatrix();
 
+        // Cells and meshes of the grid for per-viewport culling (meshes stay within a few cells above and below the grid)
+        const roomgame::InstanceCuller::Grid cullingGrid{
+            glm::vec2(grid_translation_) - glm::vec2(1.0f), GRID_CELL_SIZE_, GRID_COLS_, GRID_ROWS_,
+            grid_translation_.z - 4 * GRID_CELL_SIZE_, grid_translation_.z + 4 * GRID_CELL_SIZE_ };
+        meshpool_.setCullingGrid(cullingGrid);
+
+        // Generated instances follow the grid state texture (changes with automaton transitions and snapshots)
+        if (VISCOM_GPU_INSTANCE_GENERATION && generatedTransitionNr_ != automatonUpdater_.automatonTransitionNr_) {
+            meshpool_.generateInstances(current_grid_state_texture_.id, GRID_COLS_, GRID_ROWS_);
+            generatedTransitionNr_ = automatonUpdater_.automatonTransitionNr_;
+        }
+
         for (int i = 0; i < min(5,outerInfPositions_.size()); i++) {
             glm::mat4 tmp = outerInfPositions_[i];
             lightInfo->infLightPos[i] = glm::vec3(tmp[3][0], tmp[3][1], tmp[3][2]);
         }
 
-        sourceLightManager_->updateSourcePos();
-
         glm::vec3 viewPos = GetCamera()->GetPosition();
 
-        sm_lightmatrix_ = glm::ortho(/*left*/-10.0f, /*right*/10.0f, /*bot*/-10.0f, /*top*/10.0f, 0.1f, 20.0f) *
-            glm::lookAt(-lightInfo->sun->direction, glm::vec3(0, 0, -4), glm::vec3(0, 1, 0));
+        // camera and lights for all programs of this frame
+        sceneUniforms_.updateLights(viewPos, *lightInfo->sun, *lightInfo->outerInfLights, lightInfo->infLightPos,
+            *lightInfo->sourceLights, sourceLightManager_->sourcePositions_);
+
+        // light frustum around what this viewport sees and the grid meshes (margin of the culling pass, meshes are offset by half a cell)
+        const roomgame::ShadowMapCache::Bounds gridBounds = {
+            glm::vec3(cullingGrid.origin - glm::vec2(2 * cullingGrid.cellSize), cullingGrid.minZ),
+            glm::vec3(cullingGrid.origin + glm::vec2(GRID_WIDTH_, GRID_HEIGHT_) + glm::vec2(2 * cullingGrid.cellSize), cullingGrid.maxZ) };
+        sm_lightmatrix_ = shadowMapCache_.fitLightMatrix(lightInfo->sun->direction, viewProj, terrainBounds_, gridBounds);
 
-        // render to shadow map
-        glBindFramebuffer(GL_FRAMEBUFFER, sm_fbo_->id());
-        glClearDepth(1.0f);
-        glClear(GL_DEPTH_BUFFER_BIT);
-        glViewport(0, 0, 2048, 2048);
-        glDepthMask(GL_TRUE);
-        glEnable(GL_DEPTH_TEST);
-        glDepthFunc(GL_LESS);
-        DrawScene(viewPos, sm_lightmatrix_, sm_lightmatrix_, lightInfo);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        DrawShadowMap(viewPos, lightInfo);
 
         currentOffscreenBuffer->DrawToFBO([&]()
         {
@@ -314,29 +496,49 @@ namespace viscom {
                                       // clear all relevant buffers
             glClearColor(1.0f, 1.0f, 1.0f, 1.0f); // set clear color to white (not really necessery actually, since we won't be able to see behind the quad anyways)
             glClear(GL_COLOR_BUFFER_BIT);
-            glUseProgram(fullScreenQuad->GetGPUProgram()->getProgramId());
+            glState.useProgram(fullScreenQuad->GetGPUProgram()->getProgramId());
             GLuint imageTex = currentOffscreenBuffer->GetTextures().at(0);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, imageTex);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glState.bindTexture(0, imageTex, roomgame::LINEAR_REPEAT_SAMPLER);
             glUniform1i(fullScreenQuad->GetGPUProgram()->getUniformLocation("screenTexture"), 0);
 
             fullScreenQuad->Draw();
+            // hand over to the framework (sampler objects would override its texture parameters)
+            glState.releaseSamplers();
+            glState.invalidate();
 
         });
     }
 
+    void ApplicationNodeImplementation::DrawShadowMap(glm::vec3 viewPos, LightInfo* lightInfo)
+    {
+        if (shadowRenderMode_ != render_mode_) shadowMapCache_.invalidate();
+        shadowRenderMode_ = render_mode_;
+        // room meshes move with the grid, infected cells also flow with the automaton time (drawn in each pass)
+        const roomgame::ShadowMapCache::CachedState roomMeshState = { meshpool_.getInstanceVersion(), grid_translation_ };
+        const GLint debugMode = (render_mode_ == RenderMode::DBG) ? 1 : 0;
+        // outer influence moves every frame (and records its trail when rendered), so it is drawn in each pass
+        shadowMapCache_.render(sm_lightmatrix_, roomMeshState,
+            [&]() { DrawTerrain(viewPos, sm_lightmatrix_, sm_lightmatrix_, lightInfo); },
+            [&]() { meshpool_.renderAllMeshes(sm_lightmatrix_, 0, debugMode, lightInfo, viewPos, roomgame::RoomSegmentMeshPool::Subset::NOT_ANIMATED); },
+            [&]() {
+                meshpool_.renderAllMeshes(sm_lightmatrix_, 0, debugMode, lightInfo, viewPos, roomgame::RoomSegmentMeshPool::Subset::ANIMATED);
+                RenderOuterInfluence(viewPos, sm_lightmatrix_, lightInfo);
+            });
+    }
+
+    void ApplicationNodeImplementation::DrawTerrain(glm::vec3 viewPos, glm::mat4 lightspace, glm::mat4 viewProj, LightInfo *lightInfo)
+    {
+        waterMesh_->render(viewProj, lightspace, shadowMapCache_.getTexture(), caustics->getTextureId(), (render_mode_ == RenderMode::DBG) ? 1 : 0, lightInfo, viewPos);
+    }
+
     void ApplicationNodeImplementation::DrawScene(glm::vec3 viewPos, glm::mat4 lightspace, glm::mat4 viewProj, LightInfo *lightInfo)
     {
-        waterMesh_->render(viewProj, lightspace, sm_->id, caustics->getTextureId(), (render_mode_ == RenderMode::DBG) ? 1 : 0, lightInfo, viewPos);
+        DrawTerrain(viewPos, lightspace, viewProj, lightInfo);
         
-        glEnable(GL_BLEND); glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        roomgame::GLStateCache::current().setBlend(true, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
         meshpool_.renderAllMeshes(viewProj, 0, (render_mode_ == RenderMode::DBG) ? 1 : 0, lightInfo, viewPos);
         RenderOuterInfluence(viewPos, viewProj, lightInfo);
-        glDisable(GL_BLEND);
+        roomgame::GLStateCache::current().setBlend(false);
     }
 
     void ApplicationNodeImplementation::RenderOuterInfluence(glm::vec3 viewPos, glm::mat4 viewProj, LightInfo* lightInfo)
@@ -380,8 +582,10 @@ namespace viscom {
     void ApplicationNodeImplementation::CleanUp()
     {
         meshpool_.cleanup();
-        delete sm_;
-        delete sm_fbo_;
+        automatonUpdater_.cleanup();
+        sceneUniforms_.cleanup();
+        roomgame::GLStateCache::current().cleanup();
+        shadowMapCache_.cleanup();
         delete waterMesh_;
         delete lightInfo->sun;
         delete lightInfo->outerInfLights;
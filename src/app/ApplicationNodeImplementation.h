@@ -16,11 +16,20 @@
 #include "app/roomgame/DragAndZoomCamera.h"
 #include "app/roomgame/GameMesh.h"
 #include "app/roomgame/ShadowMap.h"
+#include "app/roomgame/ShadowMapCache.h"
 #include "app/roomgame/UpdateManager.h"
 #include "app/roomgame/OuterInfluence.h"
 #include "app/roomgame/GPUBuffer.h"
 #include "app/roomgame/GPUCellularAutomaton.h"
 #include "app/roomgame/RoomSegmentMeshPool.h"
+#include "app/roomgame/SceneUniforms.h"
+#include "app/roomgame/GLStateCache.h"
+#include "app/roomgame/SyncRegistry.h"
+
+// Resolution of the sun shadow map (its frustum is fitted to the view, see ShadowMapCache)
+#ifndef VISCOM_SHADOW_MAP_SIZE
+#define VISCOM_SHADOW_MAP_SIZE 2048
+#endif
 
 namespace roomgame
 {
@@ -68,6 +77,8 @@ namespace viscom {
 
     private:
         void DrawScene(glm::vec3 viewPos, glm::mat4 lightspace, glm::mat4 viewProj, LightInfo *lightInfo);
+        void DrawTerrain(glm::vec3 viewPos, glm::mat4 lightspace, glm::mat4 viewProj, LightInfo *lightInfo);
+        void DrawShadowMap(glm::vec3 viewPos, LightInfo* lightInfo);
         void RenderOuterInfluence(glm::vec3 viewPos, glm::mat4 viewProj, LightInfo* lightInfo);
 		GLenum last_glerror_; // helps output an error only once
         //unsigned int textureColorbuffer;
@@ -78,6 +89,35 @@ namespace viscom {
 
     protected:
 
+        /* Sync order of all cluster-wide state (shared by SGCT sync and loopback harness) */
+        void EncodeSyncedState(roomgame::SyncStream& out);
+        void DecodeSyncedState(roomgame::SyncStream& in);
+        // Same order into the objects of a loopback slave (see SyncRegistry::replicate)
+        static void DecodeSyncedState(roomgame::SyncStream& in, sgct::SharedInt64& generation, sgct::SharedDouble& syncTime, roomgame::SyncRegistry& registry);
+        /* Objects are synced only in frames in which they changed */
+        void RegisterSyncObjects();
+        roomgame::SyncRegistry syncRegistry_;
+        roomgame::ChangeTracker<glm::vec3> gridTranslationChanges_;
+        roomgame::ChangeTracker<bool> gameLostChanges_;
+        roomgame::ChangeTracker<glm::ivec2> scoreChanges_; // current and highest score
+
+        /* Package IDs of node-to-node transfers (sgct::Engine::transferDataToNode) */
+        enum DataTransferPackage {
+            PACKAGE_TRANSITION_NR = 0, // slave -> master: automaton transition number
+            PACKAGE_SNAPSHOT_REQUEST = 1, // slave -> master: (re)joining slave asks for a snapshot
+            PACKAGE_SNAPSHOT = 2, // master -> slave: full-state snapshot
+            PACKAGE_FULL_SYNC_REQUEST = 3 // slave -> master: send all sync objects once (after loading a snapshot)
+        };
+
+        /* Late-join/crash-recovery snapshot of the full game state (read from and written to live state)
+         * Master encodes it on request, a (re)joining slave loads it in one pass...
+         * ... and then continues with the regular sync stream.
+        */
+        void EncodeSnapshot(roomgame::SyncStream& out);
+        bool LoadSnapshot(roomgame::SyncStream& in);
+        static const uint32_t SNAPSHOT_MAGIC = 0x53534752; // "RGSS"
+        static const uint32_t SNAPSHOT_VERSION = 5; // 5: instances packed into 32 bits
+
 		// ROOMGAME DATA
 		// =============
 
@@ -103,6 +143,8 @@ namespace viscom {
         std::shared_ptr<viscom::GPUProgram> instanceShader_;
         std::shared_ptr<viscom::GPUProgram> terrainShader_;
         std::shared_ptr<roomgame::SourceLightManager> sourceLightManager_;
+        /* Uniform buffers of camera, lights and materials */
+        roomgame::SceneUniforms sceneUniforms_;
 
 		/* Grid parameters (constant on all nodes) */
 		const int GRID_COLS_ = 128;
@@ -111,22 +153,33 @@ namespace viscom {
 		const float GRID_CELL_SIZE_ = GRID_HEIGHT_ / GRID_ROWS_;
 		const float GRID_WIDTH_ = GRID_COLS_ * GRID_CELL_SIZE_;
 
+		/* Sync generation: counts master frames, synced with slaves */
+		sgct::SharedInt64 synchronized_generation_;
+		long long syncGeneration_ = 0;
+		/* Master time the synced state belongs to (slaves interpolate between synced states) */
+		sgct::SharedDouble synchronized_sync_time_;
+
 		/* Grid translation (controlled by master node and synced with slaves) */
-		sgct::SharedObject<glm::vec3> synchronized_grid_translation_;
+		sgct::SharedObject<roomgame::QuantizedPosition> synchronized_grid_translation_;
 		glm::vec3 grid_translation_;
 
 		/* Outer influence object containing AI logic and mesh */
 		std::shared_ptr<roomgame::OuterInfluence> outerInfluence_;
+		SynchronizedGameMesh* CreateOuterInfluenceMesh(); // also used by loopback replicas
 
 		/* Mesh pool manages and renders instanced meshes corresponding to build states of grid cells */
 		roomgame::RoomSegmentMeshPool meshpool_; // hold mesh and shader resources and render on all nodes
+		int generatedTransitionNr_ = -1; // automaton transition of the last GPU instance generation
 
         /* Shadow map is basically an offscreen framebuffer */
 		ShadowMap* shadowMap_; // hold shadow map framebuffer on all nodes
 
-        GPUBuffer::Tex* sm_;
-        GPUBuffer* sm_fbo_;
+        /* Terrain and room meshes are rendered to the shadow map only when they or the sun changed */
+        roomgame::ShadowMapCache shadowMapCache_;
+        GLsizei shadowMapSize_ = VISCOM_SHADOW_MAP_SIZE; // set by node types before InitOpenGL
+        roomgame::ShadowMapCache::Bounds terrainBounds_; // world space, for fitting the light frustum
         glm::mat4 sm_lightmatrix_;
+        int shadowRenderMode_ = -1; // render mode of the cached layers (debug mode draws wireframes)
 
         /* Shadow receiving meshes are (non-instanced) meshes with a shader reading from shadow maps */
 		ShadowReceivingMesh* backgroundMesh_; // hold static mesh on all nodes
@@ -172,7 +225,7 @@ namespace viscom {
 			GLuint vao;
 			void init(GPUProgramManager mgr) {
 				glGenVertexArrays(1, &vao);
-				glBindVertexArray(vao);
+				roomgame::GLStateCache::current().bindVertexArray(vao);
 				GLfloat quad[] = {
 					// (x, y)      // (u, v)
 					-1.0f,  1.0f,  0.0f, 1.0f, // top left
@@ -190,27 +243,21 @@ namespace viscom {
 				glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (GLvoid*)(2 * sizeof(GLfloat)));
 				glEnableVertexAttribArray(0);
 				glEnableVertexAttribArray(1);
-				glBindVertexArray(0);
+				roomgame::GLStateCache::current().bindVertexArray(0);
 				shader = mgr.GetResource("applyTextureToQuad",
 					std::initializer_list<std::string>{ "applyTextureToQuad.vert", "applyTextureToQuad.frag" });
 				texture_uniform_location = shader->getUniformLocation("tex");
 			}
 			void render(GLuint texture) const {
-				glUseProgram(shader->getProgramId());
+				roomgame::GLStateCache& state = roomgame::GLStateCache::current();
+				state.useProgram(shader->getProgramId());
 				glDisable(GL_DEPTH_TEST);
 				glDisable(GL_CULL_FACE);
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, texture);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-				float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-				glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+				state.bindTexture(0, texture, roomgame::DEBUG_QUAD_SAMPLER);
 				glUniform1i(texture_uniform_location, 0);
-				glBindVertexArray(vao);
+				state.bindVertexArray(vao);
 				glDrawArrays(GL_TRIANGLES, 0, 6);
-				glBindVertexArray(0);
+				state.bindVertexArray(0);
 				glEnable(GL_CULL_FACE);
 				glEnable(GL_DEPTH_TEST);
 			}
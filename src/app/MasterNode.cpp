@@ -10,10 +10,12 @@
 #include <imgui.h>
 #include "core/imgui/imgui_impl_glfw_gl3.h"
 #include <iostream>
+#include <chrono>
 #include "roomgame/MeshInstanceBuilder.h"
 #include "roomgame/InteractiveGrid.h"
 #include "roomgame/RoomSegmentMeshPool.h"
 #include "roomgame/RoomInteractionManager.h"
+#include "roomgame/SyncQuantization.h"
 #include "roomgame\InnerInfluence.h"
 
 
@@ -54,19 +56,30 @@ namespace viscom {
         glm::quat lookDir = glm::toQuat(glm::lookAt(GetCamera()->GetPosition(), gridPos, glm::vec3(0, 1, 0)));
         GetCamera()->SetOrientation(lookDir);
 
+        if (VISCOM_LOOPBACK_SLAVES > 0) {
+            loopback_ = std::make_unique<roomgame::LoopbackCluster>(VISCOM_LOOPBACK_SLAVES,
+                [this]() { return syncRegistry_.replicate(); },
+                [](roomgame::SyncStream& in, roomgame::SyncRegistry& objects) {
+                    sgct::SharedInt64 generation;
+                    sgct::SharedDouble syncTime;
+                    DecodeSyncedState(in, generation, syncTime, objects);
+                },
+                [this]() { fullSyncRequested_ = true; });
+#ifdef VISCOM_LOOPBACK_SCRIPT
+            std::string script = VISCOM_LOOPBACK_SCRIPT;
+            if (!script.empty()) loopbackScript_.load(script);
+#endif
+        }
     }
 
     /* Sync step 1: Master sets values of shared objects to the values of corresponding non-shared objects */
     void MasterNode::PreSync() {
         ApplicationNodeImplementation::PreSync();
-        sourceLightManager_->preSync();
-        outerInfluence_->MeshComponent->preSync();
-        meshpool_.preSync();
-        synchronized_grid_translation_.setVal(grid_translation_);
-        automatonUpdater_.preSync();
-        gameLostShared.setVal(gameLost_);
-        currentScoreShared.setVal(currentScore);
-        highestScoreThisSessionShared.setVal(highestScoreThisSession);
+        synchronized_generation_.setVal(++syncGeneration_);
+        synchronized_sync_time_.setVal(clock_.t_in_sec);
+        if (fullSyncRequested_.exchange(false)) syncRegistry_.invalidate();
+        outerInfluence_->preSync();
+        syncRegistry_.preSync(); // copies only objects that changed since the last frame
     }
 
     /* Sync step 2: Master sends shared objects to the central SharedData singleton
@@ -74,15 +87,41 @@ namespace viscom {
     */
     void MasterNode::EncodeData() {
         ApplicationNodeImplementation::EncodeData();
-        sourceLightManager_->encode();
-        outerInfluence_->MeshComponent->encode();
-        meshpool_.encode();
-        sgct::SharedData::instance()->writeObj<glm::vec3>(&synchronized_grid_translation_);
-        automatonUpdater_.encode();
-        sgct::SharedData::instance()->writeBool(&gameLostShared);
-        sgct::SharedData::instance()->writeInt32(&currentScoreShared);
-        sgct::SharedData::instance()->writeInt32(&highestScoreThisSessionShared);
+        roomgame::SGCTSyncStream out;
+        if (loopback_) EncodeLoopbackFrame(out);
+        else EncodeSyncedState(out);
+        ServeSnapshotRequests();
+    }
 
+    /* Send a full-state snapshot to every slave that asked for one since the last frame */
+    void MasterNode::ServeSnapshotRequests() {
+        std::vector<int> clients;
+        {
+            std::lock_guard<std::mutex> lock(snapshotMtx_);
+            clients.swap(snapshotRequests_);
+        }
+        if (clients.empty()) return;
+        roomgame::MemorySyncStream snapshot;
+        EncodeSnapshot(snapshot);
+        for (int clientID : clients) {
+            sgct::Engine::instance()->transferDataToNode(snapshot.data().data(),
+                static_cast<int>(snapshot.size()), PACKAGE_SNAPSHOT, clientID);
+        }
+        std::cout << "Sent snapshot (" << snapshot.size() << " bytes, generation " << syncGeneration_
+            << ") to " << clients.size() << " slave(s)" << std::endl;
+    }
+
+    /* Loopback harness: encode the frame once into memory, send these bytes to the cluster and to the in-process slaves
+     * (slaves decode them into their own replicas of the sync objects, see LoopbackCluster)
+    */
+    void MasterNode::EncodeLoopbackFrame(roomgame::SyncStream& out) {
+        loopbackStream_.clear();
+        const auto start = std::chrono::high_resolution_clock::now();
+        EncodeSyncedState(loopbackStream_);
+        const double encodeSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        if (loopbackStream_.size() > 0) out.write(loopbackStream_.data().data(), loopbackStream_.size());
+        loopback_->submitFrame(loopbackStream_, syncRegistry_.isFullFrame(), encodeSeconds);
+        loopback_->tick();
     }
 
     /* Sync step 3: Master updates its copies of cluster-wide variables with data it just synced
@@ -99,6 +138,8 @@ namespace viscom {
     /* This SGCT stage is called only once before each frame, regardless of the number of viewports */
     void MasterNode::UpdateFrame(double t1, double t2) {
         ApplicationNodeImplementation::UpdateFrame(t1, t2);
+        frameNr_++;
+        if (loopback_) RunLoopbackScript();
 
 #ifdef WITH_TUIO
         if (!inputBuffer.empty()) {
@@ -108,6 +149,7 @@ namespace viscom {
         grid_translation_ = interactiveGrid_->getTranslation();
         automatonUpdater_.updateMaster(clock_.t_in_sec);
         updateManager_.ManageUpdates(min(clock_.deltat(), 0.25));
+        interactiveGrid_->flushVertexData(); // cell changes of this frame (input, automaton, outer influence)
     }
 
     /* This SGCT stage draws the scene to the current back buffer (left, right or both).
@@ -130,7 +172,7 @@ namespace viscom {
     {
         int transNr;
         switch (packageID) {
-        case 0:
+        case PACKAGE_TRANSITION_NR:
         {
             transNr = *reinterpret_cast<int*>(receivedData);
             bool newSlave = true;
@@ -148,6 +190,16 @@ namespace viscom {
             }
         }
         return true;
+        case PACKAGE_FULL_SYNC_REQUEST:
+            fullSyncRequested_ = true;
+            return true;
+        case PACKAGE_SNAPSHOT_REQUEST:
+        {
+            // called from the network thread: snapshot is encoded in the next sync stage
+            std::lock_guard<std::mutex> lock(snapshotMtx_);
+            snapshotRequests_.push_back(clientID);
+        }
+        return true;
         default: return false;
         }
     }
@@ -272,6 +324,27 @@ namespace viscom {
                 }
             }
 
+            ImGui::Spacing();
+            if (ImGui::CollapsingHeader("GL State (last frame)"))
+            {
+                const roomgame::GLStateCache::FrameStats& glStats = roomgame::GLStateCache::current().getLastFrameStats();
+                auto statLine = [](const char* name, const roomgame::GLStateCache::Stats& s) {
+                    ImGui::Text("%s: %llu of %llu calls skipped", name, s.skipped(), s.requested);
+                };
+                statLine("Programs", glStats.programs);
+                statLine("Vertex arrays", glStats.vertexArrays);
+                statLine("Textures", glStats.textures);
+                statLine("Samplers", glStats.samplers);
+                statLine("Blend", glStats.blend);
+                const roomgame::ShadowMapCache::Stats& smStats = shadowMapCache_.getStats();
+                ImGui::Text("Shadow map: terrain rendered in %llu, room meshes in %llu of %llu passes",
+                    smStats.staticRenders, smStats.cachedRenders, smStats.passes);
+                ImGui::Text("Shadow map: %dx%d, light frustum fitted %llu times",
+                    shadowMapCache_.getSize(), shadowMapCache_.getSize(), smStats.fits);
+            }
+
+
+            if (loopback_) DrawLoopbackStats();
 
             ImGui::Spacing();
             gameLost_ ? ImGui::Text("Game Lost: yes"):ImGui::Text("Game Lost: no");
@@ -282,11 +355,72 @@ namespace viscom {
         ApplicationNodeImplementation::Draw2D(fbo);
     }
 
+    /* Loopback harness panel: transport settings and sync statistics (called inside the controls window) */
+    void MasterNode::DrawLoopbackStats() {
+        ImGui::Spacing();
+        if (ImGui::CollapsingHeader("Loopback Cluster"))
+        {
+            roomgame::LoopbackCluster::TransportSettings& transport = loopback_->transport();
+            ImGui::SliderInt("Min latency (frames)", &transport.min_latency_frames, 0, 10);
+            ImGui::SliderInt("Max latency (frames)", &transport.max_latency_frames, 0, 10);
+            ImGui::SliderFloat("Reorder probability", &transport.reorder_probability, 0.0f, 1.0f);
+            ImGui::SliderFloat("Drop probability", &transport.drop_probability, 0.0f, 1.0f);
+            if (ImGui::Button("Reset Stats")) loopback_->resetStats();
+
+            const roomgame::LoopbackCluster::Stats& stats = loopback_->stats();
+            const double frames = static_cast<double>(max(stats.frames, 1ULL));
+            ImGui::Text("Bytes/frame: %zu (avg %.0f, max %zu)", stats.bytes_last, stats.bytes_total / frames, stats.bytes_max);
+            ImGui::Text("Encode: avg %.3f ms, max %.3f ms", 1000.0 * stats.encode_seconds_total / frames, 1000.0 * stats.encode_seconds_max);
+            ImGui::Text("Quantization clamps: %llu", roomgame::quantization::clampCount());
+            const auto& slaveStats = loopback_->slaveStats();
+            for (size_t i = 0; i < slaveStats.size(); i++) {
+                const auto& st = slaveStats[i];
+                const double decoded = static_cast<double>(max(st.frames_decoded, 1ULL));
+                ImGui::Text("Slave %zu: decode avg %.3f ms, lag %llu, divergent %llu, dropped %llu, stale %llu, errors %llu, full frames %llu",
+                    i, 1000.0 * st.decode_seconds_total / decoded, st.current_lag,
+                    st.frames_divergent, st.frames_dropped, st.frames_stale, st.decode_errors, st.full_frames_requested);
+            }
+        }
+    }
+
+    /* Loopback harness: execute scripted session commands due in this frame */
+    void MasterNode::RunLoopbackScript() {
+        for (const auto& cmd : loopbackScript_.due(frameNr_)) {
+            if (cmd.name == "build" && cmd.args.size() >= 3) {
+                meshInstanceBuilder_->buildAt(static_cast<size_t>(cmd.args[0]), static_cast<size_t>(cmd.args[1]),
+                    static_cast<GLuint>(cmd.args[2]), MeshInstanceBuilder::BuildMode::Replace);
+            }
+            else if (cmd.name == "reset") {
+                resetPlaygroundValues();
+                reset();
+            }
+            else if (cmd.name == "transport" && cmd.args.size() >= 4) {
+                roomgame::LoopbackCluster::TransportSettings& transport = loopback_->transport();
+                transport.min_latency_frames = static_cast<int>(cmd.args[0]);
+                transport.max_latency_frames = static_cast<int>(cmd.args[1]);
+                transport.reorder_probability = cmd.args[2];
+                transport.drop_probability = cmd.args[3];
+            }
+            else if (cmd.name == "stats") {
+                loopback_->printStats(std::cout);
+            }
+            else if (cmd.name == "quit") {
+                loopback_->printStats(std::cout);
+                sgct::Engine::instance()->terminate();
+            }
+            else {
+                std::cerr << "Loopback script: invalid command '" << cmd.name << "' in frame " << cmd.frame << std::endl;
+            }
+        }
+    }
+
     void MasterNode::PostDraw() {
         ApplicationNodeImplementation::PostDraw();
     }
 
     void MasterNode::CleanUp() {
+        if (loopback_) loopback_->printStats(std::cout);
+        loopback_.reset(); // replicas hold GL objects (outer influence mesh)
         interactiveGrid_->cleanup();
         cellular_automaton_->cleanup();
         ApplicationNodeImplementation::CleanUp();
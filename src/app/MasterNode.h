@@ -9,16 +9,23 @@
 #pragma once
 
 
+#include <atomic>
 #include <mutex>
 #include <vector>
 
 #include "glm\gtx\quaternion.hpp"
 
 #include "../app/ApplicationNodeImplementation.h"
+#include "roomgame/LoopbackCluster.h"
 #include "core\camera\ArcballCamera.h"
 #ifdef WITH_TUIO
 #include "core/TuioInputWrapper.h"
 #endif
+// Number of in-process loopback slaves (0 disables the loopback harness)
+#ifndef VISCOM_LOOPBACK_SLAVES
+#define VISCOM_LOOPBACK_SLAVES 0
+#endif
+
 namespace roomgame
 {
     class InnerInfluence;
@@ -149,5 +156,22 @@ namespace viscom {
         void resetPlaygroundValues();
         bool isGameLost();
         std::list<TransitionMsg> slaveTransitionNumbers_;
+
+        /* Slaves waiting for a full-state snapshot (filled by DataTransferCallback) */
+        std::mutex snapshotMtx_;
+        std::vector<int> snapshotRequests_;
+        void ServeSnapshotRequests();
+        std::atomic<bool> fullSyncRequested_{ false }; // a slave needs all sync objects (set by DataTransferCallback)
+
+        /* Loopback harness: in-process slaves decoding every encoded frame (see LoopbackCluster)
+         * Each slave decodes into its own replicas of the sync objects, the shared objects of this node stay untouched.
+        */
+        std::unique_ptr<roomgame::LoopbackCluster> loopback_;
+        roomgame::LoopbackScript loopbackScript_;
+        roomgame::MemorySyncStream loopbackStream_; // encoded frame, also sent to the cluster
+        unsigned long long frameNr_ = 0;
+        void EncodeLoopbackFrame(roomgame::SyncStream& out);
+        void RunLoopbackScript();
+        void DrawLoopbackStats();
     };
 }
@@ -8,17 +8,28 @@
 
 #include "SlaveNode.h"
 #include <imgui.h>
+#include <iostream>
 
 namespace viscom {
 
     SlaveNode::SlaveNode(ApplicationNodeInternal* appNode) :
-        SlaveNodeInternal{ appNode }
+        SlaveNodeInternal{ appNode },
+        interpolator_(VISCOM_SLAVE_RENDER_DELAY_MS / 1000.0, VISCOM_SLAVE_MAX_EXTRAPOLATION_MS / 1000.0)
     {
+        shadowMapSize_ = VISCOM_SLAVE_SHADOW_MAP_SIZE;
     }
 
 
     void SlaveNode::UpdateFrame(double t1, double t2) {
         ApplicationNodeImplementation::UpdateFrame(t1, t2);
+        // render interpolated (or, if the sync is late, extrapolated) dynamic state
+        roomgame::SyncInterpolator::State state;
+        if (interpolator_.sample(glfwGetTime(), state)) {
+            grid_translation_ = state.grid_translation;
+            automatonUpdater_.automaton_transition_time_delta_ = state.automaton_time_delta;
+        }
+        // outer influence moves locally between the states synced by master (same step as master's update loop)
+        outerInfluence_->UpdateLocal(min(clock_.deltat(), 0.25));
     }
 
     void SlaveNode::Draw2D(FrameBuffer& fbo)
@@ -32,6 +43,11 @@ namespace viscom {
         ApplicationNodeImplementation::PostDraw();
     }
 
+    void SlaveNode::CleanUp() {
+        interpolator_.printStats(std::cout);
+        SlaveNodeInternal::CleanUp();
+    }
+
     SlaveNode::~SlaveNode() = default;
 
     /* Sync step 1: Slave nodes fetch the data shared by master node here 
@@ -39,14 +55,8 @@ namespace viscom {
     */
     void SlaveNode::DecodeData() {
         SlaveNodeInternal::DecodeData();
-        sourceLightManager_->decode();
-        outerInfluence_->MeshComponent->decode();
-        meshpool_.decode();
-        sgct::SharedData::instance()->readObj<glm::vec3>(&synchronized_grid_translation_);
-        automatonUpdater_.decode();
-        sgct::SharedData::instance()->readBool(&gameLostShared);
-        sgct::SharedData::instance()->readInt32(&currentScoreShared);
-        sgct::SharedData::instance()->readInt32(&highestScoreThisSessionShared);
+        roomgame::SGCTSyncStream in;
+        DecodeSyncedState(in);
     }
 
     /* Sync step 2: Slaves set their copies of cluster-wide variables to values received from master 
@@ -54,23 +64,71 @@ namespace viscom {
     */
     void SlaveNode::UpdateSyncedInfo() {
         SlaveNodeInternal::UpdateSyncedInfo();
-        sourceLightManager_->updateSyncedSlave();
-        outerInfluence_->MeshComponent->updateSyncedSlave();
-        meshpool_.updateSyncedSlave();
-        grid_translation_ = synchronized_grid_translation_.getVal();
-        automatonUpdater_.updateSyncedSlave();
+        syncGeneration_ = synchronized_generation_.getVal();
+        RequestOrLoadSnapshot();
+        syncRegistry_.updateSyncedSlave(); // applies only objects received since the last frame
+        // keyframes from the received values (UpdateFrame overwrites the live values with interpolated ones)
+        if (syncRegistry_.wasApplied("grid translation") || syncRegistry_.wasApplied("automaton time delta")) {
+            interpolator_.push(synchronized_sync_time_.getVal(), glfwGetTime(),
+                { roomgame::dequantizePosition(synchronized_grid_translation_.getVal()),
+                automatonUpdater_.synchronized_automaton_transition_time_delta_.getVal() });
+        }
+        else {
+            interpolator_.confirm(synchronized_sync_time_.getVal(), glfwGetTime());
+        }
         ConfirmCurrentState();
-        gameLost_ = gameLostShared.getVal();
-        currentScore = currentScoreShared.getVal();
-        highestScoreThisSession = highestScoreThisSessionShared.getVal();
     }
 
     void SlaveNode::ConfirmCurrentState() const
     {
         sgct::Engine::instance()->transferDataToNode(
             &automatonUpdater_.automatonTransitionNr_,
-            sizeof(int), 0,
+            sizeof(int), PACKAGE_TRANSITION_NR,
             0);
     }
 
+    /* A (re)started slave asks the master for a full-state snapshot once and loads it when it arrives
+     * Loaded before the synced updates, so state received with this frame's sync data stays on top
+    */
+    void SlaveNode::RequestOrLoadSnapshot()
+    {
+        if (!snapshotRequested_) {
+            int dummy = 0;
+            sgct::Engine::instance()->transferDataToNode(&dummy, sizeof(int), PACKAGE_SNAPSHOT_REQUEST, 0);
+            snapshotRequested_ = true;
+        }
+        std::vector<unsigned char> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(snapshotMtx_);
+            snapshot.swap(pendingSnapshot_);
+        }
+        if (snapshot.empty()) return;
+        roomgame::MemorySyncStream in(std::move(snapshot));
+        try {
+            if (LoadSnapshot(in)) {
+                // sync objects received after the snapshot was taken were overwritten: get all of them again
+                int dummy = 0;
+                sgct::Engine::instance()->transferDataToNode(&dummy, sizeof(int), PACKAGE_FULL_SYNC_REQUEST, 0);
+            }
+        }
+        catch (const std::out_of_range&) {
+            std::cerr << "Snapshot truncated, ignored." << std::endl;
+        }
+    }
+
+    bool SlaveNode::DataTransferCallback(void* receivedData, int receivedLength, int packageID, int clientID)
+    {
+        switch (packageID) {
+        case PACKAGE_SNAPSHOT:
+        {
+            // called from the network thread: snapshot is loaded in the next UpdateSyncedInfo
+            const unsigned char* data = reinterpret_cast<const unsigned char*>(receivedData);
+            std::lock_guard<std::mutex> lock(snapshotMtx_);
+            pendingSnapshot_.assign(data, data + receivedLength);
+        }
+        return true;
+        default: return false;
+        }
+    }
+
 }
@@ -8,11 +8,29 @@
 
 #pragma once
 
+#include <mutex>
+#include <vector>
 #include "core/SlaveNodeHelper.h"
+#include "roomgame/SyncInterpolator.h"
+
+// Render delay of slaves behind the synced state (about one sync interval, so regular frames interpolate)
+#ifndef VISCOM_SLAVE_RENDER_DELAY_MS
+#define VISCOM_SLAVE_RENDER_DELAY_MS 16
+#endif
+// Maximum time slaves extrapolate the synced state if a sync is late
+#ifndef VISCOM_SLAVE_MAX_EXTRAPOLATION_MS
+#define VISCOM_SLAVE_MAX_EXTRAPOLATION_MS 100
+#endif
+// Resolution of the sun shadow map on slaves (fitted to the part of the scene a slave sees)
+#ifndef VISCOM_SLAVE_SHADOW_MAP_SIZE
+#define VISCOM_SLAVE_SHADOW_MAP_SIZE 1024
+#endif
 
 namespace viscom {
 
-    /* Roomgame currently has no data exclusive to slave nodes */
+    /* Roomgame slave node
+     * Only data exclusive to slave nodes: state of the late-join snapshot and the sync interpolation
+    */
     class SlaveNode final : public SlaveNodeInternal {
     public:
 
@@ -22,11 +40,18 @@ namespace viscom {
 		void UpdateSyncedInfo() override;
 
         void ConfirmCurrentState() const;
+        void RequestOrLoadSnapshot();
+        bool DataTransferCallback(void* receivedData, int receivedLength, int packageID, int clientID) override;
 
 		void UpdateFrame(double, double) override;
         void Draw2D(FrameBuffer& fbo) override;
 		virtual void PostDraw() override;
+        void CleanUp() override;
     private:
         int automatonTransitionNr_ = 0;
+        bool snapshotRequested_ = false;
+        std::mutex snapshotMtx_;
+        std::vector<unsigned char> pendingSnapshot_; // filled by DataTransferCallback
+        roomgame::SyncInterpolator interpolator_;
     };
 }
@@ -16,56 +16,49 @@
 
 namespace roomgame {
 
-    /* Raw instance data that must stay memcpy-able */
+    /* Raw instance data that must stay memcpy-able
+     * Only what differs between instances on the same cell: the cell and the build state bits of the mesh.
+     * Translation and scale follow from the cell (grid uniforms), health is fetched from the grid state texture.
+     * Everything is packed into one 32 bit word (4 bytes per instance):
+     * column (bits 0-8), row (bits 9-17) and build state (bits 18-31, all bits up to REPAIRING).
+    */
     struct PerInstanceData {
-        glm::vec3 translation = glm::vec3(0); // local translation
-        GLfloat scale = 0.0f; // scale
-        GLuint buildState = 0; // build state (a value from GLuint buildState)
-        GLuint health = 0; // health points in [0, 100]
+        static const GLuint CELL_BITS = 9; // per axis, so grids are limited to MAX_CELLS_PER_AXIS (must match the shaders)
+        static const GLuint MAX_CELLS_PER_AXIS = 1 << CELL_BITS;
+        static const GLuint BUILD_STATE_SHIFT = 2 * CELL_BITS;
+        GLuint packed = 0; // see pack
+        static GLuint pack(size_t col, size_t row, GLuint buildState) {
+            const GLuint cellMask = MAX_CELLS_PER_AXIS - 1;
+            return (static_cast<GLuint>(col) & cellMask) | ((static_cast<GLuint>(row) & cellMask) << CELL_BITS) | (buildState << BUILD_STATE_SHIFT);
+        }
         static const void setAttribPointer() {
-            GLint transLoc = 3;
-            GLint scaleLoc = 4;
-            GLint buildStateLoc = 5;
-            GLint healthLoc = 6;
-            glEnableVertexAttribArray(transLoc);
-            glEnableVertexAttribArray(scaleLoc);
-            glEnableVertexAttribArray(buildStateLoc);
-            glEnableVertexAttribArray(healthLoc);
-            size_t off = 0;
-            glVertexAttribPointer(transLoc, 3, GL_FLOAT, false, sizeof(PerInstanceData), (GLvoid*)off);
-            off += 3 * sizeof(GLfloat);
-            glVertexAttribPointer(scaleLoc, 1, GL_FLOAT, false, sizeof(PerInstanceData), (GLvoid*)off);
-            off += sizeof(GLfloat);
-            glVertexAttribIPointer(buildStateLoc, 1, GL_UNSIGNED_INT, sizeof(PerInstanceData), (GLvoid*)off);
-            off += sizeof(GLuint);
-            glVertexAttribIPointer(healthLoc, 1, GL_UNSIGNED_INT, sizeof(PerInstanceData), (GLvoid*)off);
-            glVertexAttribDivisor(transLoc, 1);
-            glVertexAttribDivisor(scaleLoc, 1);
-            glVertexAttribDivisor(buildStateLoc, 1);
-            glVertexAttribDivisor(healthLoc, 1);
+            GLint instanceLoc = 3;
+            glEnableVertexAttribArray(instanceLoc);
+            glVertexAttribIPointer(instanceLoc, 1, GL_UNSIGNED_INT, sizeof(PerInstanceData), (GLvoid*)0);
+            glVertexAttribDivisor(instanceLoc, 1);
         }
-        static const void updateHealth(GLuint buffer, int offset_instances, GLuint hp) {
-            glBindBuffer(GL_ARRAY_BUFFER, buffer);
-            glBufferSubData(GL_ARRAY_BUFFER,
-                (offset_instances + 1) * sizeof(PerInstanceData) - sizeof(health),
-                sizeof(health), &hp);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        // Vertex buffer binding point of the instance attributes (separate from the per-vertex bindings)
+        static const GLuint BINDING = 3;
+        // Same layout as setAttribPointer, but sourced from BINDING (buffer is attached with bindBuffer)
+        static const void setAttribFormat() {
+            GLint instanceLoc = 3;
+            glEnableVertexAttribArray(instanceLoc);
+            glVertexAttribIFormat(instanceLoc, 1, GL_UNSIGNED_INT, 0);
+            glVertexAttribBinding(instanceLoc, BINDING);
+            glVertexBindingDivisor(BINDING, 1);
+        }
+        // Attach an instance buffer to the bound VAO (swapping buffers does not touch the attribute formats)
+        static const void bindBuffer(GLuint buffer) {
+            glBindVertexBuffer(BINDING, buffer, 0, sizeof(PerInstanceData));
         }
-
         //Is this needed?
         PerInstanceData() :
-            translation(glm::vec3(0)),
-            scale(0.0f),
-            buildState(0),
-            health(0)
+            packed(0)
         {}
 
         //Is this needed?
         PerInstanceData& operator =(const PerInstanceData& other) {
-            translation = other.translation;
-            scale = other.scale;
-            buildState = other.buildState;
-            health = other.health;
+            packed = other.packed;
             return *this;
         }
     };
@@ -74,8 +67,8 @@ namespace roomgame {
     struct InstanceBuffer {
         GLuint id_; // GL handle (do not sync)
         int num_instances_; // current size
-        const size_t pool_allocation_bytes_; // chunk size for reallocations (need not sync since const)
-        int num_reallocations_; // current number of reallocations
+        const size_t pool_allocation_bytes_; // initial capacity (need not sync since const)
+        int num_reallocations_; // current capacity level (capacity doubles with each level, starts at 1)
         InstanceBuffer(size_t pool_allocation_bytes) :
             pool_allocation_bytes_(pool_allocation_bytes),
             num_instances_(0),
@@ -87,6 +80,9 @@ namespace roomgame {
             glBufferData(GL_ARRAY_BUFFER, pool_allocation_bytes_, (GLvoid*)0, GL_STATIC_DRAW);
             glBindBuffer(GL_ARRAY_BUFFER, 0);
         }
+        size_t capacityBytes(int num_reallocations) const {
+            return pool_allocation_bytes_ << (num_reallocations - 1);
+        }
     };
 
 }
@@ -1,6 +1,7 @@
 #include "AutomatonUpdater.h"
 #include "GPUCellularAutomaton.h"
 #include "InteractiveGrid.h"
+#include "GLStateCache.h"
 namespace roomgame
 {
     AutomatonUpdater::AutomatonUpdater()
@@ -21,6 +22,10 @@ namespace roomgame
         //}
     }
 
+    void AutomatonUpdater::cleanup() {
+        synchronized_grid_state_.cleanup();
+    }
+
     void AutomatonUpdater::setCellularAutomaton(GPUCellularAutomaton* automaton) {
         automaton_ = automaton;
     }
@@ -44,7 +49,7 @@ namespace roomgame
 
         // Do instant update for all other cases
         meshInstanceBuilder_->buildAt(c, state, MeshInstanceBuilder::BuildMode::Replace);
-        c->updateHealthPoints(interactiveGrid_->vbo_, hp); // thinking of dynamic inner influence...
+        c->updateHealthPoints(hp); // thinking of dynamic inner influence...
                                          // a fixed-on-cell health is not very practical
     }
 
@@ -92,10 +97,13 @@ namespace roomgame
         if (currGridStateTexID <= 0 || lastGridStateTexID <= 0) {
             return;
         }
-        // Grid state: type UINT has to be converted to UNORM to make use of bilinear interpolation when rendering
-        glBindTexture(GL_TEXTURE_2D, lastGridStateTexID);
         const auto numCols = static_cast<GLsizei>(interactiveGrid_->getNumColumns());
         const auto numRows = static_cast<GLsizei>(interactiveGrid_->getNumRows());
+        if (!masterNode && uploadStagedGridStateToGPU(numCols, numRows)) {
+            return;
+        }
+        // Grid state: type UINT has to be converted to UNORM to make use of bilinear interpolation when rendering
+        GLStateCache::current().bindTextureForTransfer(lastGridStateTexID);
         glTexImage2D(GL_TEXTURE_2D, 0,
             // 32 bit UNORM means 1.0F is represented by (2^31 - 1)U
             roomgame::FILTERABLE_GRID_STATE_TEXTURE.sized_format,
@@ -107,15 +115,16 @@ namespace roomgame
             grid_state_.data());
         if (masterNode)
         {
-            grid_state_ = std::vector<roomgame::GRID_STATE_ELEMENT>(
+            // assign keeps the capacity of the last transition
+            grid_state_.assign(
                 automaton_->getGridBuffer(),
                 automaton_->getGridBuffer() + automaton_->getGridBufferElements());
         }
         else
         {
-            grid_state_ = synchronized_grid_state_.getVal(); // fetch new Grid state
+            synchronized_grid_state_.swapReceived(grid_state_); // fetch new Grid state
         }
-        glBindTexture(GL_TEXTURE_2D, currGridStateTexID);
+        GLStateCache::current().bindTextureForTransfer(currGridStateTexID);
         glTexImage2D(GL_TEXTURE_2D, 0,
             roomgame::FILTERABLE_GRID_STATE_TEXTURE.sized_format,
             numCols, numRows, 0,
@@ -124,6 +133,135 @@ namespace roomgame
             grid_state_.data());
     }
 
+    void AutomatonUpdater::registerSyncObjects(SyncRegistry& registry) {
+        // decode and apply run on the updater's objects and on those of its loopback replicas
+        auto decodeTimeDelta = [](SyncStream& in, sgct::SharedFloat& shared) {
+            in.readFloat(&shared);
+        };
+        auto applyTimeDelta = [](sgct::SharedFloat& shared, float& timeDelta) {
+            timeDelta = shared.getVal();
+        };
+        registry.add({ "automaton time delta",
+            [this]() { return time_delta_changes_.update(automaton_transition_time_delta_); },
+            [this]() { synchronized_automaton_transition_time_delta_.setVal(automaton_transition_time_delta_); },
+            [this](SyncStream& out) { out.writeFloat(&synchronized_automaton_transition_time_delta_); },
+            [this, decodeTimeDelta](SyncStream& in) { decodeTimeDelta(in, synchronized_automaton_transition_time_delta_); },
+            [this, applyTimeDelta]() { applyTimeDelta(synchronized_automaton_transition_time_delta_, automaton_transition_time_delta_); },
+            [this, decodeTimeDelta, applyTimeDelta]() {
+                struct TimeDeltaReplica {
+                    sgct::SharedFloat shared;
+                    float time_delta = 0.0f;
+                };
+                auto replica = std::make_shared<TimeDeltaReplica>();
+                return SyncRegistry::Replica{
+                    [replica, decodeTimeDelta](SyncStream& in) { decodeTimeDelta(in, replica->shared); },
+                    [replica, applyTimeDelta]() { applyTimeDelta(replica->shared, replica->time_delta); },
+                    [this, replica]() { return replica->time_delta == automaton_transition_time_delta_; } };
+            } });
+        auto decodeTransition = [](SyncStream& in, sgct::SharedBool& hasTransitioned, SharedBuffer<GRID_STATE_ELEMENT>& gridState) {
+            in.readBool(&hasTransitioned);
+            gridState.decode(in);
+        };
+        // the flag toggles with each transition: true if a new one arrived
+        auto receiveTransition = [](sgct::SharedBool& shared, bool& hasTransitioned) {
+            bool oldVal = hasTransitioned;
+            hasTransitioned = shared.getVal();
+            return oldVal != hasTransitioned;
+        };
+        registry.add({ "automaton transition",
+            [this]() { return static_cast<unsigned long long>(automatonTransitionNr_); },
+            [this]() { synchronized_automaton_has_transitioned_.setVal(automaton_has_transitioned_); },
+            [this](SyncStream& out) {
+                out.writeBool(&synchronized_automaton_has_transitioned_);
+                synchronized_grid_state_.encode(out, grid_state_);
+            },
+            [this, decodeTransition](SyncStream& in) { decodeTransition(in, synchronized_automaton_has_transitioned_, synchronized_grid_state_); },
+            [this, receiveTransition]() {
+                prepareGridStateStaging();
+                if (receiveTransition(synchronized_automaton_has_transitioned_, automaton_has_transitioned_)) {
+                    automatonTransitionNr_++;
+                    uploadGridStateToGPU(false);
+                }
+            },
+            [this, decodeTransition, receiveTransition]() {
+                // takes the grid state like uploadGridStateToGPU on a slave without staging buffer (no textures)
+                struct TransitionReplica {
+                    sgct::SharedBool shared_has_transitioned;
+                    SharedBuffer<GRID_STATE_ELEMENT> shared_grid_state;
+                    bool has_transitioned = false;
+                    std::vector<GRID_STATE_ELEMENT> grid_state;
+                };
+                auto replica = std::make_shared<TransitionReplica>();
+                return SyncRegistry::Replica{
+                    [replica, decodeTransition](SyncStream& in) { decodeTransition(in, replica->shared_has_transitioned, replica->shared_grid_state); },
+                    [replica, receiveTransition]() {
+                        if (receiveTransition(replica->shared_has_transitioned, replica->has_transitioned)) {
+                            replica->shared_grid_state.swapReceived(replica->grid_state);
+                        }
+                    },
+                    [this, replica]() { return replica->has_transitioned == automaton_has_transitioned_ && replica->grid_state == grid_state_; } };
+            } });
+    }
+
+    void AutomatonUpdater::encodeSnapshot(SyncStream& out) {
+        out.writeValue<int32_t>(automatonTransitionNr_);
+        out.writeValue<bool>(automaton_has_transitioned_);
+        out.writeValue<float>(automaton_transition_time_delta_);
+        out.writeArray(grid_state_);
+    }
+
+    void AutomatonUpdater::loadSnapshot(SyncStream& in) {
+        automatonTransitionNr_ = in.readValue<int32_t>();
+        automaton_has_transitioned_ = in.readValue<bool>();
+        automaton_transition_time_delta_ = in.readValue<float>();
+        in.readArray(grid_state_);
+        if (currGridStateTexID <= 0 || lastGridStateTexID <= 0 || grid_state_.empty()) {
+            return;
+        }
+        // no transition to interpolate from: current and last state are the same
+        const auto numCols = static_cast<GLsizei>(interactiveGrid_->getNumColumns());
+        const auto numRows = static_cast<GLsizei>(interactiveGrid_->getNumRows());
+        for (GLuint tex : { lastGridStateTexID, currGridStateTexID }) {
+            GLStateCache::current().bindTextureForTransfer(tex);
+            glTexImage2D(GL_TEXTURE_2D, 0,
+                roomgame::FILTERABLE_GRID_STATE_TEXTURE.sized_format,
+                numCols, numRows, 0,
+                roomgame::FILTERABLE_GRID_STATE_TEXTURE.format,
+                roomgame::FILTERABLE_GRID_STATE_TEXTURE.datatype,
+                grid_state_.data());
+        }
+    }
+
+    void AutomatonUpdater::prepareGridStateStaging() {
+        // staged path needs a GPU-side copy of the current grid state texture
+        if (!GLEW_ARB_copy_image || !interactiveGrid_) return;
+        synchronized_grid_state_.allocStaging(
+            interactiveGrid_->getNumColumns() * interactiveGrid_->getNumRows() * roomgame::GRID_STATE_TEXTURE_CHANNELS);
+    }
+
+    bool AutomatonUpdater::uploadStagedGridStateToGPU(GLsizei numCols, GLsizei numRows) {
+        GLuint pbo;
+        GLintptr offset;
+        size_t numElements;
+        if (!synchronized_grid_state_.acquireStaged(pbo, offset, numElements)) {
+            return false;
+        }
+        // old state stays on the GPU: copy current to last texture
+        glCopyImageSubData(currGridStateTexID, GL_TEXTURE_2D, 0, 0, 0, 0,
+            lastGridStateTexID, GL_TEXTURE_2D, 0, 0, 0, 0,
+            numCols, numRows, 1);
+        // new state: staging buffer is source of the pixel transfer
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        GLStateCache::current().bindTextureForTransfer(currGridStateTexID);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, numCols, numRows,
+            roomgame::FILTERABLE_GRID_STATE_TEXTURE.format,
+            roomgame::FILTERABLE_GRID_STATE_TEXTURE.datatype,
+            reinterpret_cast<const GLvoid*>(offset));
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        synchronized_grid_state_.releaseStaged();
+        return true;
+    }
+
 
     void AutomatonUpdater::populateCircleAtLastMousePosition(int radius) {
         /*
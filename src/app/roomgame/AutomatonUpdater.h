@@ -3,6 +3,8 @@
 #include <functional>
 #include "GridCell.h"
 #include "MeshInstanceBuilder.h"
+#include "SharedBuffer.h"
+#include "SyncRegistry.h"
 
 namespace roomgame
 {
@@ -31,6 +33,11 @@ namespace roomgame
         void updateGridAt(GridCell* c, GLuint state, GLuint hp);
         friend GPUCellularAutomaton; // allow private access
 
+        // Slave: allocate staging buffer for the grid state (no-op if already allocated or unsupported)
+        void prepareGridStateStaging();
+        // Slave: upload received grid state without leaving the GPU, returns false if not staged
+        bool uploadStagedGridStateToGPU(GLsizei numCols, GLsizei numRows);
+
 
     public:
         GPUCellularAutomaton* automaton_;
@@ -41,8 +48,8 @@ namespace roomgame
         bool automaton_has_transitioned_;
         GLuint currGridStateTexID;
         GLuint lastGridStateTexID;
-        // use vector although grid state is not dynamic because sgct provides no shared array
-        sgct::SharedVector<roomgame::GRID_STATE_ELEMENT> synchronized_grid_state_;
+        // slaves receive the grid state in a staging buffer that is used as pixel unpack buffer
+        SharedBuffer<roomgame::GRID_STATE_ELEMENT> synchronized_grid_state_;
         std::vector<roomgame::GRID_STATE_ELEMENT> grid_state_;
 
         // Update automaton (called from user input or outer influence through buildAt)
@@ -58,32 +65,21 @@ namespace roomgame
         void onTransition();
         void updateMaster(double currentTimeInSec);
         void uploadGridStateToGPU(bool masterNode);
+        // Release GL objects (staging buffer of the synced grid state)
+        void cleanup();
+        // Late-join snapshot: transition state and full grid state
+        void encodeSnapshot(SyncStream& out); // master
+        void loadSnapshot(SyncStream& in); // slave
         void populateCircleAtLastMousePosition(int radius);
 
-        void preSync() { // master
-            synchronized_automaton_transition_time_delta_.setVal(automaton_transition_time_delta_);
-            synchronized_automaton_has_transitioned_.setVal(automaton_has_transitioned_);
-            synchronized_grid_state_.setVal(grid_state_);
-        }
-        void encode() { // master
-            sgct::SharedData::instance()->writeFloat(&synchronized_automaton_transition_time_delta_);
-            sgct::SharedData::instance()->writeBool(&synchronized_automaton_has_transitioned_);
-            sgct::SharedData::instance()->writeVector(&synchronized_grid_state_);
-        }
-        void decode() { // slave
-            sgct::SharedData::instance()->readFloat(&synchronized_automaton_transition_time_delta_);
-            sgct::SharedData::instance()->readBool(&synchronized_automaton_has_transitioned_);
-            sgct::SharedData::instance()->readVector(&synchronized_grid_state_);
-        }
-        void updateSyncedSlave() {
-            automaton_transition_time_delta_ = synchronized_automaton_transition_time_delta_.getVal();
-            bool oldVal = automaton_has_transitioned_;
-            automaton_has_transitioned_ = synchronized_automaton_has_transitioned_.getVal();
-            if (oldVal != automaton_has_transitioned_) {
-                automatonTransitionNr_++;
-                uploadGridStateToGPU(false);
-            }
-        }
+        /* Two sync objects:
+         * Transition time delta (changes every frame while the automaton runs)
+         * Transition flag with grid state (changes only on transitions, grid state is not resent in between)
+        */
+        void registerSyncObjects(SyncRegistry& registry);
+
+    private:
+        ChangeTracker<float> time_delta_changes_;
 
     };
 }
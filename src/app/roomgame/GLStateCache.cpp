@@ -0,0 +1,156 @@
+#include "GLStateCache.h"
+#include <cstring>
+
+namespace roomgame
+{
+    GLStateCache::GLStateCache() :
+        blend_src_(GL_NONE), blend_dst_(GL_NONE)
+    {
+        std::memset(&frame_stats_, 0, sizeof(frame_stats_));
+        std::memset(&last_frame_stats_, 0, sizeof(last_frame_stats_));
+        invalidate();
+    }
+
+    GLStateCache& GLStateCache::current() {
+        static GLStateCache cache;
+        return cache;
+    }
+
+    void GLStateCache::useProgram(GLuint program) {
+        frame_stats_.programs.requested++;
+        if (program == program_) return;
+        glUseProgram(program);
+        program_ = program;
+        frame_stats_.programs.issued++;
+    }
+
+    void GLStateCache::bindVertexArray(GLuint vao) {
+        frame_stats_.vertexArrays.requested++;
+        if (vao == vao_) return;
+        glBindVertexArray(vao);
+        vao_ = vao;
+        frame_stats_.vertexArrays.issued++;
+    }
+
+    void GLStateCache::deleteVertexArray(GLuint vao) {
+        glDeleteVertexArrays(1, &vao);
+        if (vao == vao_) vao_ = UNKNOWN;
+    }
+
+    void GLStateCache::activeTexture(GLuint unit) {
+        frame_stats_.textures.requested++;
+        if (unit == active_unit_) return;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        active_unit_ = unit;
+        frame_stats_.textures.issued++;
+    }
+
+    void GLStateCache::bindTexture(GLuint unit, GLuint texture) {
+        frame_stats_.samplers.requested++;
+        const bool tracked = unit < MAX_TEXTURE_UNITS;
+        if (!tracked || samplers_[unit] != 0) {
+            glBindSampler(unit, 0);
+            if (tracked) samplers_[unit] = 0;
+            frame_stats_.samplers.issued++;
+        }
+        frame_stats_.textures.requested++;
+        if (tracked && textures_[unit] == texture) return;
+        activeTexture(unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        if (tracked) textures_[unit] = texture;
+        frame_stats_.textures.issued++;
+    }
+
+    void GLStateCache::bindTexture(GLuint unit, GLuint texture, const SamplerDesc& sampler) {
+        const GLuint samplerObject = getSampler(sampler);
+        const bool tracked = unit < MAX_TEXTURE_UNITS;
+        frame_stats_.samplers.requested++;
+        if (!tracked || samplers_[unit] != samplerObject) {
+            glBindSampler(unit, samplerObject); // no active unit needed
+            if (tracked) samplers_[unit] = samplerObject;
+            frame_stats_.samplers.issued++;
+        }
+        frame_stats_.textures.requested++;
+        if (tracked && textures_[unit] == texture) return;
+        activeTexture(unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        if (tracked) textures_[unit] = texture;
+        frame_stats_.textures.issued++;
+    }
+
+    void GLStateCache::bindTextureForTransfer(GLuint texture) {
+        frame_stats_.textures.requested++;
+        const bool tracked = active_unit_ < MAX_TEXTURE_UNITS;
+        if (tracked && textures_[active_unit_] == texture) return;
+        glBindTexture(GL_TEXTURE_2D, texture);
+        if (tracked) textures_[active_unit_] = texture;
+        frame_stats_.textures.issued++;
+    }
+
+    void GLStateCache::setBlend(bool enabled, GLenum srcFactor, GLenum dstFactor) {
+        frame_stats_.blend.requested++;
+        if (blend_enabled_ != (enabled ? 1 : 0)) {
+            if (enabled) glEnable(GL_BLEND);
+            else glDisable(GL_BLEND);
+            blend_enabled_ = enabled ? 1 : 0;
+            frame_stats_.blend.issued++;
+        }
+        if (!enabled) return;
+        frame_stats_.blend.requested++;
+        if (srcFactor == blend_src_ && dstFactor == blend_dst_) return;
+        glBlendFunc(srcFactor, dstFactor);
+        blend_src_ = srcFactor;
+        blend_dst_ = dstFactor;
+        frame_stats_.blend.issued++;
+    }
+
+    GLuint GLStateCache::getSampler(const SamplerDesc& desc) {
+        for (const std::pair<SamplerDesc, GLuint>& entry : sampler_objects_)
+            if (entry.first == desc) return entry.second;
+        GLuint sampler;
+        glGenSamplers(1, &sampler);
+        glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, desc.minFilter);
+        glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, desc.magFilter);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, desc.wrap);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, desc.wrap);
+        glSamplerParameterfv(sampler, GL_TEXTURE_BORDER_COLOR, &desc.borderColor[0]);
+        glSamplerParameteri(sampler, GL_TEXTURE_COMPARE_MODE, desc.compareMode);
+        if (desc.compareMode != GL_NONE) glSamplerParameteri(sampler, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        sampler_objects_.push_back({ desc, sampler });
+        return sampler;
+    }
+
+    void GLStateCache::releaseSamplers() {
+        for (GLuint unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+            if (samplers_[unit] == 0) continue;
+            glBindSampler(unit, 0);
+            samplers_[unit] = 0;
+        }
+    }
+
+    void GLStateCache::invalidate() {
+        program_ = UNKNOWN;
+        vao_ = UNKNOWN;
+        active_unit_ = UNKNOWN;
+        for (GLuint unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+            textures_[unit] = UNKNOWN;
+            samplers_[unit] = UNKNOWN;
+        }
+        blend_enabled_ = -1;
+        blend_src_ = GL_NONE;
+        blend_dst_ = GL_NONE;
+    }
+
+    void GLStateCache::beginFrame() {
+        last_frame_stats_ = frame_stats_;
+        std::memset(&frame_stats_, 0, sizeof(frame_stats_));
+        invalidate(); // framework GUI and buffer swap ran since the last frame
+    }
+
+    void GLStateCache::cleanup() {
+        for (const std::pair<SamplerDesc, GLuint>& entry : sampler_objects_)
+            glDeleteSamplers(1, &entry.second);
+        sampler_objects_.clear();
+        invalidate();
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <glm/glm.hpp>
+#include "core/open_gl.h"
+
+namespace roomgame
+{
+    /* Sampling parameters of an immutable sampler object (one sampler per combination in use, see GLStateCache) */
+    struct SamplerDesc {
+        GLint minFilter;
+        GLint magFilter;
+        GLint wrap; // S and T
+        glm::vec4 borderColor; // with GL_CLAMP_TO_BORDER
+        GLint compareMode; // GL_COMPARE_REF_TO_TEXTURE for shadow samplers
+        bool operator==(const SamplerDesc& o) const {
+            return minFilter == o.minFilter && magFilter == o.magFilter && wrap == o.wrap
+                && borderColor == o.borderColor && compareMode == o.compareMode;
+        }
+    };
+
+    // Combinations in use
+    const SamplerDesc LINEAR_REPEAT_SAMPLER = { GL_LINEAR, GL_LINEAR, GL_REPEAT, glm::vec4(0), GL_NONE }; // materials, caustics, post pass
+    const SamplerDesc NEAREST_REPEAT_SAMPLER = { GL_NEAREST, GL_NEAREST, GL_REPEAT, glm::vec4(0), GL_NONE }; // automaton (torus-shaped playing field)
+    const SamplerDesc GRID_STATE_SAMPLER = { GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_BORDER, glm::vec4(0, 0, 0, 1), GL_NONE }; // no build state outside the grid
+    const SamplerDesc SHADOW_MAP_SAMPLER = { GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_BORDER, glm::vec4(1), GL_NONE }; // no shadow outside the map
+    const SamplerDesc SHADOW_COMPARE_SAMPLER = { GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_BORDER, glm::vec4(1), GL_COMPARE_REF_TO_TEXTURE };
+    const SamplerDesc DEBUG_QUAD_SAMPLER = { GL_NEAREST, GL_NEAREST, GL_CLAMP_TO_BORDER, glm::vec4(1), GL_NONE };
+
+    /* Shadow of the GL binding state used by the render loop (one GL context per node, so one instance).
+     * Skips binds of programs, vertex arrays, 2D textures, samplers and blend state that are already current.
+     * Only valid as long as all binds go through it:
+     * Framework code (SGCT, ImGui, viscom quads) and raw binds (texture uploads) require invalidate() afterwards.
+     * Texture parameters are never touched per bind, textures are sampled through immutable sampler objects instead.
+     * Counts requested and issued calls per frame (see getLastFrameStats).
+    */
+    class GLStateCache {
+    public:
+        static const GLuint MAX_TEXTURE_UNITS = 16; // units tracked (higher units are always bound)
+
+        struct Stats {
+            unsigned long long requested;
+            unsigned long long issued;
+            unsigned long long skipped() const { return requested - issued; }
+        };
+        struct FrameStats {
+            Stats programs;
+            Stats vertexArrays;
+            Stats textures; // including active texture unit switches
+            Stats samplers;
+            Stats blend;
+        };
+
+        static GLStateCache& current();
+
+        void useProgram(GLuint program);
+        void bindVertexArray(GLuint vao);
+        void deleteVertexArray(GLuint vao); // the name may be reused, so it must not stay current
+        // Bind a 2D texture and the sampler object of desc to a unit
+        void bindTexture(GLuint unit, GLuint texture, const SamplerDesc& sampler);
+        void bindTexture(GLuint unit, GLuint texture); // sampling state of the texture itself
+        // Bind a 2D texture to the active unit for uploads and downloads (sampler unchanged)
+        void bindTextureForTransfer(GLuint texture);
+        void setBlend(bool enabled, GLenum srcFactor = GL_SRC_ALPHA, GLenum dstFactor = GL_ONE_MINUS_SRC_ALPHA);
+
+        // Sampler object of desc (created on first use, never modified afterwards)
+        GLuint getSampler(const SamplerDesc& desc);
+        // Unbind all sampler objects (before handing over to code that relies on texture parameters)
+        void releaseSamplers();
+        // Forget the shadowed state (after GL calls that bypass the cache)
+        void invalidate();
+        // Once per frame (before any GL work of the frame): keep the counters of the last frame, start anew and invalidate
+        void beginFrame();
+        const FrameStats& getLastFrameStats() const { return last_frame_stats_; }
+        void cleanup();
+
+    private:
+        GLStateCache();
+        void activeTexture(GLuint unit);
+
+        static const GLuint UNKNOWN = 0xFFFFFFFFu; // state not known, next bind is always issued
+        GLuint program_;
+        GLuint vao_;
+        GLuint active_unit_;
+        GLuint textures_[MAX_TEXTURE_UNITS];
+        GLuint samplers_[MAX_TEXTURE_UNITS];
+        int blend_enabled_; // -1 unknown
+        GLenum blend_src_;
+        GLenum blend_dst_;
+        std::vector<std::pair<SamplerDesc, GLuint>> sampler_objects_;
+        FrameStats frame_stats_;
+        FrameStats last_frame_stats_;
+    };
+}
@@ -1,4 +1,5 @@
 #include "GPUBuffer.h"
+#include "GLStateCache.h"
 #include <iostream>
 
 GPUBuffer::GPUBuffer() {
@@ -103,7 +104,7 @@ void GPUBuffer::bind_data(GLsizeiptr bytes, const GLvoid* pointer) {
 GLuint GPUBuffer::alloc_texture2D(GLsizei w, GLsizei h, GLint sized_format, GLenum format, GLenum type) {
     GLuint tex;
     glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
+    roomgame::GLStateCache::current().bindTextureForTransfer(tex);
     // format and type are irrelevant here because they refer to passed pixel data, which is 0 here
     // still they have to be compatible with sized_format, i.e. the format in which pixel data is converted by GL
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
@@ -115,7 +116,7 @@ GLuint GPUBuffer::alloc_texture2D(GLsizei w, GLsizei h, GLint sized_format, GLen
 GLuint GPUBuffer::alloc_immutable_format_texture2D(GLsizei w, GLsizei h, GLint sized_format, GLenum format, GLenum type) {
     GLuint tex;
     glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
+    roomgame::GLStateCache::current().bindTextureForTransfer(tex);
     // glTexStorage specifies an immutable-format texture,
     // which means glTexImage cannot be called because it might alter format (glTexSubImage is possible anyway)
     
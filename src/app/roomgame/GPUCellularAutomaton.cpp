@@ -3,6 +3,7 @@
 #include "GPUCellularAutomaton.h"
 #include "core/resources/GPUProgramManager.h"
 #include "InteractiveGrid.h"
+#include "GLStateCache.h"
 
 namespace roomgame
 {
@@ -60,7 +61,7 @@ namespace roomgame
         copyFromGridToTexture(0);
         // Screen filling quad
         glGenVertexArrays(1, &vao_);
-        glBindVertexArray(vao_);
+        GLStateCache::current().bindVertexArray(vao_);
         GLfloat quad[] = {
             // (x, y)      // (u, v)
             -1.0f,  1.0f,  0.0f, 1.0f, // top left
@@ -78,7 +79,7 @@ namespace roomgame
         glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (GLvoid*)(2 * sizeof(GLfloat)));
         glEnableVertexAttribArray(0);
         glEnableVertexAttribArray(1);
-        glBindVertexArray(0);
+        GLStateCache::current().bindVertexArray(0);
         is_initialized_ = true;
     }
 
@@ -93,7 +94,7 @@ namespace roomgame
                 tmp_client_buffer_[x * N_CH * rows + y + 1] = (roomgame::GRID_STATE_ELEMENT) c->getHealthPoints();
             }
         }
-        glBindTexture(GL_TEXTURE_2D, texture_pair_[pair_index].id);
+        GLStateCache::current().bindTextureForTransfer(texture_pair_[pair_index].id);
         glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (GLsizei)cols, (GLsizei)rows,
             texture_pair_[pair_index].format, texture_pair_[pair_index].datatype, tmp_client_buffer_);
     }
@@ -103,7 +104,7 @@ namespace roomgame
         size_t cols = interactiveGrid_->getNumRows();
         const unsigned int N_CH = roomgame::GRID_STATE_TEXTURE_CHANNELS;
         // download texture
-        glBindTexture(GL_TEXTURE_2D, texture_pair_[pair_index].id);
+        GLStateCache::current().bindTextureForTransfer(texture_pair_[pair_index].id);
         glGetTexImage(GL_TEXTURE_2D, 0, texture_pair_[pair_index].format,
             texture_pair_[pair_index].datatype, tmp_client_buffer_);
         // iterate over contents
@@ -130,7 +131,7 @@ namespace roomgame
             (buildState & GridCell::INFECTED) ? 0xFFFFFFFFU : 0,
             static_cast<roomgame::GRID_STATE_ELEMENT>(static_cast<float>(hp) / static_cast<float>(GridCell::MAX_HEALTH) * 0xFFFFFFFFU) 
         };
-        glBindTexture(GL_TEXTURE_2D, texture_pair_[current_read_index_].id);
+        GLStateCache::current().bindTextureForTransfer(texture_pair_[current_read_index_].id);
         glTexSubImage2D(GL_TEXTURE_2D, 0, (GLint)c->getCol(), (GLint)c->getRow(), 1, 1,
             texture_pair_[0].format, texture_pair_[0].datatype, data);
     }
@@ -155,18 +156,15 @@ namespace roomgame
         glViewport(0, 0, (GLsizei)interactiveGrid_->getNumColumns(), (GLsizei)interactiveGrid_->getNumRows());
         glDisable(GL_DEPTH_TEST);
         glClear(GL_COLOR_BUFFER_BIT);
-        glUseProgram(shader_->getProgramId());
-        glBindVertexArray(vao_);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture_pair_[current_read_index_].id);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT); // repeat makes a torus-shaped playing field
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        GLStateCache& state = GLStateCache::current();
+        state.useProgram(shader_->getProgramId());
+        state.bindVertexArray(vao_);
+        state.bindTexture(0, texture_pair_[current_read_index_].id, NEAREST_REPEAT_SAMPLER); // repeat makes a torus-shaped playing field
         glUniform1i(texture_uniform_location_, 0);
         glUniform2f(pixel_size_uniform_location_, pixel_size_.x, pixel_size_.y);
         glDrawArrays(GL_TRIANGLES, 0, 6);
-        glBindVertexArray(0);
+        state.bindVertexArray(0);
+        state.releaseSamplers(); // framework code samples with the texture parameters
         glEnable(GL_DEPTH_TEST);
         // Update grid
         automatonUpdater_->onTransition();
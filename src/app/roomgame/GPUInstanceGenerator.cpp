@@ -0,0 +1,107 @@
+#include "GPUInstanceGenerator.h"
+#include <algorithm>
+#include "GLStateCache.h"
+
+namespace roomgame
+{
+    GPUInstanceGenerator::GPUInstanceGenerator() :
+        program_(nullptr), renderer_(nullptr), counter_buffer_(0), draw_source_buffer_(0), uloc_grid_state_(-1), uloc_pass_(-1)
+    {
+    }
+
+    GPUInstanceGenerator::~GPUInstanceGenerator() {
+        cleanup();
+    }
+
+    bool GPUInstanceGenerator::isSupported() {
+        return MultiDrawRenderer::isSupported() && GLEW_ARB_compute_shader
+            && GLEW_ARB_shader_storage_buffer_object && GLEW_ARB_clear_buffer_object;
+    }
+
+    bool GPUInstanceGenerator::init(viscom::GPUProgram* program, MultiDrawRenderer& renderer, const std::vector<Mapping>& mappings, size_t numCells) {
+        cleanup();
+        if (!isSupported() || !renderer.isReady() || mappings.size() > MAX_MAPPINGS) return false;
+
+        // Aggregate all build states of a mesh (filter) and find the instance region of each mapping (getMeshOfType)
+        std::vector<RoomSegmentMesh*> meshes;
+        std::vector<GLuint> meshMasks;
+        std::vector<GLuint> mappingStates;
+        std::vector<GLint> mappingSources;
+        for (const Mapping& mapping : mappings) {
+            size_t m = std::find(meshes.begin(), meshes.end(), mapping.mesh) - meshes.begin();
+            if (m == meshes.size()) {
+                meshes.push_back(mapping.mesh);
+                meshMasks.push_back(0);
+            }
+            meshMasks[m] |= mapping.buildState;
+            size_t source = 0;
+            while (source < renderer.getNumSources() && renderer.getSource(source) != mapping.mesh) source++;
+            if (source == renderer.getNumSources()) return false;
+            mappingStates.push_back(mapping.buildState);
+            mappingSources.push_back(static_cast<GLint>(source));
+        }
+
+        // Each mesh gets room for one instance per cell, room-ordered meshes keep zero instances
+        renderer.useGeneratedInstances(numCells);
+        std::vector<GLint> drawSources(renderer.getNumDraws());
+        for (size_t i = 0; i < drawSources.size(); i++)
+            drawSources[i] = renderer.getDrawLOD(i) == 0 ? static_cast<GLint>(renderer.getDrawSource(i)) : -1;
+        glGenBuffers(1, &draw_source_buffer_);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, draw_source_buffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, drawSources.size() * sizeof(GLint), drawSources.data(), GL_STATIC_DRAW);
+        glGenBuffers(1, &counter_buffer_);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, counter_buffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, renderer.getNumSources() * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        // Mapping is constant, so uniforms are set once
+        GLStateCache::current().useProgram(program->getProgramId());
+        glUniform1i(program->getUniformLocation("numMeshes"), static_cast<GLint>(meshMasks.size()));
+        glUniform1uiv(program->getUniformLocation("meshMasks"), static_cast<GLsizei>(meshMasks.size()), meshMasks.data());
+        glUniform1i(program->getUniformLocation("numMappings"), static_cast<GLint>(mappingStates.size()));
+        glUniform1uiv(program->getUniformLocation("mappingStates"), static_cast<GLsizei>(mappingStates.size()), mappingStates.data());
+        glUniform1iv(program->getUniformLocation("mappingSources"), static_cast<GLsizei>(mappingSources.size()), mappingSources.data());
+        glUniform1ui(program->getUniformLocation("sourceCapacity"), static_cast<GLuint>(numCells));
+        glUniform1i(program->getUniformLocation("numDraws"), static_cast<GLint>(drawSources.size()));
+        uloc_grid_state_ = program->getUniformLocation("curr_grid_state");
+        uloc_pass_ = program->getUniformLocation("pass");
+        program_ = program;
+        renderer_ = &renderer;
+        return true;
+    }
+
+    void GPUInstanceGenerator::generate(GLuint gridStateTexture, GLsizei numCols, GLsizei numRows) {
+        if (!isReady()) return;
+        GLStateCache::current().useProgram(program_->getProgramId());
+        const GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, counter_buffer_);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, renderer_->getInstanceBuffer());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, counter_buffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, renderer_->getIndirectBuffer());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, draw_source_buffer_);
+        // texelFetch ignores sampling state
+        GLStateCache::current().bindTexture(0, gridStateTexture);
+        glUniform1i(uloc_grid_state_, 0);
+
+        // pass 0: append instances per cell
+        glUniform1i(uloc_pass_, 0);
+        glDispatchCompute((numCols + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, (numRows + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        // pass 1: instance counts to draw commands (one workgroup loops over all draws)
+        glUniform1i(uloc_pass_, 1);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+        for (GLuint binding = 0; binding < 4; binding++) glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+    }
+
+    void GPUInstanceGenerator::cleanup() {
+        if (counter_buffer_ != 0) glDeleteBuffers(1, &counter_buffer_);
+        if (draw_source_buffer_ != 0) glDeleteBuffers(1, &draw_source_buffer_);
+        counter_buffer_ = draw_source_buffer_ = 0;
+        program_ = nullptr;
+        renderer_ = nullptr;
+    }
+}
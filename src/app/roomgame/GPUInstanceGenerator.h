@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include "MultiDrawRenderer.h"
+
+namespace roomgame
+{
+    /* Generates the mesh instances of a mesh pool on the GPU from the grid state texture (see generateMeshInstances.comp).
+     * One compute invocation per cell maps its build state to meshes like RoomSegmentMeshPool::filter...
+     * ... and appends instances to the region of each mesh in the instance buffer of a MultiDrawRenderer.
+     * A second pass writes the instance counts into the indirect draw commands, no read back to the CPU.
+     * So every node renders rooms from the grid state alone (no instance buffers need to be synced).
+     * Differences to CPU-built instances: mesh variations are not chosen randomly (first mesh of a mapping)...
+     * ... and instances follow automaton transitions (the grid state texture), not each build call.
+    */
+    class GPUInstanceGenerator {
+    public:
+        static const size_t MAX_MAPPINGS = 32; // must match MAX_MAPPINGS in generateMeshInstances.comp
+        static const GLuint WORKGROUP_SIZE = 8; // must match local_size_x/y in generateMeshInstances.comp
+
+        // Build state of a pool mapping and its (first) mesh
+        struct Mapping {
+            GLuint buildState;
+            RoomSegmentMesh* mesh;
+        };
+
+        GPUInstanceGenerator();
+        ~GPUInstanceGenerator();
+
+        static bool isSupported();
+        // Switch the renderer to generated instances (false if unsupported or too many mappings)
+        bool init(viscom::GPUProgram* program, MultiDrawRenderer& renderer, const std::vector<Mapping>& mappings, size_t numCells);
+        // Rebuild all instances from the given grid state texture (call after each grid state update)
+        void generate(GLuint gridStateTexture, GLsizei numCols, GLsizei numRows);
+        void cleanup();
+        bool isReady() const { return program_ != nullptr; }
+
+    private:
+        viscom::GPUProgram* program_;
+        MultiDrawRenderer* renderer_;
+        GLuint counter_buffer_; // instances per region
+        GLuint draw_source_buffer_; // region of each draw command
+        GLint uloc_grid_state_;
+        GLint uloc_pass_;
+    };
+}
@@ -12,14 +12,7 @@ void ShadowReceivingMesh::render(glm::mat4& vp, glm::mat4& lightspace, GLuint sh
         glUniformMatrix4fv(uloc_lightspace_matrix_, 1, GL_FALSE, &lightspace[0][0]);
 		// Bind shadow map to texture unit **2** because
 		// the MeshBase super-class already uses 0 (diffuse texture) and 1 (bump map)
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, shadowMap);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-		float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-		glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+		roomgame::GLStateCache::current().bindTexture(2, shadowMap, roomgame::SHADOW_MAP_SAMPLER);
 		glUniform1i(uloc_shadow_map_, 2);
 	},false,lightInfo,viewPos,isDebugMode);
 }
@@ -39,22 +32,11 @@ void PostProcessingMesh::render(glm::mat4& vp, glm::mat4& lightspace, GLuint sha
         glUniformMatrix4fv(uloc_lightspace_matrix_, 1, GL_FALSE, &lightspace[0][0]);
 		// Bind shadow map to texture unit **2** because
 		// the MeshBase super-class already uses 0 (diffuse texture) and 1 (bump map)
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, shadowMap);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
-		float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-		glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+		roomgame::GLStateCache::current().bindTexture(2, shadowMap, roomgame::SHADOW_COMPARE_SAMPLER);
 		glUniform1i(uloc_shadow_map_, 2);
 		glUniform1f(uloc_time_, time_);
 
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, caustics);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        roomgame::GLStateCache::current().bindTexture(3, caustics, roomgame::LINEAR_REPEAT_SAMPLER);
         glUniform1i(uloc_caustics_, 3);
 	},false, lightInfo,viewPos,isDebugMode);
 }
\ No newline at end of file
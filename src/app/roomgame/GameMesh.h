@@ -3,6 +3,8 @@
 
 #include <memory>
 #include <iostream>
+#include <cstring>
+#include <algorithm>
 
 #include "glm\gtc/matrix_inverse.hpp"
 #include <glm/gtx/transform.hpp>
@@ -15,13 +17,19 @@
 
 #include "../Vertices.h"
 #include "sgct.h"
+#include "SharedBuffer.h"
+#include "SyncRegistry.h"
+#include "PersistentRingBuffer.h"
 #include "app\roomgame\LightBase.h"
 #include "SourceLightManager.h"
+#include "SceneUniforms.h"
+#include "ProgramReflection.h"
+#include "GLStateCache.h"
 
 /* Base class for all meshes rendered by the roomgame.
  * Construct with a vertex class as template parameter (providing CreateVertexBuffer and SetVertexAttributes functions).
  * Uses naked pointers to mesh and shader (according resources should be owned by extending classes).
- * Holds VAO, VBO and the shader locations of common uniform variables.
+ * Holds VAO, VBO and typed handles of common uniform variables (resolved once, see ProgramReflection).
  * Common uniforms that are provided:
      "subMeshLocalMatrix",
      "normalMatrix",
@@ -37,6 +45,9 @@
      "material.refraction",
      "material.specular",
      "material.specularExponent"
+ * Programs with a LightBlock get camera and lights from SceneUniforms (written once per frame) instead of per draw.
+ * Programs with a MaterialBlock get the materials of the mesh from an own uniform buffer (written once, bound by index).
+ * Binds go through the GLStateCache, material textures are sampled with a shared sampler object.
  * Provides instanced and non-instanced render functions.
  * Both functions have one overload which takes a callback where custom uniform variables can be set.
  * Custom uniform locations and updates are managed by extending classes.
@@ -59,125 +70,158 @@ protected:
 	GLuint vbo_;
 	viscom::Mesh* mesh_;
 	viscom::GPUProgram* program_;
-	std::vector<GLint> uniformLocations_;
-
-
+	roomgame::ProgramReflection reflection_;
+	bool has_light_block_ = false;
+	bool has_material_block_ = false;
+	GLuint material_buffer_ = 0; // std140 materials of all submeshes (with MaterialBlock only)
+	size_t material_stride_ = 0;
+	std::vector<const viscom::Material*> materials_; // index in material_buffer_
+
+
+
+	// Common uniforms (invalid handles for uniforms the program does not have)
+	struct PointLightPropsUniforms {
+		roomgame::Uniform<glm::vec3> ambient;
+		roomgame::Uniform<glm::vec3> diffuse;
+		roomgame::Uniform<glm::vec3> specular;
+		roomgame::Uniform<float> constant;
+		roomgame::Uniform<float> linear;
+		roomgame::Uniform<float> quadratic;
+		void resolve(const roomgame::ProgramReflection& reflection, const std::string& name) {
+			ambient = reflection.uniform<glm::vec3>(name + ".ambient");
+			diffuse = reflection.uniform<glm::vec3>(name + ".diffuse");
+			specular = reflection.uniform<glm::vec3>(name + ".specular");
+			constant = reflection.uniform<float>(name + ".constant");
+			linear = reflection.uniform<float>(name + ".linear");
+			quadratic = reflection.uniform<float>(name + ".quadratic");
+		}
+		void set(const PointLight& light) const {
+			ambient.set(light.ambient);
+			diffuse.set(light.diffuse);
+			specular.set(light.specular);
+			constant.set(light.constant);
+			linear.set(light.linear);
+			quadratic.set(light.quadratic);
+		}
+	};
+	struct CommonUniforms {
+		roomgame::Uniform<glm::mat4> subMeshLocalMatrix;
+		roomgame::Uniform<glm::mat3> normalMatrix;
+		roomgame::Uniform<glm::mat4> viewProjectionMatrix;
+		roomgame::Uniform<GLint> isDebugMode;
+		roomgame::Uniform<float> time;
+		roomgame::Uniform<float> materialAlpha;
+		roomgame::Uniform<glm::vec3> materialAmbient;
+		roomgame::Uniform<float> materialBumpMultiplier;
+		roomgame::Uniform<GLint> materialBumpTex;
+		roomgame::Uniform<glm::vec3> materialDiffuse;
+		roomgame::Uniform<GLint> materialDiffuseTex;
+		roomgame::Uniform<float> materialRefraction;
+		roomgame::Uniform<glm::vec3> materialSpecular;
+		roomgame::Uniform<float> materialSpecularExponent;
+		// camera and lights (programs without LightBlock only)
+		roomgame::Uniform<glm::vec3> viewPos;
+		roomgame::Uniform<glm::vec3> dirLightDirection;
+		roomgame::Uniform<glm::vec3> dirLightAmbient;
+		roomgame::Uniform<glm::vec3> dirLightDiffuse;
+		roomgame::Uniform<glm::vec3> dirLightSpecular;
+		PointLightPropsUniforms outerInfLightProps;
+		PointLightPropsUniforms sourceLightProps;
+		std::vector<roomgame::Uniform<glm::vec3>> outerInfLightPositions;
+	};
+	CommonUniforms uniforms_;
 
 public:
-    //Uniform Location names
-    const int UL_SUB_MESH_LOCAL_MATRIX = 0;
-    const int UL_NORMAL_MATRIX = 1;
-    const int UL_VIEW_PROJECTION_MATRIX = 2;
-    const int UL_IS_DEBUG_MODE = 3;
-    const int UL_TIME = 4;
-    const int UL_MATERIAL_ALPHA = 5;
-    const int UL_MATERIAL_AMBIENT = 6;
-    const int UL_MATERIAL_BUMP_MULTIPLIER = 7;
-    const int UL_MATERIAL_BUMP_TEX = 8;
-    const int UL_MATERIAL_DIFFUSE = 9;
-    const int UL_MATERIAL_DIFFUSE_TEX = 10;
-    const int UL_MATERIAL_REFRACTION = 11;
-    const int UL_MATERIAL_SPECULAR = 12;
-    const int UL_MATERIAL_SPECULAR_EXPONENT = 13;
-    const int UL_VIEW_POS = 14;
-    const int UL_DIR_LIGHT_DIRECTION = 15;
-    const int UL_DIR_LIGHT_AMBIENT = 16;
-    const int UL_DIR_LIGHT_DIFFUSE = 17;
-    const int UL_DIR_LIGHT_SPECULAR = 18;
-
-
-    std::vector<std::string> pointLightProps;
-    std::vector<std::vector<std::string>> infLightStrings;
-    std::vector<std::vector<std::string>> sourceLightStrings;
-    std::string outerInfString = "outerInfLights";
-    std::string sourceString = "sourceLights";
-    std::string outerInfLightPropsString = "outerInfLightProps";
-    std::string sourceLightPropsString = "sourceLightProps";
-
 
 	MeshBase(viscom::Mesh* mesh, viscom::GPUProgram* program) :
 		mesh_(mesh), program_(program), vbo_(VERTEX_LAYOUT::CreateVertexBuffer(mesh)), vao_(0)
 	{
 		resetShader();
-        pointLightProps.push_back(".position");
-        pointLightProps.push_back(".ambient");
-        pointLightProps.push_back(".diffuse");
-        pointLightProps.push_back(".specular");
-        pointLightProps.push_back(".constant");
-        pointLightProps.push_back(".linear");
-        pointLightProps.push_back(".quadratic");
-
-	    for (int i = 0; i < 10; i++)
-        {
-            std::string number = "" + std::to_string(i);
-            std::string loc = outerInfString + "[" + number + "]";
-            std::vector<std::string> tmp;
-            tmp.push_back(loc + pointLightProps[0]);
-            infLightStrings.push_back(tmp);
-        }
-
-	    std::string loc2 = outerInfLightPropsString;
-        for(int i = 1;i<pointLightProps.size();i++)
-        {
-            infLightStrings[0].push_back(loc2 + pointLightProps[i]);
-        }
-
-        for (int i = 0; i < 15; i++)
-        {
-            std::string number = "" + std::to_string(i);
-            std::string loc = sourceString + "[" + number + "]";
-            std::vector<std::string> tmp;
-            tmp.push_back(loc + pointLightProps[0]);
-            sourceLightStrings.push_back(tmp);
-        }
-        std::string loc3 = sourceLightPropsString;
-        for (int i = 1; i<pointLightProps.size(); i++)
-        {
-            sourceLightStrings[0].push_back(loc3 + pointLightProps[i]);
-        }
+		initUniformBlocks();
     }
 
 	~MeshBase() {
 		if (vbo_ != 0) glDeleteBuffers(1, &vbo_);
 		vbo_ = 0;
-		if (vao_ != 0) glDeleteVertexArrays(1, &vao_);
+		if (material_buffer_ != 0) glDeleteBuffers(1, &material_buffer_);
+		material_buffer_ = 0;
+		if (vao_ != 0) roomgame::GLStateCache::current().deleteVertexArray(vao_);
 		vao_ = 0;
 	}
 
 
 protected:
 
+	void initUniformBlocks() {
+		roomgame::SceneUniforms::bindBlocks(program_->getProgramId(), has_light_block_, has_material_block_);
+		if (!has_material_block_) return;
+		// all materials of the mesh once, submeshes bind their range
+		forEachSubmesh([&](const viscom::SubMesh* submesh, const glm::mat4&) {
+			const viscom::Material* mat = submesh->GetMaterial();
+			if (mat && std::find(materials_.begin(), materials_.end(), mat) == materials_.end()) materials_.push_back(mat);
+		});
+		if (materials_.empty()) return;
+		material_stride_ = roomgame::SceneUniforms::materialStride();
+		std::vector<char> block(materials_.size() * material_stride_, 0);
+		for (size_t i = 0; i < materials_.size(); i++) {
+			const viscom::Material* mat = materials_[i];
+			roomgame::SceneUniforms::MaterialData data;
+			std::memset(&data, 0, sizeof(data));
+			data.alpha = mat->alpha;
+			data.ambient = mat->ambient;
+			data.bumpMultiplier = mat->bumpMultiplier;
+			data.diffuse = mat->diffuse;
+			data.refraction = mat->refraction;
+			data.specular = mat->specular;
+			data.specularExponent = mat->specularExponent;
+			std::memcpy(block.data() + i * material_stride_, &data, sizeof(data));
+		}
+		glGenBuffers(1, &material_buffer_);
+		glBindBuffer(GL_UNIFORM_BUFFER, material_buffer_);
+		glBufferData(GL_UNIFORM_BUFFER, block.size(), block.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
 	void resetShader() {
+		roomgame::GLStateCache& state = roomgame::GLStateCache::current();
 		glGenVertexArrays(1, &vao_);
-		glBindVertexArray(vao_);
+		state.bindVertexArray(vao_);
 		glBindBuffer(GL_ARRAY_BUFFER, vbo_);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh_->GetIndexBuffer());
 		VERTEX_LAYOUT::SetVertexAttributes(program_);
-		glBindVertexArray(0);
+		state.bindVertexArray(0);
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-		uniformLocations_ = program_->getUniformLocations({
-			"subMeshLocalMatrix",
-			"normalMatrix",
-			"viewProjectionMatrix",
-			"isDebugMode",
-            "time",
-            "material.alpha",
-            "material.ambient",
-            "material.bumpMultiplier",
-            "material.bumpTex",
-            "material.diffuse",
-            "material.diffuseTex",
-            "material.refraction",
-            "material.specular",
-            "material.specularExponent",
-            "viewPos",
-            "dirLight.direction",
-            "dirLight.ambient",
-            "dirLight.diffuse",
-            "dirLight.specular"
-        });
+		resolveUniforms();
     }
+
+	void resolveUniforms() {
+		reflection_.reflect(program_->getProgramId());
+		uniforms_.subMeshLocalMatrix = reflection_.uniform<glm::mat4>("subMeshLocalMatrix");
+		uniforms_.normalMatrix = reflection_.uniform<glm::mat3>("normalMatrix");
+		uniforms_.viewProjectionMatrix = reflection_.uniform<glm::mat4>("viewProjectionMatrix");
+		uniforms_.isDebugMode = reflection_.uniform<GLint>("isDebugMode");
+		uniforms_.time = reflection_.uniform<float>("time");
+		uniforms_.materialAlpha = reflection_.uniform<float>("material.alpha");
+		uniforms_.materialAmbient = reflection_.uniform<glm::vec3>("material.ambient");
+		uniforms_.materialBumpMultiplier = reflection_.uniform<float>("material.bumpMultiplier");
+		uniforms_.materialBumpTex = reflection_.uniform<GLint>("material.bumpTex");
+		uniforms_.materialDiffuse = reflection_.uniform<glm::vec3>("material.diffuse");
+		uniforms_.materialDiffuseTex = reflection_.uniform<GLint>("material.diffuseTex");
+		uniforms_.materialRefraction = reflection_.uniform<float>("material.refraction");
+		uniforms_.materialSpecular = reflection_.uniform<glm::vec3>("material.specular");
+		uniforms_.materialSpecularExponent = reflection_.uniform<float>("material.specularExponent");
+		uniforms_.viewPos = reflection_.uniform<glm::vec3>("viewPos");
+		uniforms_.dirLightDirection = reflection_.uniform<glm::vec3>("dirLight.direction");
+		uniforms_.dirLightAmbient = reflection_.uniform<glm::vec3>("dirLight.ambient");
+		uniforms_.dirLightDiffuse = reflection_.uniform<glm::vec3>("dirLight.diffuse");
+		uniforms_.dirLightSpecular = reflection_.uniform<glm::vec3>("dirLight.specular");
+		uniforms_.outerInfLightProps.resolve(reflection_, "outerInfLightProps");
+		uniforms_.sourceLightProps.resolve(reflection_, "sourceLightProps");
+		uniforms_.outerInfLightPositions.clear();
+		for (size_t i = 0; i < roomgame::SceneUniforms::NUM_OUTER_INFLUENCE_LIGHTS; i++)
+			uniforms_.outerInfLightPositions.push_back(reflection_.uniform<glm::vec3>("outerInfLights[" + std::to_string(i) + "].position"));
+	}
 	void render(
         const glm::mat4& vpMatrix,
         GLsizei numInstances=1,
@@ -186,10 +230,11 @@ protected:
         bool overrideBump = false,
         LightInfo* lightInfo = nullptr,
         glm::vec3& viewPos = glm::vec3(0,0,4),
-        GLint isDebugMode = 0
+        GLint isDebugMode = 0,
+        GLuint baseInstance = 0
     ) const {
-		glUseProgram(program_->getProgramId());
-		glBindVertexArray(vao_);
+		roomgame::GLStateCache::current().useProgram(program_->getProgramId());
+		roomgame::GLStateCache::current().bindVertexArray(vao_);
 		forEachSubmeshOf(mesh_->GetRootNode(), modelMatrix, [&](const viscom::SubMesh* submesh, const glm::mat4& localTransform) {
 			bindUniformsAndTextures(vpMatrix, localTransform, submesh->GetMaterial(), lightInfo, viewPos, overrideBump, isDebugMode);
             if (outsideUniformSetter != nullptr) {
@@ -197,7 +242,11 @@ protected:
             }
 			if (isDebugMode == 1) glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 			else glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-            if (numInstances == 1) {
+            if (baseInstance != 0) { // instance data starts inside the instance buffer (see PersistentRingBuffer)
+                glDrawElementsInstancedBaseInstance(GL_TRIANGLES, submesh->GetNumberOfIndices(), GL_UNSIGNED_INT,
+                    (static_cast<char*> (nullptr)) + (submesh->GetIndexOffset() * sizeof(unsigned int)), numInstances, baseInstance);
+            }
+            else if (numInstances == 1) {
                 glDrawElements(GL_TRIANGLES, submesh->GetNumberOfIndices(), GL_UNSIGNED_INT,
                     (static_cast<char*> (nullptr)) + (submesh->GetIndexOffset() * sizeof(unsigned int)));
             }
@@ -208,9 +257,34 @@ protected:
 		});
 	}
 
+    // Use the program and set all uniforms of render (with the material of the first submesh) without drawing
+    void bindPassUniforms(const glm::mat4& vpMatrix, LightInfo* lightInfo, glm::vec3& viewPos, GLint isDebugMode) const {
+        roomgame::GLStateCache::current().useProgram(program_->getProgramId());
+        bool bound = false;
+        forEachSubmesh([&](const viscom::SubMesh* submesh, const glm::mat4& localTransform) {
+            if (bound) return;
+            bindUniformsAndTextures(vpMatrix, localTransform, submesh->GetMaterial(), lightInfo, viewPos, false, isDebugMode);
+            bound = true;
+        });
+    }
+
+    void forEachSubmesh(std::function<void(const viscom::SubMesh*, const glm::mat4&)> callback) const {
+        forEachSubmeshOf(mesh_->GetRootNode(), glm::mat4(1), callback);
+    }
+    // Same for any mesh resource (e.g. levels of detail)
+    static void forEachSubmeshOf(const viscom::Mesh* mesh, std::function<void(const viscom::SubMesh*, const glm::mat4&)> callback) {
+        forEachSubmeshOf(mesh->GetRootNode(), glm::mat4(1), callback);
+    }
+    const viscom::Mesh* getMesh() const {
+        return mesh_;
+    }
+    GLuint getVertexBuffer() const {
+        return vbo_;
+    }
+
 private:
 
-	void forEachSubmeshOf(const viscom::SceneMeshNode* subtree, const glm::mat4& transform, std::function<void(const viscom::SubMesh*, const glm::mat4&)> callback) const {
+	static void forEachSubmeshOf(const viscom::SceneMeshNode* subtree, const glm::mat4& transform, std::function<void(const viscom::SubMesh*, const glm::mat4&)> callback) {
 		auto localTransform = subtree->GetLocalTransform() * transform;
 		for (unsigned int i = 0; i < subtree->GetNumMeshes(); ++i)
 			callback(subtree->GetMesh(i), localTransform);
@@ -220,76 +294,68 @@ private:
 
 	void bindUniformsAndTextures(const glm::mat4& vpMatrix, const glm::mat4& localMatrix, const viscom::Material* mat = nullptr, LightInfo* lightInfo = nullptr, const glm::vec3& viewPos = glm::vec3(0,0,4),bool overrideBump = false, GLint isDebugMode = 0) const {
 		
-        glUniformMatrix4fv(uniformLocations_[UL_SUB_MESH_LOCAL_MATRIX], 1, GL_FALSE, glm::value_ptr(localMatrix));
-		glUniformMatrix3fv(uniformLocations_[UL_NORMAL_MATRIX], 1, GL_FALSE, glm::value_ptr(glm::inverseTranspose(glm::mat3(localMatrix))));
-		glUniformMatrix4fv(uniformLocations_[UL_VIEW_PROJECTION_MATRIX], 1, GL_FALSE, glm::value_ptr(vpMatrix));
-		glUniform1i(uniformLocations_[UL_IS_DEBUG_MODE], isDebugMode);
-        glUniform1f(uniformLocations_[UL_TIME], (float)glfwGetTime());
+        uniforms_.subMeshLocalMatrix.set(localMatrix);
+		uniforms_.normalMatrix.set(glm::inverseTranspose(glm::mat3(localMatrix)));
+		uniforms_.viewProjectionMatrix.set(vpMatrix);
+		uniforms_.isDebugMode.set(isDebugMode);
+        uniforms_.time.set((float)glfwGetTime());
 
         //Material Properties
+        if (mat != nullptr && material_buffer_ != 0) {
+            size_t index = std::find(materials_.begin(), materials_.end(), mat) - materials_.begin();
+            glBindBufferRange(GL_UNIFORM_BUFFER, roomgame::SceneUniforms::MATERIAL_BLOCK_BINDING, material_buffer_,
+                index * material_stride_, sizeof(roomgame::SceneUniforms::MaterialData));
+        }
         if (mat != nullptr) {
-            glUniform1f(uniformLocations_[UL_MATERIAL_ALPHA], mat->alpha);
-            glUniform3fv(uniformLocations_[UL_MATERIAL_AMBIENT],1,glm::value_ptr(mat->ambient));
+            if (!has_material_block_) {
+                uniforms_.materialAlpha.set(mat->alpha);
+                uniforms_.materialAmbient.set(mat->ambient);
+            }
 
             //Bumpmap and multiplier
-            if (!overrideBump) {
-                glUniform1f(uniformLocations_[UL_MATERIAL_BUMP_MULTIPLIER], mat->bumpMultiplier);
+            if (!overrideBump && !has_material_block_) {
+                uniforms_.materialBumpMultiplier.set(mat->bumpMultiplier);
             }
-            if (mat->bumpTex && uniformLocations_[UL_MATERIAL_BUMP_TEX]!=-1) {
-                glActiveTexture(GL_TEXTURE1);
-                glBindTexture(GL_TEXTURE_2D, mat->bumpTex->getTextureId());
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-                glUniform1i(uniformLocations_[UL_MATERIAL_BUMP_TEX], 1);
+            if (mat->bumpTex && uniforms_.materialBumpTex.isValid()) {
+                roomgame::GLStateCache::current().bindTexture(1, mat->bumpTex->getTextureId(), roomgame::LINEAR_REPEAT_SAMPLER);
+                uniforms_.materialBumpTex.set(1);
             }
 
             //diffuse properties and diffuse texture
-            glUniform3fv(uniformLocations_[UL_MATERIAL_DIFFUSE],1, glm::value_ptr(mat->diffuse));
-            if (mat->diffuseTex && uniformLocations_[UL_MATERIAL_DIFFUSE_TEX] != -1) {
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, mat->diffuseTex->getTextureId());
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-                glUniform1i(uniformLocations_[UL_MATERIAL_DIFFUSE_TEX], 0);
+            if (!has_material_block_) uniforms_.materialDiffuse.set(mat->diffuse);
+            if (mat->diffuseTex && uniforms_.materialDiffuseTex.isValid()) {
+                roomgame::GLStateCache::current().bindTexture(0, mat->diffuseTex->getTextureId(), roomgame::LINEAR_REPEAT_SAMPLER);
+                uniforms_.materialDiffuseTex.set(0);
             }
 
             //refraction and specular properties
-            glUniform1f(uniformLocations_[UL_MATERIAL_REFRACTION], mat->refraction);
-            glUniform3fv(uniformLocations_[UL_MATERIAL_SPECULAR], 1, glm::value_ptr(mat->specular));
-            glUniform1f(uniformLocations_[UL_MATERIAL_SPECULAR_EXPONENT], mat->specularExponent);
+            if (!has_material_block_) {
+                uniforms_.materialRefraction.set(mat->refraction);
+                uniforms_.materialSpecular.set(mat->specular);
+                uniforms_.materialSpecularExponent.set(mat->specularExponent);
+            }
+            // camera and lights come from the light block (written once per frame)
+            if (has_light_block_) return;
+
             //View Position
-            glUniform3fv(uniformLocations_[UL_VIEW_POS], 1, glm::value_ptr(viewPos));
+            uniforms_.viewPos.set(viewPos);
 
             if (lightInfo != nullptr && lightInfo->infLightPos.size()>0) {
                 //Directional Light
-                glUniform3fv(uniformLocations_[UL_DIR_LIGHT_DIRECTION], 1, glm::value_ptr(lightInfo->sun->direction));
-                glUniform3fv(uniformLocations_[UL_DIR_LIGHT_AMBIENT], 1, glm::value_ptr(lightInfo->sun->ambient));
-                glUniform3fv(uniformLocations_[UL_DIR_LIGHT_DIFFUSE], 1, glm::value_ptr(lightInfo->sun->diffuse));
-                glUniform3fv(uniformLocations_[UL_DIR_LIGHT_SPECULAR], 1, glm::value_ptr(lightInfo->sun->specular));
+                uniforms_.dirLightDirection.set(lightInfo->sun->direction);
+                uniforms_.dirLightAmbient.set(lightInfo->sun->ambient);
+                uniforms_.dirLightDiffuse.set(lightInfo->sun->diffuse);
+                uniforms_.dirLightSpecular.set(lightInfo->sun->specular);
 
                 //outer influence Light
-                for (int i = 0; i < lightInfo->infLightPos.size(); i++) {
-                    glUniform3fv(program_->getUniformLocation(infLightStrings[i][0]), 1, glm::value_ptr(lightInfo->infLightPos[i]));
+                for (size_t i = 0; i < lightInfo->infLightPos.size() && i < uniforms_.outerInfLightPositions.size(); i++) {
+                    uniforms_.outerInfLightPositions[i].set(lightInfo->infLightPos[i]);
                 }
-                glUniform3fv(program_->getUniformLocation(infLightStrings[0][1]), 1, glm::value_ptr(lightInfo->outerInfLights->ambient));
-                glUniform3fv(program_->getUniformLocation(infLightStrings[0][2]), 1, glm::value_ptr(lightInfo->outerInfLights->diffuse));
-                glUniform3fv(program_->getUniformLocation(infLightStrings[0][3]), 1, glm::value_ptr(lightInfo->outerInfLights->specular));
-                glUniform1f(program_->getUniformLocation(infLightStrings[0][4]), lightInfo->outerInfLights->constant);
-                glUniform1f(program_->getUniformLocation(infLightStrings[0][5]), lightInfo->outerInfLights->linear);
-                glUniform1f(program_->getUniformLocation(infLightStrings[0][6]), lightInfo->outerInfLights->quadratic);
+                uniforms_.outerInfLightProps.set(*lightInfo->outerInfLights);
             }
 
             ////source lights
-            glUniform3fv(program_->getUniformLocation(sourceLightStrings[0][1]), 1, glm::value_ptr(lightInfo->sourceLights->ambient));
-            glUniform3fv(program_->getUniformLocation(sourceLightStrings[0][2]), 1, glm::value_ptr(lightInfo->sourceLights->diffuse));
-            glUniform3fv(program_->getUniformLocation(sourceLightStrings[0][3]), 1, glm::value_ptr(lightInfo->sourceLights->specular));
-            glUniform1f(program_->getUniformLocation(sourceLightStrings[0][4]), lightInfo->sourceLights->constant);
-            glUniform1f(program_->getUniformLocation(sourceLightStrings[0][5]), lightInfo->sourceLights->linear);
-            glUniform1f(program_->getUniformLocation(sourceLightStrings[0][6]), lightInfo->sourceLights->quadratic);
+            if (lightInfo != nullptr) uniforms_.sourceLightProps.set(*lightInfo->sourceLights);
         }
 	}
 };
@@ -365,14 +431,13 @@ public:
 /* Simple synchronized mesh class extending MeshBase.
  * Owns mesh and shader resources.
  * Adds a model matrix for dynamic transformation.
- * Synchronizes the model matrix with SGCT nodes.
+ * Model matrix and influence positions are not synced every frame:
+ * The owner (OuterInfluence) syncs motion states and all nodes compute the matrices locally.
 */
 class SynchronizedGameMesh : public MeshBase<viscom::SimpleMeshVertex> {
 protected:
 	std::shared_ptr<viscom::Mesh> mesh_resource_;
 	std::shared_ptr<viscom::GPUProgram> shader_resource_;
-	sgct::SharedObject<glm::mat4> sharedModelMatrix_;
-	sgct::SharedVector<glm::mat4> sharedInfluencePositions_;
 public:
 	float scale;
     glm::mat4 model_matrix_;
@@ -387,24 +452,13 @@ public:
 	void transform(glm::mat4& t) {
 		model_matrix_ *= t;
 	}
-	void preSync() { // master
-		sharedModelMatrix_.setVal(model_matrix_);
-		sharedInfluencePositions_.setVal(influencePositions_);
+	void encodeSnapshot(roomgame::SyncStream& out) { // master
+		out.writeValue(model_matrix_);
+		out.writeArray(influencePositions_);
 	}
-	void encode() { // master
-		sgct::SharedData::instance()->writeObj(&sharedModelMatrix_);
-        sgct::SharedData::instance()->writeVector(&sharedInfluencePositions_);
-    }
-	void decode() { // slave
-		sgct::SharedData::instance()->readObj(&sharedModelMatrix_);
-        sgct::SharedData::instance()->readVector(&sharedInfluencePositions_);
-    }
-	void updateSyncedSlave() {
-		model_matrix_ = sharedModelMatrix_.getVal();
-		influencePositions_ = sharedInfluencePositions_.getVal();
-	}
-	void updateSyncedMaster() {
-		//Can maybe stay empty
+	void loadSnapshot(roomgame::SyncStream& in) { // slave
+		model_matrix_ = in.readValue<glm::mat4>();
+		in.readArray(influencePositions_);
 	}
     virtual void render(
         const glm::mat4& vpMatrix,
@@ -425,77 +479,223 @@ public:
  * Has no owned resources because it is managed by a mesh pool.
  * Synchronizes the instance buffer.
  * The instance buffer is dynamic.
+ * Slaves receive the instance buffer in a persistently mapped staging buffer and copy it on the GPU.
+ * Extending classes call markInstancesChanged on each mutation (buffer is synced and uploaded only if changed).
+ * GPU capacity doubles when full and is trimmed when mostly unused (each node on its own, capacity is not synced).
+ * The instance buffer has its own vertex buffer binding point, so resizing does not rebuild the VAO.
 */
 template <class PER_INSTANCE_DATA>
 class SynchronizedInstancedMesh : public MeshBase<viscom::SimpleMeshVertex> {
+public:
+    /* Instance buffer as sent to slaves (held by the mesh and by each of its loopback replicas) */
+    struct InstanceSync {
+        roomgame::SharedBuffer<PER_INSTANCE_DATA> shared_instance_buffer;
+        sgct::SharedInt64 shared_num_instances;
+        void decode(roomgame::SyncStream& in) { // slave
+            shared_instance_buffer.decode(in);
+            in.readInt64(&shared_num_instances);
+        }
+        int numInstances() {
+            return (int) shared_num_instances.getVal();
+        }
+        // without a staged buffer: take the received instances (false if none arrived)
+        bool receive(std::vector<PER_INSTANCE_DATA>& instances) {
+            return shared_instance_buffer.swapReceived(instances);
+        }
+    };
 private:
-    sgct::SharedVector<PER_INSTANCE_DATA> shared_instance_buffer_;
-	sgct::SharedInt64 shared_num_instances_;
-	sgct::SharedInt64 shared_num_reallocations_;
+    InstanceSync sync_;
+    unsigned long long instance_generation_ = 1; // bumped on each mutation of the instance buffer
+    unsigned long long uploaded_generation_ = 0; // master: generation on the GPU
+    // persistently mapped ring holding the instance buffer (null id if not supported, then glBufferSubData is used)
+    roomgame::PersistentRingBuffer instance_ring_;
+    GLuint base_instance_ = 0; // first instance of the ring region holding the latest instance data
+    unsigned long long gpu_version_ = 0; // bumped on each write of the GPU instance buffer (all nodes)
 protected:
     roomgame::InstanceBuffer gpu_instance_buffer_;
     std::vector<PER_INSTANCE_DATA> instance_buffer_;
+    void markInstancesChanged() {
+        instance_generation_++;
+    }
 public:
     SynchronizedInstancedMesh(viscom::Mesh* mesh, viscom::GPUProgram* program, size_t pool_allocation_bytes)
         : MeshBase(mesh, program), gpu_instance_buffer_(pool_allocation_bytes)
     {
-    
+        // replace the plain instance buffer with the ring
+        if (instance_ring_.alloc(pool_allocation_bytes)) {
+            glDeleteBuffers(1, &gpu_instance_buffer_.id_);
+            gpu_instance_buffer_.id_ = instance_ring_.id();
+        }
+        connectInstanceBuffer();
     }
-    ~SynchronizedInstancedMesh() {
-        glDeleteBuffers(1, &gpu_instance_buffer_.id_);
+    ~SynchronizedInstancedMesh() { // deleted by the GL cleanup of the mesh pool
+        if (!instance_ring_.isAllocated()) glDeleteBuffers(1, &gpu_instance_buffer_.id_);
+        sync_.shared_instance_buffer.cleanup();
     }
     void preSync() { // master
-        shared_instance_buffer_.setVal(instance_buffer_);
-		shared_num_instances_.setVal(gpu_instance_buffer_.num_instances_);
-		shared_num_reallocations_.setVal(gpu_instance_buffer_.num_reallocations_);
+		sync_.shared_num_instances.setVal(gpu_instance_buffer_.num_instances_);
     }
-    void encode() { // master
-        sgct::SharedData::instance()->writeVector(&shared_instance_buffer_);
-		sgct::SharedData::instance()->writeInt64(&shared_num_instances_);
-        sgct::SharedData::instance()->writeInt64(&shared_num_reallocations_);
+    void encode(roomgame::SyncStream& out) { // master
+        sync_.shared_instance_buffer.encode(out, instance_buffer_);
+		out.writeInt64(&sync_.shared_num_instances);
     }
-    void decode() { // slave
-        sgct::SharedData::instance()->readVector(&shared_instance_buffer_);
-		sgct::SharedData::instance()->readInt64(&shared_num_instances_);
-		sgct::SharedData::instance()->readInt64(&shared_num_reallocations_);
+    void decode(roomgame::SyncStream& in) { // slave
+        sync_.decode(in);
     }
     void updateSyncedSlave() {
-        instance_buffer_ = shared_instance_buffer_.getVal();
-		gpu_instance_buffer_.num_instances_ = (int) shared_num_instances_.getVal();
-		gpu_instance_buffer_.num_reallocations_ = (int) shared_num_reallocations_.getVal();
-        uploadInstanceBufferToGPU();
+		gpu_instance_buffer_.num_instances_ = sync_.numInstances();
+        // staging buffer is allocated lazily, so only slaves pay for it
+        sync_.shared_instance_buffer.allocStaging(gpu_instance_buffer_.pool_allocation_bytes_ / sizeof(PER_INSTANCE_DATA));
+        GLuint staging;
+        GLintptr stagingOffset;
+        size_t numElements;
+        if (sync_.shared_instance_buffer.acquireStaged(staging, stagingOffset, numElements)) {
+            fitGPUCapacity(numElements);
+            if (numElements > 0) {
+                GLintptr offset = 0;
+                if (instance_ring_.isAllocated()) {
+                    instance_ring_.beginWrite();
+                    offset = instance_ring_.regionOffset();
+                    base_instance_ = static_cast<GLuint>(offset / sizeof(PER_INSTANCE_DATA));
+                }
+                glBindBuffer(GL_COPY_READ_BUFFER, staging);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, gpu_instance_buffer_.id_);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, stagingOffset, offset, numElements * sizeof(PER_INSTANCE_DATA));
+            }
+            gpu_version_++;
+            sync_.shared_instance_buffer.releaseStaged();
+        }
+        else if (sync_.receive(instance_buffer_)) {
+            uploadInstanceBufferToGPU();
+        }
+    }
+    /* Loopback harness: instance buffer of an in-process slave (see SyncRegistry::Replica)
+     * Decoded like on a slave without staging buffer, compared with the live instances of this mesh.
+    */
+    roomgame::SyncRegistry::Replica replicate() { // master
+        struct InstanceReplica {
+            InstanceSync sync;
+            std::vector<PER_INSTANCE_DATA> instances;
+            int num_instances = 0;
+        };
+        auto replica = std::make_shared<InstanceReplica>();
+        return roomgame::SyncRegistry::Replica{
+            [replica](roomgame::SyncStream& in) { replica->sync.decode(in); },
+            [replica]() {
+                replica->num_instances = replica->sync.numInstances();
+                replica->sync.receive(replica->instances);
+            },
+            [this, replica]() {
+                return replica->num_instances == gpu_instance_buffer_.num_instances_
+                    && replica->instances.size() == instance_buffer_.size()
+                    && (instance_buffer_.empty() || std::memcmp(replica->instances.data(), instance_buffer_.data(),
+                        instance_buffer_.size() * sizeof(PER_INSTANCE_DATA)) == 0);
+            } };
     }
     void updateSyncedMaster() {
-        //Can maybe stay empty
+        if (uploaded_generation_ == instance_generation_) return;
+        uploadInstanceBufferToGPU();
+        uploaded_generation_ = instance_generation_;
+    }
+    unsigned long long getInstanceGeneration() const {
+        return instance_generation_;
+    }
+    // base instance to draw with (selects the latest region of the instance ring)
+    GLuint getBaseInstance() const {
+        return base_instance_;
+    }
+    // GPU instance buffer and its state (for renderers drawing instances of several meshes at once)
+    GLuint getInstanceBufferId() const {
+        return gpu_instance_buffer_.id_;
+    }
+    int getNumInstances() const {
+        return gpu_instance_buffer_.num_instances_;
+    }
+    unsigned long long getGPUVersion() const {
+        return gpu_version_;
+    }
+    void encodeSnapshot(roomgame::SyncStream& out) { // master
+        out.writeArray(instance_buffer_);
+        out.writeValue<int32_t>(gpu_instance_buffer_.num_instances_);
+    }
+    void loadSnapshot(roomgame::SyncStream& in) { // slave
+        in.readArray(instance_buffer_);
+        gpu_instance_buffer_.num_instances_ = in.readValue<int32_t>();
         uploadInstanceBufferToGPU();
     }
 private:
+    // capacity level (see InstanceBuffer) needed to hold the given number of instances
+    int requiredReallocations(size_t numElements) const {
+        int level = 1;
+        while (numElements * sizeof(PER_INSTANCE_DATA) > gpu_instance_buffer_.capacityBytes(level)) level++;
+        return level;
+    }
+    // grow geometrically when full, trim when less than a quarter is used (e.g. after a reset)
+    void fitGPUCapacity(size_t numElements) {
+        const int level = requiredReallocations(numElements);
+        if (level > gpu_instance_buffer_.num_reallocations_) resizeGPUMemory(level);
+        else if (level + 2 <= gpu_instance_buffer_.num_reallocations_) resizeGPUMemory(level + 1);
+    }
     void uploadInstanceBufferToGPU() {
-        // instance buffer reached current capacity?
-        if (instance_buffer_.size() * sizeof(PER_INSTANCE_DATA) > gpu_instance_buffer_.pool_allocation_bytes_ * gpu_instance_buffer_.num_reallocations_) {
-            reallocGPUMemory();
+        fitGPUCapacity(instance_buffer_.size());
+        gpu_version_++;
+        if (instance_ring_.isAllocated()) {
+            // write directly into the next region of the ring, no driver copy
+            unsigned char* region = instance_ring_.beginWrite();
+            std::memcpy(region, instance_buffer_.data(), instance_buffer_.size() * sizeof(PER_INSTANCE_DATA));
+            base_instance_ = static_cast<GLuint>(instance_ring_.regionOffset() / sizeof(PER_INSTANCE_DATA));
+            return;
         }
         glBindBuffer(GL_ARRAY_BUFFER, gpu_instance_buffer_.id_);
         glBufferSubData(GL_ARRAY_BUFFER, 0, instance_buffer_.size() * sizeof(PER_INSTANCE_DATA), instance_buffer_.data());
     }
-    void reallocGPUMemory() {
-        // allocate new buffer and and copy data
-        glBindBuffer(GL_COPY_READ_BUFFER, gpu_instance_buffer_.id_);
-        GLuint tmpBuffer;
-        glGenBuffers(1, &tmpBuffer);
-        glBindBuffer(GL_COPY_WRITE_BUFFER, tmpBuffer);
-        gpu_instance_buffer_.num_reallocations_++;
-        glBufferData(GL_COPY_WRITE_BUFFER, gpu_instance_buffer_.pool_allocation_bytes_ * gpu_instance_buffer_.num_reallocations_, 0, GL_STATIC_COPY);
-        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, gpu_instance_buffer_.num_instances_ * sizeof(PER_INSTANCE_DATA));
-        // THIS IS WHAT MAKES REALLOCATION APPROACH ***UGLY***:
-        glDeleteBuffers(1, &gpu_instance_buffer_.id_); // Delete old instance buffer
-        glDeleteVertexArrays(1, &vao_); // Delete old VAO
+    // connect the instance buffer to the VAO (with a separate binding point if possible)
+    void connectInstanceBuffer() {
+        roomgame::GLStateCache::current().bindVertexArray(vao_);
+        if (GLEW_ARB_vertex_attrib_binding) {
+            PER_INSTANCE_DATA::setAttribFormat();
+            PER_INSTANCE_DATA::bindBuffer(gpu_instance_buffer_.id_);
+        }
+        else {
+            glBindBuffer(GL_ARRAY_BUFFER, gpu_instance_buffer_.id_);
+            PER_INSTANCE_DATA::setAttribPointer();
+        }
+        roomgame::GLStateCache::current().bindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    // the ring keeps its latest instances, a plain buffer discards them (callers write the whole instance buffer after resizing)
+    void resizeGPUMemory(int num_reallocations) {
+        gpu_instance_buffer_.num_reallocations_ = num_reallocations;
+        const size_t bytes = gpu_instance_buffer_.capacityBytes(num_reallocations);
+        if (!instance_ring_.isAllocated()) {
+            // same buffer name with new storage, the VAO stays valid
+            glBindBuffer(GL_ARRAY_BUFFER, gpu_instance_buffer_.id_);
+            glBufferData(GL_ARRAY_BUFFER, bytes, 0, GL_STATIC_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            return;
+        }
+        // immutable storage needs a new buffer name (latest region is copied into the first one, no wait for the GPU)
+        base_instance_ = 0;
+        if (instance_ring_.resize(bytes)) {
+            gpu_instance_buffer_.id_ = instance_ring_.id();
+        } else {
+            // mapping failed: continue with a plain buffer
+            instance_ring_.free();
+            glGenBuffers(1, &gpu_instance_buffer_.id_);
+            glBindBuffer(GL_ARRAY_BUFFER, gpu_instance_buffer_.id_);
+            glBufferData(GL_ARRAY_BUFFER, bytes, 0, GL_STATIC_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+        if (GLEW_ARB_vertex_attrib_binding) {
+            // only swap the buffer at the instance binding point
+            roomgame::GLStateCache::current().bindVertexArray(vao_);
+            PER_INSTANCE_DATA::bindBuffer(gpu_instance_buffer_.id_);
+            roomgame::GLStateCache::current().bindVertexArray(0);
+            return;
+        }
+        roomgame::GLStateCache::current().deleteVertexArray(vao_); // Delete old VAO
         resetShader(); // Create new VAO and connect old vertex buffer
-                       // Connect new instance buffer
-        gpu_instance_buffer_.id_ = tmpBuffer;
-        glBindVertexArray(vao_);
-        glBindBuffer(GL_ARRAY_BUFFER, gpu_instance_buffer_.id_);
-        PER_INSTANCE_DATA::setAttribPointer();
+        connectInstanceBuffer();
     }
 };
 
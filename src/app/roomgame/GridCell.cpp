@@ -6,6 +6,7 @@ GridCell::GridCell(float x, float y, size_t col_idx, size_t row_idx) {
 	vertex_.build_state = EMPTY;
 	vertex_.health_points = MAX_HEALTH;
 	vertex_buffer_offset_ = 0;
+	vertex_dirty_ = false;
 	northNeighbor = 0, eastNeighbor = 0, southNeighbor = 0, westNeighbor = 0;
 	col_idx_ = col_idx;
 	row_idx_ = row_idx;
@@ -13,34 +14,24 @@ GridCell::GridCell(float x, float y, size_t col_idx, size_t row_idx) {
 
 
 
-void GridCell::updateBuildState(GLuint vbo) {
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferSubData(GL_ARRAY_BUFFER,
-        vertex_buffer_offset_ + 2 * sizeof(GLfloat),
-        sizeof(vertex_.build_state),
-        (GLvoid*)&vertex_.build_state);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+void GridCell::updateBuildState() {
+    vertex_dirty_ = true; // uploaded with the next flush of the grid
 }
 
-void GridCell::updateHealthPoints(GLuint vbo, unsigned int hp) {
+void GridCell::updateHealthPoints(unsigned int hp) {
 	if (hp < MIN_HEALTH) hp = MIN_HEALTH;
 	else if (hp > MAX_HEALTH) hp = MAX_HEALTH;
 	vertex_.health_points = hp;
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferSubData(GL_ARRAY_BUFFER,
-		vertex_buffer_offset_ + 2 * sizeof(GLfloat) + sizeof(GLint),
-		sizeof(vertex_.health_points),
-		(GLvoid*)&vertex_.health_points);
-	if (vertex_.build_state != EMPTY) {
-        // If the cell is not empty it should have a reference to its mesh instance in an instance buffer
-        // Otherwise there went something WRONG when a MeshInstanceBuilder called buildAt on this cell!
-        for(RoomSegmentMesh::InstanceBufferRange& mesh_instance : mesh_instances_)
-		    RoomSegmentMesh::Instance::updateHealth(
-			    mesh_instance.buffer_->id_,
-			    mesh_instance.offset_instances_,
-			    vertex_.health_points);
-	}
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	vertex_dirty_ = true; // uploaded with the next flush of the grid
+	// mesh instances read health from the grid state texture (automaton), their buffers stay untouched
+}
+
+bool GridCell::isVertexDirty() {
+	return vertex_dirty_;
+}
+
+void GridCell::clearVertexDirty() {
+	vertex_dirty_ = false;
 }
 
 void GridCell::setVertexBufferOffset(GLintptr o) {
@@ -103,6 +94,12 @@ void GridCell::setBuildState(unsigned int state) {
     vertex_.build_state = state;
 }
 
+void GridCell::setHealthPoints(unsigned int hp) {
+	if (hp < MIN_HEALTH) hp = MIN_HEALTH;
+	else if (hp > MAX_HEALTH) hp = MAX_HEALTH;
+	vertex_.health_points = hp;
+}
+
 unsigned int GridCell::getHealthPoints() {
 	return vertex_.health_points;
 }
@@ -172,4 +169,19 @@ RoomSegmentMesh::InstanceBufferRange GridCell::popMeshInstance() {
         mesh_instances_.pop_back();
     }
     return bufrange;
+}
+
+void GridCell::moveMeshInstance(RoomSegmentMesh* mesh, int old_offset, int new_offset) {
+    // called by the mesh when it compacted its instance buffer
+    for (RoomSegmentMesh::InstanceBufferRange& mesh_instance : mesh_instances_) {
+        if (mesh_instance.mesh_ == mesh && mesh_instance.offset_instances_ == old_offset) {
+            mesh_instance.offset_instances_ = new_offset;
+            return;
+        }
+    }
+}
+
+void GridCell::moveMeshInstancesToRoomOrderedBuffers(const roomgame::Room* room) {
+    for (RoomSegmentMesh::InstanceBufferRange& mesh_instance : mesh_instances_)
+        mesh_instance = mesh_instance.mesh_->moveInstanceToRoomOrderedBuffer(mesh_instance.offset_instances_, room);
 }
\ No newline at end of file
@@ -6,7 +6,7 @@
 
 /* Represents one cell of the grid.
  * Defines the build states used by the roomgame.
- * Holds position, build state and health points (on CPU and GPU side).
+ * Holds position, build state and health points (on CPU and GPU side, GPU side is updated in batches by the grid).
  * Supports debug rendering of grid cells as GL_POINTS.
  * Holds offset into a vertex buffer with a vertex for each grid cell.
  * The vertex buffer is owned by the grid.
@@ -77,6 +77,7 @@ private:
 		}
 	} vertex_;
 	GLintptr vertex_buffer_offset_;
+	bool vertex_dirty_; // vertex changed since the last flush of the grid vertex buffer
 	GridCell* northNeighbor;
 	GridCell* eastNeighbor;
 	GridCell* southNeighbor;
@@ -87,14 +88,18 @@ private:
 public:
 	GridCell(float x, float y, size_t col_idx, size_t row_idx);
 	~GridCell() = default;
-    void updateBuildState(GLuint vbo);
+    // Update functions only mark the vertex, the grid uploads all marked vertices once per frame (flushVertexData)
+    void updateBuildState();
     //void removeBuildState(GLuint vbo, unsigned int s, bool makeEmpty);
     //void addBuildState(GLuint vbo, unsigned int s);
     //void andBuildStateWith(GLuint vbo, unsigned int s);
     void setBuildState(unsigned int state);
-    void updateHealthPoints(GLuint vbo, unsigned int hp);
+    void updateHealthPoints(unsigned int hp);
+    void setHealthPoints(unsigned int hp);
 	static void setVertexAttribPointer();
 	void setVertexBufferOffset(GLintptr o);
+	bool isVertexDirty();
+	void clearVertexDirty();
 	void setNorthNeighbor(GridCell* N);
 	void setEastNeighbor(GridCell* E);
 	void setSouthNeighbor(GridCell* S);
@@ -122,6 +127,8 @@ public:
 	float getDistanceTo(GridCell* other);
     void pushMeshInstance(RoomSegmentMesh::InstanceBufferRange mesh_instance);
     RoomSegmentMesh::InstanceBufferRange popMeshInstance();
+    void moveMeshInstance(RoomSegmentMesh* mesh, int old_offset, int new_offset);
+    void moveMeshInstancesToRoomOrderedBuffers(const roomgame::Room* room);
 };
 
 #endif
\ No newline at end of file
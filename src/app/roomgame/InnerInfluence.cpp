@@ -1,5 +1,6 @@
 #include "InnerInfluence.h"
 #include "core/resources/GPUProgramManager.h"
+#include "GLStateCache.h"
 
 namespace roomgame
 {
@@ -33,7 +34,7 @@ namespace roomgame
 
     void InnerInfluence::transition() {
         if (GPUCellularAutomaton::isInitialized()) {
-            glUseProgram(shader_->getProgramId());
+            GLStateCache::current().useProgram(shader_->getProgramId());
             glUniform1ui(uloc_FLOW_SPEED, FLOW_SPEED);
             glUniform1i(uloc_CRITICAL_VALUE, CRITICAL_VALUE);
             GPUCellularAutomaton::transition();
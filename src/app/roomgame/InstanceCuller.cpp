@@ -0,0 +1,201 @@
+#include "InstanceCuller.h"
+#include <algorithm>
+#include <cmath>
+#include "GLStateCache.h"
+
+namespace roomgame
+{
+    const glm::vec2 InstanceCuller::LOD_CELL_PIXELS(16.0f, 6.0f);
+
+    InstanceCuller::InstanceCuller() :
+        program_(nullptr), renderer_(nullptr), instance_buffer_(0), instance_capacity_(0), indirect_buffer_(0),
+        counter_buffer_(0), draw_source_buffer_(0), source_draw_buffer_(0), draw_lod_buffer_(0), uloc_pass_(-1), uloc_cell_rect_(-1),
+        uloc_num_draws_(-1), uloc_view_projection_(-1), uloc_grid_origin_(-1), uloc_cell_size_(-1), uloc_viewport_size_(-1), uloc_lod_stride_(-1)
+    {
+    }
+
+    InstanceCuller::~InstanceCuller() {
+        cleanup();
+    }
+
+    bool InstanceCuller::isSupported() {
+        return MultiDrawRenderer::isSupported() && GLEW_ARB_compute_shader
+            && GLEW_ARB_shader_storage_buffer_object && GLEW_ARB_clear_buffer_object;
+    }
+
+    bool InstanceCuller::frustumSlabBounds(const glm::mat4& viewProjection, float minZ, float maxZ, glm::vec2& lo, glm::vec2& hi) {
+        // Frustum corners in world space
+        const glm::mat4 inv = glm::inverse(viewProjection);
+        glm::vec3 corners[8];
+        for (int i = 0; i < 8; i++) {
+            glm::vec4 p = inv * glm::vec4((i & 1) ? 1 : -1, (i & 2) ? 1 : -1, (i & 4) ? 1 : -1, 1);
+            if (p.w <= 0.0f) {
+                lo = glm::vec2(-INFINITY);
+                hi = glm::vec2(INFINITY);
+                return true;
+            }
+            corners[i] = glm::vec3(p) / p.w;
+        }
+        // Clip all frustum edges to the slab (vertices of the intersection lie on clipped edges)
+        const int edges[12][2] = { { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 }, { 0, 2 }, { 1, 3 },
+                                   { 4, 6 }, { 5, 7 }, { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 } };
+        lo = glm::vec2(INFINITY);
+        hi = glm::vec2(-INFINITY);
+        for (const int* edge : edges) {
+            const glm::vec3 a = corners[edge[0]];
+            const glm::vec3 d = corners[edge[1]] - a;
+            float t0 = 0.0f, t1 = 1.0f;
+            if (std::abs(d.z) < 1e-6f) {
+                if (a.z < minZ || a.z > maxZ) continue;
+            }
+            else {
+                float tMin = (minZ - a.z) / d.z;
+                float tMax = (maxZ - a.z) / d.z;
+                if (tMin > tMax) std::swap(tMin, tMax);
+                t0 = tMin > t0 ? tMin : t0;
+                t1 = tMax < t1 ? tMax : t1;
+                if (t0 > t1) continue;
+            }
+            for (float t : { t0, t1 }) {
+                const glm::vec2 p = glm::vec2(a + t * d);
+                lo = glm::vec2(p.x < lo.x ? p.x : lo.x, p.y < lo.y ? p.y : lo.y);
+                hi = glm::vec2(p.x > hi.x ? p.x : hi.x, p.y > hi.y ? p.y : hi.y);
+            }
+        }
+        return lo.x <= hi.x; // false if the frustum misses the slab
+    }
+
+    bool InstanceCuller::visibleCellRect(const glm::mat4& viewProjection, const Grid& grid, glm::ivec4& rect) {
+        glm::vec2 lo, hi;
+        if (!frustumSlabBounds(viewProjection, grid.minZ, grid.maxZ, lo, hi)) return false;
+        if (std::isinf(lo.x)) {
+            rect = glm::ivec4(0, 0, grid.numCols - 1, grid.numRows - 1); // degenerate projection: no culling
+            return true;
+        }
+
+        // Mesh of a cell is centered half a cell below the cell (see renderMeshInstance.vert), one cell margin around
+        const glm::vec2 first = glm::floor((lo - grid.origin) / grid.cellSize);
+        const glm::vec2 last = glm::floor((hi - grid.origin) / grid.cellSize);
+        const glm::vec2 maxCell(static_cast<float>(grid.numCols - 1), static_cast<float>(grid.numRows - 1));
+        const glm::vec2 firstCell = glm::clamp(first - glm::vec2(1, 0), glm::vec2(0), maxCell);
+        const glm::vec2 lastCell = glm::clamp(last + glm::vec2(1, 2), glm::vec2(0), maxCell);
+        rect = glm::ivec4(glm::ivec2(firstCell), glm::ivec2(lastCell));
+        return first.x - 1.0f <= maxCell.x && first.y <= maxCell.y && last.x + 1.0f >= 0.0f && last.y + 2.0f >= 0.0f;
+    }
+
+    bool InstanceCuller::coversGrid(const glm::ivec4& rect, const Grid& grid) {
+        return rect.x <= 0 && rect.y <= 0 && rect.z >= grid.numCols - 1 && rect.w >= grid.numRows - 1;
+    }
+
+    bool InstanceCuller::init(viscom::GPUProgram* program, MultiDrawRenderer& renderer) {
+        cleanup();
+        if (!isSupported() || !renderer.isReady()) return false;
+
+        std::vector<GLint> drawSources(renderer.getNumDraws());
+        std::vector<GLint> drawLODs(renderer.getNumDraws());
+        std::vector<GLint> sourceDraws(renderer.getNumSources(), -1);
+        for (size_t i = 0; i < drawSources.size(); i++) {
+            const size_t source = renderer.getDrawSource(i);
+            drawSources[i] = static_cast<GLint>(source);
+            drawLODs[i] = static_cast<GLint>(renderer.getDrawLOD(i));
+            if (sourceDraws[source] < 0) sourceDraws[source] = static_cast<GLint>(i); // level 0 comes first
+        }
+        glGenBuffers(1, &draw_source_buffer_);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, draw_source_buffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, drawSources.size() * sizeof(GLint), drawSources.data(), GL_STATIC_DRAW);
+        glGenBuffers(1, &source_draw_buffer_);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, source_draw_buffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sourceDraws.size() * sizeof(GLint), sourceDraws.data(), GL_STATIC_DRAW);
+        glGenBuffers(1, &draw_lod_buffer_);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, draw_lod_buffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, drawLODs.size() * sizeof(GLint), drawLODs.data(), GL_STATIC_DRAW);
+        glGenBuffers(1, &counter_buffer_);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, counter_buffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sourceDraws.size() * renderer.getNumLODLevels() * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+        glGenBuffers(1, &indirect_buffer_);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, indirect_buffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, renderer.getCommandBytes(), nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glGenBuffers(1, &instance_buffer_); // allocated on first cull (capacity follows the renderer)
+
+        uloc_pass_ = program->getUniformLocation("pass");
+        uloc_cell_rect_ = program->getUniformLocation("cellRect");
+        uloc_num_draws_ = program->getUniformLocation("numDraws");
+        uloc_view_projection_ = program->getUniformLocation("viewProjection");
+        uloc_grid_origin_ = program->getUniformLocation("gridOrigin");
+        uloc_cell_size_ = program->getUniformLocation("cellSize");
+        uloc_viewport_size_ = program->getUniformLocation("viewportSize");
+        uloc_lod_stride_ = program->getUniformLocation("lodStride");
+        // constant for the renderer
+        GLStateCache::current().useProgram(program->getProgramId());
+        glUniform1i(program->getUniformLocation("lodLevels"), static_cast<GLint>(renderer.getNumLODLevels()));
+        glUniform2f(program->getUniformLocation("lodCellPixels"), LOD_CELL_PIXELS.x, LOD_CELL_PIXELS.y);
+        program_ = program;
+        renderer_ = &renderer;
+        return true;
+    }
+
+    void InstanceCuller::cull(const glm::ivec4& rect, const glm::mat4& viewProjection, const Grid& grid, const glm::vec2& viewportSize) {
+        if (!isReady()) return;
+        // instances and commands may have been written by shaders (GPUInstanceGenerator)
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+        if (renderer_->getInstanceCapacity() > instance_capacity_) {
+            // same regions as the renderer for each level, so base instances of the commands only move by whole levels
+            instance_capacity_ = renderer_->getInstanceCapacity();
+            glBindBuffer(GL_COPY_WRITE_BUFFER, instance_buffer_);
+            glBufferData(GL_COPY_WRITE_BUFFER, instance_capacity_ * renderer_->getNumLODLevels() * sizeof(RoomSegmentMesh::Instance), nullptr, GL_DYNAMIC_COPY);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+        const GLsizeiptr commandBytes = static_cast<GLsizeiptr>(renderer_->getCommandBytes());
+        glBindBuffer(GL_COPY_READ_BUFFER, renderer_->getIndirectBuffer());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, indirect_buffer_);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, commandBytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        const GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, counter_buffer_);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        GLStateCache::current().useProgram(program_->getProgramId());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, renderer_->getInstanceBuffer());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, instance_buffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, counter_buffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, indirect_buffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, draw_source_buffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, source_draw_buffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_LOD_BINDING, draw_lod_buffer_);
+        glUniform4i(uloc_cell_rect_, rect.x, rect.y, rect.z, rect.w);
+        glUniform1i(uloc_num_draws_, static_cast<GLint>(renderer_->getNumDraws()));
+        glUniformMatrix4fv(uloc_view_projection_, 1, GL_FALSE, &viewProjection[0][0]);
+        glUniform3f(uloc_grid_origin_, grid.origin.x, grid.origin.y, 0.5f * (grid.minZ + grid.maxZ));
+        glUniform1f(uloc_cell_size_, grid.cellSize);
+        glUniform2f(uloc_viewport_size_, viewportSize.x, viewportSize.y);
+        glUniform1ui(uloc_lod_stride_, static_cast<GLuint>(instance_capacity_));
+
+        // pass 0: visible instances of each source
+        const GLuint maxInstances = static_cast<GLuint>(renderer_->getMaxSourceInstances());
+        if (maxInstances > 0) {
+            glUniform1i(uloc_pass_, 0);
+            glDispatchCompute((maxInstances + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, static_cast<GLuint>(renderer_->getNumSources()), 1);
+        }
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        // pass 1: visible counts to draw commands
+        glUniform1i(uloc_pass_, 1);
+        glDispatchCompute((static_cast<GLuint>(renderer_->getNumDraws()) + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+        for (GLuint binding = 0; binding <= DRAW_LOD_BINDING; binding++) glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+    }
+
+    void InstanceCuller::cleanup() {
+        GLuint buffers[] = { instance_buffer_, indirect_buffer_, counter_buffer_, draw_source_buffer_, source_draw_buffer_, draw_lod_buffer_ };
+        for (GLuint b : buffers) {
+            if (b != 0) glDeleteBuffers(1, &b);
+        }
+        instance_buffer_ = indirect_buffer_ = counter_buffer_ = draw_source_buffer_ = source_draw_buffer_ = draw_lod_buffer_ = 0;
+        instance_capacity_ = 0;
+        program_ = nullptr;
+        renderer_ = nullptr;
+    }
+}
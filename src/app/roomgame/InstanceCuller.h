@@ -0,0 +1,71 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "MultiDrawRenderer.h"
+
+namespace roomgame
+{
+    /* Per-viewport culling of the instances of a MultiDrawRenderer against the grid (see cullMeshInstances.comp).
+     * Cells form a regular lattice, so culling is conservative and works on a rectangle of cells:
+     * The view frustum is clipped to the slab the meshes of the grid live in, its bounding box gives the cell rectangle.
+     * A compute pass copies the instances inside the rectangle into an own instance buffer (same regions as the renderer)...
+     * ... and writes the visible instance counts into an own copy of the indirect draw commands.
+     * Each projector of a cluster only draws the instances on its slice of the grid.
+     * The same pass selects a level of detail per instance from the projected size of its cell...
+     * ... and appends it to the copy of its region for that level (one copy of all regions per level).
+    */
+    class InstanceCuller {
+    public:
+        static const GLuint WORKGROUP_SIZE = 64; // must match local_size_x in cullMeshInstances.comp
+        static const GLuint DRAW_LOD_BINDING = 6;
+
+        // World space layout of the grid cells and their meshes
+        struct Grid {
+            glm::vec2 origin; // lower left corner of cell (0, 0)
+            float cellSize;
+            GLint numCols;
+            GLint numRows;
+            float minZ; // lowest and highest point of any mesh on the grid
+            float maxZ;
+        };
+        // Projected cell size (pixels) below which level of detail 1 and 2 are drawn
+        static const glm::vec2 LOD_CELL_PIXELS;
+
+        InstanceCuller();
+        ~InstanceCuller();
+
+        static bool isSupported();
+        // Conservative rectangle of cells whose meshes may be visible (false if no cell is visible)
+        static bool visibleCellRect(const glm::mat4& viewProjection, const Grid& grid, glm::ivec4& rect);
+        // Bounds in x and y of the part of the view frustum between minZ and maxZ (false if there is none, infinite for degenerate projections)
+        static bool frustumSlabBounds(const glm::mat4& viewProjection, float minZ, float maxZ, glm::vec2& lo, glm::vec2& hi);
+        static bool coversGrid(const glm::ivec4& rect, const Grid& grid);
+
+        bool init(viscom::GPUProgram* program, MultiDrawRenderer& renderer);
+        // Cull the current instances of the renderer (after its update) and select their levels of detail
+        void cull(const glm::ivec4& rect, const glm::mat4& viewProjection, const Grid& grid, const glm::vec2& viewportSize);
+        void cleanup();
+        bool isReady() const { return program_ != nullptr; }
+        GLuint getInstanceBuffer() const { return instance_buffer_; }
+        GLuint getIndirectBuffer() const { return indirect_buffer_; }
+
+    private:
+        viscom::GPUProgram* program_;
+        MultiDrawRenderer* renderer_;
+        GLuint instance_buffer_; // visible instances (regions of the renderer per level of detail)
+        size_t instance_capacity_; // in instances per level of detail
+        GLuint indirect_buffer_; // draw commands with visible instance counts
+        GLuint counter_buffer_; // visible instances per source and level of detail
+        GLuint draw_source_buffer_; // source of each draw
+        GLuint source_draw_buffer_; // first draw of each source
+        GLuint draw_lod_buffer_; // level of detail of each draw
+        GLint uloc_pass_;
+        GLint uloc_cell_rect_;
+        GLint uloc_num_draws_;
+        GLint uloc_view_projection_;
+        GLint uloc_grid_origin_;
+        GLint uloc_cell_size_;
+        GLint uloc_viewport_size_;
+        GLint uloc_lod_stride_;
+    };
+}
@@ -1,5 +1,8 @@
 #include "InteractiveGrid.h"
 #include "RoomInteractionManager.h"
+#include "GLStateCache.h"
+#include <stdexcept>
+#include <string>
 
 namespace roomgame
 {
@@ -7,7 +10,13 @@ namespace roomgame
 
     InteractiveGrid::InteractiveGrid(size_t columns, size_t rows, float height) {
         height_units_ = height;
+        vao_ = 0;
+        vbo_ = 0;
         cell_size_ = height_units_ / float(rows);
+        // packed instances would alias cells of larger grids
+        if (columns > PerInstanceData::MAX_CELLS_PER_AXIS || rows > PerInstanceData::MAX_CELLS_PER_AXIS)
+            throw std::runtime_error("Grid of " + std::to_string(columns) + "x" + std::to_string(rows)
+                + " cells exceeds the mesh instance layout (" + std::to_string(PerInstanceData::MAX_CELLS_PER_AXIS) + " cells per axis)");
         //grid_center_ = glm::vec3(-1.0f + cell_size_ * columns / 2.0f, -1.0f + height_units_ / 2.0f, 0.0f);
         grid_center_ = glm::vec3(0, 0, -4);
         for (int x = 0; x < columns; x++) {
@@ -210,7 +219,7 @@ namespace roomgame
 
     void InteractiveGrid::uploadVertexData() {
         glGenVertexArrays(1, &vao_);
-        glBindVertexArray(vao_);
+        GLStateCache::current().bindVertexArray(vao_);
         glGenBuffers(1, &vbo_);
         glBindBuffer(GL_ARRAY_BUFFER, vbo_);
         size_t ncells = cells_.size() * cells_[0].size();
@@ -229,11 +238,51 @@ namespace roomgame
         });
         GridCell::setVertexAttribPointer();
         glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
+        GLStateCache::current().bindVertexArray(0);
         num_vertices_ = (GLsizei)ncells;
     }
 
 
+    void InteractiveGrid::flushVertexData() {
+        // clean cells between two changed cells are uploaded too if the gap is small (fewer, larger writes)
+        const size_t MAX_GAP_CELLS = 8;
+        const size_t bytes_per_cell = GridCell::getVertexBytes();
+        std::vector<GridCell*> gap;
+        GLintptr run_offset = 0;
+        bool bound = false;
+        auto appendVertex = [&](GridCell* cell) {
+            const unsigned char* v = static_cast<const unsigned char*>(cell->getVertexPointer());
+            vertex_staging_.insert(vertex_staging_.end(), v, v + bytes_per_cell);
+        };
+        auto flushRun = [&]() {
+            gap.clear();
+            if (vertex_staging_.empty()) return;
+            if (!bound) {
+                glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+                bound = true;
+            }
+            glBufferSubData(GL_ARRAY_BUFFER, run_offset, vertex_staging_.size(), vertex_staging_.data());
+            vertex_staging_.clear();
+        };
+        if (vbo_ == 0) return;
+        forEachCell([&](GridCell* cell) {
+            if (!cell->isVertexDirty()) {
+                if (vertex_staging_.empty()) return;
+                if (gap.size() < MAX_GAP_CELLS) gap.push_back(cell);
+                else flushRun();
+                return;
+            }
+            if (vertex_staging_.empty()) run_offset = cell->getVertexBufferOffset();
+            for (GridCell* g : gap) appendVertex(g);
+            gap.clear();
+            appendVertex(cell);
+            cell->clearVertexDirty();
+        });
+        flushRun();
+        if (bound) glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+
     void InteractiveGrid::loadShader(viscom::GPUProgramManager mgr) {
         glEnable(GL_PROGRAM_POINT_SIZE);
         shader_ = mgr.GetResource("viewBuildStates",
@@ -245,9 +294,9 @@ namespace roomgame
     void InteractiveGrid::onFrame() {
         // Debug render
         glDisable(GL_DEPTH_TEST);
-        glBindVertexArray(vao_);
+        GLStateCache::current().bindVertexArray(vao_);
         glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-        glUseProgram(shader_->getProgramId());
+        GLStateCache::current().useProgram(shader_->getProgramId());
         last_view_projection_ = glm::translate(last_view_projection_, translation_);
 
         glUniformMatrix4fv(mvp_uniform_location_, 1, GL_FALSE, glm::value_ptr(last_view_projection_));
@@ -258,7 +307,7 @@ namespace roomgame
 
     void InteractiveGrid::cleanup() {
         glDeleteBuffers(1, &vbo_);
-        glDeleteVertexArrays(1, &vao_);
+        GLStateCache::current().deleteVertexArray(vao_);
     }
 
     // TODO TEST What happens with concurrent input? Multitouch!?
@@ -24,6 +24,7 @@ namespace roomgame {
         GLint mvp_uniform_location_;
         glm::vec3 translation_;
         GLsizei num_vertices_;
+        std::vector<unsigned char> vertex_staging_; // merged range of changed cell vertices (flushVertexData)
         glm::mat4 last_view_projection_;
         // Input-related members
         glm::vec3 last_ray_start_point_;
@@ -69,6 +70,8 @@ namespace roomgame {
 
         // Render functions
         void uploadVertexData();
+        /* Upload vertices of changed cells (once per frame), neighbouring changes are merged into one range */
+        void flushVertexData();
         void loadShader(viscom::GPUProgramManager);
         void onFrame();
         void cleanup();
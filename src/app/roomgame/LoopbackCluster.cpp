@@ -0,0 +1,176 @@
+#include "LoopbackCluster.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "SyncQuantization.h"
+
+namespace roomgame
+{
+    LoopbackCluster::LoopbackCluster(int numSlaves, ReplicateFunction replicate, DecodeFunction decode, RequestFunction requestFullFrame, unsigned int seed) :
+        decode_(decode),
+        request_full_frame_(requestFullFrame),
+        rnd_(seed),
+        slaves_(static_cast<size_t>(std::max(numSlaves, 0))),
+        slave_stats_(slaves_.size())
+    {
+        for (Slave& slave : slaves_) slave.objects = replicate();
+    }
+
+    void LoopbackCluster::submitFrame(const MemorySyncStream& payload, bool fullFrame, double encodeSeconds) {
+        frame_++;
+        const size_t wireBytes = payload.size();
+        stats_.frames++;
+        stats_.bytes_total += wireBytes;
+        stats_.bytes_last = wireBytes;
+        stats_.bytes_max = std::max(stats_.bytes_max, wireBytes);
+        stats_.encode_seconds_total += encodeSeconds;
+        stats_.encode_seconds_max = std::max(stats_.encode_seconds_max, encodeSeconds);
+
+        auto shared_payload = std::make_shared<const std::vector<unsigned char>>(payload.data());
+        std::uniform_real_distribution<float> chance(0.0f, 1.0f);
+        const int min_latency = std::max(transport_.min_latency_frames, 0);
+        const int max_latency = std::max(transport_.max_latency_frames, min_latency);
+        std::uniform_int_distribution<int> latency(min_latency, max_latency);
+        for (size_t i = 0; i < slaves_.size(); i++) {
+            if (chance(rnd_) < transport_.drop_probability) {
+                slave_stats_[i].frames_dropped++;
+                if (fullFrame) slaves_[i].full_frame_requested = false; // ask again
+                continue;
+            }
+            unsigned long long deliver_at = frame_ + latency(rnd_);
+            if (chance(rnd_) < transport_.reorder_probability) {
+                deliver_at++; // held back, so the next payload may overtake it
+            }
+            slaves_[i].in_flight.push_back(Packet{ frame_, deliver_at, fullFrame, shared_payload });
+        }
+    }
+
+    void LoopbackCluster::tick() {
+        for (size_t i = 0; i < slaves_.size(); i++) {
+            Slave& slave = slaves_[i];
+            SlaveStats& st = slave_stats_[i];
+            // deliver in arrival order (packets with equal arrival keep submit order)
+            std::stable_sort(slave.in_flight.begin(), slave.in_flight.end(),
+                [](const Packet& a, const Packet& b) { return a.deliver_at < b.deliver_at; });
+            bool delivered = false;
+            while (!slave.in_flight.empty() && slave.in_flight.front().deliver_at <= frame_) {
+                Packet p = slave.in_flight.front();
+                slave.in_flight.pop_front();
+                if (slave.has_state && p.frame <= slave.applied_frame) {
+                    st.frames_stale++;
+                    if (p.full_frame) slave.full_frame_requested = false; // ask again
+                    continue;
+                }
+                // frames in between were skipped: the objects changed in them are missing
+                if (p.full_frame) slave.missed_frames = false;
+                else if (!slave.has_state || p.frame != slave.applied_frame + 1) slave.missed_frames = true;
+                MemorySyncStream in(*p.payload);
+                const auto start = std::chrono::high_resolution_clock::now();
+                try {
+                    decode_(in, *slave.objects);
+                    if (in.remaining() != 0) {
+                        st.decode_errors++;
+                        slave.missed_frames = true;
+                    }
+                }
+                catch (const std::out_of_range&) {
+                    st.decode_errors++;
+                    slave.missed_frames = true;
+                }
+                const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+                st.frames_decoded++;
+                st.decode_seconds_total += seconds;
+                st.decode_seconds_max = std::max(st.decode_seconds_max, seconds);
+                slave.applied_frame = p.frame;
+                slave.has_state = true;
+                delivered = true;
+                if (p.full_frame) slave.full_frame_requested = false;
+            }
+            if (delivered) {
+                // once per frame, like the slave node (objects decoded from several payloads apply their latest state)
+                const auto start = std::chrono::high_resolution_clock::now();
+                slave.objects->updateSyncedSlave();
+                const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+                st.updates++;
+                st.apply_seconds_total += seconds;
+                st.apply_seconds_max = std::max(st.apply_seconds_max, seconds);
+            }
+            if (slave.missed_frames && !slave.full_frame_requested) {
+                request_full_frame_();
+                slave.full_frame_requested = true;
+                st.full_frames_requested++;
+            }
+            st.current_lag = slave.has_state ? frame_ - slave.applied_frame : frame_;
+            st.max_lag = std::max(st.max_lag, st.current_lag);
+            const std::string divergent = slave.has_state ? slave.objects->findDivergent() : std::string("(no state)");
+            if (!divergent.empty()) {
+                st.frames_divergent++;
+                st.last_divergent_object = divergent;
+            }
+        }
+    }
+
+    void LoopbackCluster::resetStats() {
+        stats_ = Stats();
+        for (SlaveStats& st : slave_stats_) st = SlaveStats();
+    }
+
+    void LoopbackCluster::printStats(std::ostream& out) const {
+        const double frames = static_cast<double>(std::max(stats_.frames, 1ULL));
+        out << "Loopback cluster: " << slaves_.size() << " slaves, " << stats_.frames << " frames" << std::endl;
+        out << "  bytes/frame: avg " << stats_.bytes_total / frames << ", max " << stats_.bytes_max << std::endl;
+        out << "  encode ms: avg " << 1000.0 * stats_.encode_seconds_total / frames
+            << ", max " << 1000.0 * stats_.encode_seconds_max << std::endl;
+        out << "  quantization clamps: " << quantization::clampCount() << std::endl;
+        for (size_t i = 0; i < slave_stats_.size(); i++) {
+            const SlaveStats& st = slave_stats_[i];
+            const double decoded = static_cast<double>(std::max(st.frames_decoded, 1ULL));
+            const double updates = static_cast<double>(std::max(st.updates, 1ULL));
+            out << "  slave " << i << ": decoded " << st.frames_decoded
+                << ", dropped " << st.frames_dropped
+                << ", stale " << st.frames_stale
+                << ", divergent " << st.frames_divergent
+                << ", decode errors " << st.decode_errors
+                << ", full frames requested " << st.full_frames_requested
+                << ", lag " << st.current_lag << " (max " << st.max_lag << ")"
+                << ", decode ms: avg " << 1000.0 * st.decode_seconds_total / decoded
+                << ", max " << 1000.0 * st.decode_seconds_max
+                << ", apply ms: avg " << 1000.0 * st.apply_seconds_total / updates
+                << ", max " << 1000.0 * st.apply_seconds_max << std::endl;
+            if (st.frames_divergent > 0) out << "    last divergent object: " << st.last_divergent_object << std::endl;
+        }
+    }
+
+    bool LoopbackScript::load(const std::string& path) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            std::cerr << "LoopbackScript: could not open " << path << std::endl;
+            return false;
+        }
+        commands_.clear();
+        next_ = 0;
+        std::string line;
+        while (std::getline(file, line)) {
+            line = line.substr(0, line.find('#'));
+            std::istringstream tokens(line);
+            Command cmd;
+            if (!(tokens >> cmd.frame >> cmd.name)) continue;
+            float arg;
+            while (tokens >> arg) cmd.args.push_back(arg);
+            commands_.push_back(cmd);
+        }
+        std::stable_sort(commands_.begin(), commands_.end(),
+            [](const Command& a, const Command& b) { return a.frame < b.frame; });
+        return true;
+    }
+
+    std::vector<LoopbackScript::Command> LoopbackScript::due(unsigned long long frame) {
+        std::vector<Command> result;
+        while (next_ < commands_.size() && commands_[next_].frame <= frame) {
+            result.push_back(commands_[next_++]);
+        }
+        return result;
+    }
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "SyncRegistry.h"
+#include "SyncStream.h"
+
+namespace roomgame
+{
+    /* In-process loopback cluster for testing and benchmarking master/slave sync on a single machine.
+     * Replaces the SGCT network by an in-memory transport:
+     * The master encodes each frame once into a MemorySyncStream and submits the same bytes it sends to the cluster.
+     * The transport delays, reorders and drops payloads per slave (seeded, so sessions are reproducible).
+     * Each of the N slaves decodes delivered payloads into its own replicas of the sync objects (never into the master's objects),
+     * ... with the decode and updateSyncedSlave code of the slave node (see SyncRegistry::replicate).
+     * Slaves behave like sequence-numbered receivers: payloads older than the applied state are discarded.
+     * Measures encode/decode time, bytes per frame and state divergence:
+     * A slave diverges in a frame if the state it applied differs from the master's live state (SyncRegistry::findDivergent).
+     * Sync objects are only sent when they change (SyncRegistry), so a slave that misses a frame (dropped, or overtaken and then stale)...
+     * ... lacks the objects changed in it: it detects the gap in the frame numbers and requests a full frame from the master...
+     * ... (again if that one is lost too) and holds outdated objects until it arrives (SGCT itself never drops payloads).
+     * Enabled on the master node by the CMake cache variable VISCOM_LOOPBACK_SLAVES (number of slaves).
+    */
+    class LoopbackCluster {
+    public:
+        struct TransportSettings {
+            int min_latency_frames = 0;
+            int max_latency_frames = 0;
+            float reorder_probability = 0.0f; // chance that a payload is held back one extra frame
+            float drop_probability = 0.0f;
+        };
+        struct SlaveStats {
+            unsigned long long frames_decoded = 0;
+            unsigned long long frames_dropped = 0; // lost by the transport
+            unsigned long long frames_stale = 0; // arrived after a newer frame was applied
+            unsigned long long frames_divergent = 0; // frames in which the applied state differed from the master
+            unsigned long long decode_errors = 0; // payloads not consumed exactly by the decode function
+            unsigned long long full_frames_requested = 0; // after missed frames
+            unsigned long long current_lag = 0; // frames between master and applied state
+            unsigned long long max_lag = 0;
+            double decode_seconds_total = 0.0;
+            double decode_seconds_max = 0.0;
+            unsigned long long updates = 0; // updateSyncedSlave calls (once per tick with delivered frames)
+            double apply_seconds_total = 0.0;
+            double apply_seconds_max = 0.0;
+            std::string last_divergent_object; // first differing object in the last divergent frame
+        };
+        struct Stats {
+            unsigned long long frames = 0;
+            unsigned long long bytes_total = 0;
+            size_t bytes_max = 0;
+            size_t bytes_last = 0;
+            double encode_seconds_total = 0.0;
+            double encode_seconds_max = 0.0;
+        };
+        using ReplicateFunction = std::function<std::unique_ptr<SyncRegistry>()>; // master: sync objects of a new slave
+        using DecodeFunction = std::function<void(SyncStream&, SyncRegistry&)>; // decode a frame like the slave node
+        using RequestFunction = std::function<void()>; // master: send all objects in the next frame
+
+        LoopbackCluster(int numSlaves, ReplicateFunction replicate, DecodeFunction decode, RequestFunction requestFullFrame, unsigned int seed = 1);
+
+        /* Master: hand over the encoded frame (payload is copied into the transport)
+         * fullFrame: the frame holds all objects (see SyncRegistry::isFullFrame)
+        */
+        void submitFrame(const MemorySyncStream& payload, bool fullFrame, double encodeSeconds);
+        // Deliver all payloads that are due in the current frame, decode and apply them, compare with the master's live state
+        void tick();
+
+        TransportSettings& transport() { return transport_; }
+        const Stats& stats() const { return stats_; }
+        const std::vector<SlaveStats>& slaveStats() const { return slave_stats_; }
+        void resetStats();
+        void printStats(std::ostream& out) const;
+
+    private:
+        struct Packet {
+            unsigned long long frame;
+            unsigned long long deliver_at; // transport frame in which the packet arrives
+            bool full_frame;
+            std::shared_ptr<const std::vector<unsigned char>> payload; // shared between slaves
+        };
+        struct Slave {
+            std::deque<Packet> in_flight;
+            unsigned long long applied_frame = 0;
+            std::unique_ptr<SyncRegistry> objects; // replicas, decoded like on a slave node
+            bool has_state = false;
+            bool missed_frames = false; // objects of a missed frame are lacking until a full frame is applied
+            bool full_frame_requested = false;
+        };
+
+        DecodeFunction decode_;
+        RequestFunction request_full_frame_;
+        TransportSettings transport_;
+        std::mt19937 rnd_;
+        std::vector<Slave> slaves_;
+        std::vector<SlaveStats> slave_stats_; // same order as slaves_
+        Stats stats_;
+        unsigned long long frame_ = 0; // last submitted master frame
+    };
+
+    /* Scripted session for the loopback harness
+     * One command per line, prefixed by the master frame it is executed in ('#' starts a comment):
+     *   <frame> build <col> <row> <buildState>    (build state as number, e.g. 5 = INSIDE_ROOM | WALL)
+     *   <frame> reset
+     *   <frame> transport <minLatency> <maxLatency> <reorderProbability> <dropProbability>
+     *   <frame> stats
+     *   <frame> quit
+    */
+    class LoopbackScript {
+    public:
+        struct Command {
+            unsigned long long frame;
+            std::string name;
+            std::vector<float> args;
+        };
+        bool load(const std::string& path);
+        // Pop all commands due in the given frame (commands are sorted by frame)
+        std::vector<Command> due(unsigned long long frame);
+        bool empty() const { return next_ >= commands_.size(); }
+    private:
+        std::vector<Command> commands_;
+        size_t next_ = 0;
+    };
+}
@@ -12,24 +12,16 @@ namespace roomgame
     /* Called only on master (resulting instance buffer is synced) */
     void MeshInstanceBuilder::addInstanceAt(GridCell* c, GLuint buildStateBits) {
         RoomSegmentMesh::Instance instance;
-        float cell_size_ = interactiveGrid_->getCellSize();
-        instance.scale = cell_size_ / 1.98f; // assume model extends [-1,1]^3
-        instance.translation = interactiveGrid_->getTranslation(); // grid translation
-        instance.translation += glm::vec3(c->getPosition(), 0.0f); // + relative cell translation
-        instance.translation += glm::vec3(cell_size_ / 2.0f, -cell_size_ / 2.0f, 0.0f); // + origin to middle of cell
-        instance.health = c->getHealthPoints();
 
         // get a mesh instance for all given buildstate bits that have a mapping in the meshpool
-        meshpool_->filter(buildStateBits, [&](GLuint renderableBuildState) {
+        meshpool_->forEachMeshOfState(buildStateBits, RoomSegmentMeshPool::cellHash(c->getCol(), c->getRow()),
+            [&](RoomSegmentMesh* mesh, GLuint renderableBuildState) {
 
             // make the shader see only the subset of build states for which this mesh was added to the pool
-            instance.buildState = renderableBuildState;
-            
-            RoomSegmentMesh* mesh = meshpool_->getMeshOfType(renderableBuildState);
-            if (!mesh) {
-                return;
-            }
-            RoomSegmentMesh::InstanceBufferRange bufrange = mesh->addInstanceUnordered(instance);
+            // (translation and scale are derived from the cell in the shader, see renderMeshInstance.vert)
+            instance.packed = RoomSegmentMesh::Instance::pack(c->getCol(), c->getRow(), renderableBuildState);
+
+            RoomSegmentMesh::InstanceBufferRange bufrange = mesh->addInstanceUnordered(instance, c);
             c->pushMeshInstance(bufrange);
         });
     }
@@ -117,10 +109,10 @@ namespace roomgame
         }
         if ((newSt & (GridCell::SOURCE | GridCell::INFECTED | GridCell::TEMPORARY)) == 0)
         {
-            c->updateHealthPoints(interactiveGrid_->vbo_, GridCell::MAX_HEALTH);
+            c->updateHealthPoints(GridCell::MAX_HEALTH);
         }
         c->setBuildState(newSt);
-        c->updateBuildState(interactiveGrid_->vbo_);
+        c->updateBuildState();
         automatonUpdater_->updateAutomatonAt(c, newSt, c->getHealthPoints());
     }
 
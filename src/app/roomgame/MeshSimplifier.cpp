@@ -0,0 +1,74 @@
+#include "MeshSimplifier.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <cmath>
+
+namespace roomgame
+{
+    std::vector<unsigned int> MeshSimplifier::clusterVertices(const std::vector<glm::vec3>& positions,
+        const unsigned int* indices, size_t numIndices, unsigned int resolution) {
+        std::vector<unsigned int> result;
+        if (numIndices < 3 || resolution == 0) return result;
+
+        // Bounding box of the referenced vertices
+        glm::vec3 lo(INFINITY), hi(-INFINITY);
+        for (size_t i = 0; i < numIndices; i++) {
+            const glm::vec3& p = positions[indices[i]];
+            lo = glm::vec3(p.x < lo.x ? p.x : lo.x, p.y < lo.y ? p.y : lo.y, p.z < lo.z ? p.z : lo.z);
+            hi = glm::vec3(p.x > hi.x ? p.x : hi.x, p.y > hi.y ? p.y : hi.y, p.z > hi.z ? p.z : hi.z);
+        }
+        const glm::vec3 extent = hi - lo;
+        const float maxCell = static_cast<float>(resolution - 1);
+        auto cellOf = [&](const glm::vec3& p) {
+            glm::vec3 c(0);
+            for (int a = 0; a < 3; a++) {
+                if (extent[a] > 0.0f) c[a] = glm::clamp(std::floor((p[a] - lo[a]) / extent[a] * resolution), 0.0f, maxCell);
+            }
+            return (static_cast<size_t>(c.z) * resolution + static_cast<size_t>(c.y)) * resolution + static_cast<size_t>(c.x);
+        };
+
+        // Mean of each cluster
+        struct Cluster {
+            glm::vec3 sum;
+            unsigned int count;
+            unsigned int representative;
+            float distance; // of the representative to the mean
+        };
+        std::unordered_map<size_t, Cluster> clusters;
+        std::unordered_map<unsigned int, size_t> vertexCluster;
+        for (size_t i = 0; i < numIndices; i++) {
+            const unsigned int v = indices[i];
+            if (vertexCluster.find(v) != vertexCluster.end()) continue;
+            const size_t cell = cellOf(positions[v]);
+            vertexCluster[v] = cell;
+            Cluster& cluster = clusters.emplace(cell, Cluster{ glm::vec3(0), 0, v, INFINITY }).first->second;
+            cluster.sum += positions[v];
+            cluster.count++;
+        }
+        // Representative: referenced vertex closest to the mean
+        for (const std::pair<const unsigned int, size_t>& vc : vertexCluster) {
+            Cluster& cluster = clusters[vc.second];
+            const glm::vec3 d = positions[vc.first] - cluster.sum / static_cast<float>(cluster.count);
+            const float distance = glm::dot(d, d);
+            if (distance < cluster.distance || (distance == cluster.distance && vc.first < cluster.representative)) {
+                cluster.distance = distance;
+                cluster.representative = vc.first;
+            }
+        }
+
+        // Remap triangles, drop degenerate and duplicate ones (winding is kept)
+        std::unordered_set<unsigned long long> emitted;
+        for (size_t i = 0; i + 2 < numIndices; i += 3) {
+            unsigned int t[3];
+            for (int k = 0; k < 3; k++) t[k] = clusters[vertexCluster[indices[i + k]]].representative;
+            if (t[0] == t[1] || t[1] == t[2] || t[0] == t[2]) continue;
+            // rotate the smallest index first, so the same triangle always gives the same key
+            int first = t[0] < t[1] ? (t[0] < t[2] ? 0 : 2) : (t[1] < t[2] ? 1 : 2);
+            const unsigned long long key = (static_cast<unsigned long long>(t[first]) << 42)
+                ^ (static_cast<unsigned long long>(t[(first + 1) % 3]) << 21) ^ t[(first + 2) % 3];
+            if (!emitted.insert(key).second) continue;
+            result.insert(result.end(), t, t + 3);
+        }
+        return result;
+    }
+}
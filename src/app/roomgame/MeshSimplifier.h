@@ -0,0 +1,20 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace roomgame
+{
+    /* Simplification of triangle lists by vertex clustering (used for the levels of detail of room segment meshes).
+     * The bounding box of the referenced vertices is divided into resolution^3 cells...
+     * ... all vertices of a cell collapse into the vertex closest to their mean (no new vertices, attributes stay valid).
+     * Triangles with less than three distinct clusters vanish, so do duplicates.
+     * Fast and robust for load time, but not topology preserving (small features may close or disappear).
+    */
+    class MeshSimplifier {
+    public:
+        // Indices of the simplified triangles (into the same vertices as the input indices)
+        static std::vector<unsigned int> clusterVertices(const std::vector<glm::vec3>& positions,
+            const unsigned int* indices, size_t numIndices, unsigned int resolution);
+    };
+}
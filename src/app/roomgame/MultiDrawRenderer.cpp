@@ -0,0 +1,342 @@
+#include "MultiDrawRenderer.h"
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include "MeshSimplifier.h"
+#include "GLStateCache.h"
+
+namespace roomgame
+{
+    namespace {
+        // Vertex clustering grid of the simplified levels of detail (0: full mesh)
+        const unsigned int LOD_CLUSTER_RESOLUTION[MultiDrawRenderer::LOD_LEVELS] = { 0, 16, 8 };
+    }
+
+    MultiDrawRenderer::MultiDrawRenderer() :
+        lod_levels_(0), vao_(0), vbo_(0), ibo_(0), instance_buffer_(0), instance_capacity_(0), generated_capacity_(0), max_source_instances_(0), indirect_buffer_(0), draw_data_buffer_(0)
+    {
+    }
+
+    MultiDrawRenderer::~MultiDrawRenderer() {
+        cleanup();
+    }
+
+    bool MultiDrawRenderer::isSupported() {
+        return GLEW_ARB_multi_draw_indirect && GLEW_ARB_shader_draw_parameters
+            && GLEW_ARB_base_instance && GLEW_ARB_vertex_attrib_binding;
+    }
+
+    void MultiDrawRenderer::buildLODChain(RoomSegmentMesh* mesh) {
+        if (!isSupported()) return; // levels of detail are only drawn by multi draws
+        viscom::Mesh* full = mesh->getLODMesh(0);
+        std::vector<RoomSegmentMesh::SimplifiedLOD> levels(LOD_LEVELS);
+        std::vector<unsigned int> indices; // read back once for all levels
+        for (size_t lod = 1; lod < LOD_LEVELS; lod++) {
+            if (mesh->getLODMesh(lod)) continue; // supplied
+            if (indices.empty()) {
+                GLint indexBytes = 0;
+                glBindBuffer(GL_COPY_READ_BUFFER, full->GetIndexBuffer());
+                glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &indexBytes);
+                indices.resize(indexBytes / sizeof(unsigned int));
+                glGetBufferSubData(GL_COPY_READ_BUFFER, 0, indices.size() * sizeof(unsigned int), indices.data());
+                glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            }
+            RoomSegmentMesh::SimplifiedLOD& level = levels[lod];
+            RoomSegmentMesh::forEachSubmeshOf(full, [&](const viscom::SubMesh* submesh, const glm::mat4&) {
+                std::vector<unsigned int> simplified = MeshSimplifier::clusterVertices(full->GetVertices(),
+                    indices.data() + submesh->GetIndexOffset(), submesh->GetNumberOfIndices(), LOD_CLUSTER_RESOLUTION[lod]);
+                level.submeshes.push_back(std::make_pair(static_cast<GLuint>(level.indices.size()), static_cast<GLuint>(simplified.size())));
+                level.indices.insert(level.indices.end(), simplified.begin(), simplified.end());
+            });
+        }
+        mesh->setSimplifiedLODs(std::move(levels));
+    }
+
+    bool MultiDrawRenderer::init(const std::vector<RoomSegmentMesh*>& meshes, viscom::GPUProgram* program) {
+        cleanup();
+        if (!isSupported() || meshes.empty()) return false;
+        GLuint blockIndex = glGetUniformBlockIndex(program->getProgramId(), "DrawDataBlock");
+        if (blockIndex == GL_INVALID_INDEX) return false;
+
+        // Collect sources and submesh draws (a room-ordered mesh shares vertices, indices and draw data with its unordered mesh)
+        struct Resource {
+            const viscom::Mesh* mesh;
+            GLuint vbo;
+            bool ownsVbo; // supplied levels of detail have no mesh with a vertex buffer of our layout
+            GLuint ibo;
+            GLint vertexBase;
+            GLuint indexBase;
+            size_t numVertices;
+            size_t numIndices;
+        };
+        std::vector<Resource> resources;
+        std::vector<DrawData> drawData;
+        std::vector<GLuint> drawDataIndices; // entry in drawData of each draw
+        // resource and index offset of a submesh -> entry in drawData (all levels simplified from it and room-ordered meshes share it)
+        std::map<std::pair<size_t, GLuint>, GLuint> drawDataOfSubmesh;
+        std::vector<unsigned int> simplifiedIndices; // appended behind the indices of all resources
+        std::vector<size_t> simplifiedDraws;
+        // simplified level of detail -> its first index in simplifiedIndices (room-ordered meshes share them)
+        std::map<const RoomSegmentMesh::SimplifiedLOD*, GLuint> simplifiedBases;
+        size_t totalVertices = 0;
+        size_t totalIndices = 0;
+        for (RoomSegmentMesh* mesh : meshes) {
+            sources_.push_back(mesh);
+            if (mesh->getRoomOrderedMesh()) sources_.push_back(mesh->getRoomOrderedMesh());
+        }
+        auto findResource = [&](viscom::Mesh* meshResource, RoomSegmentMesh* source) {
+            size_t r = 0;
+            while (r < resources.size() && resources[r].mesh != meshResource) r++;
+            if (r == resources.size()) {
+                GLint indexBytes = 0;
+                glBindBuffer(GL_COPY_READ_BUFFER, meshResource->GetIndexBuffer());
+                glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &indexBytes);
+                Resource res;
+                res.mesh = meshResource;
+                res.ownsVbo = meshResource != source->getMesh();
+                res.vbo = res.ownsVbo ? viscom::SimpleMeshVertex::CreateVertexBuffer(meshResource) : source->getVertexBuffer();
+                res.ibo = meshResource->GetIndexBuffer();
+                res.vertexBase = static_cast<GLint>(totalVertices);
+                res.indexBase = static_cast<GLuint>(totalIndices);
+                res.numVertices = meshResource->GetVertices().size();
+                res.numIndices = indexBytes / sizeof(unsigned int);
+                totalVertices += res.numVertices;
+                totalIndices += res.numIndices;
+                resources.push_back(res);
+            }
+            return r;
+        };
+        lod_levels_ = LOD_LEVELS;
+        for (size_t s = 0; s < sources_.size(); s++) {
+            for (size_t lod = 0; lod < lod_levels_; lod++) {
+                // supplied level (own resource), simplified from level 0 when the mesh was added, or level 0 itself
+                viscom::Mesh* lodMesh = sources_[s]->getLODMesh(lod);
+                const RoomSegmentMesh::SimplifiedLOD* simplified = lodMesh ? nullptr : sources_[s]->getSimplifiedLOD(lod);
+                if (!lodMesh) lodMesh = sources_[s]->getLODMesh(0);
+                const size_t r = findResource(lodMesh, sources_[s]);
+                GLuint simplifiedBase = 0;
+                if (simplified) {
+                    auto base = simplifiedBases.find(simplified);
+                    if (base == simplifiedBases.end()) {
+                        // relative to the simplified indices until all resources are known
+                        base = simplifiedBases.emplace(simplified, static_cast<GLuint>(simplifiedIndices.size())).first;
+                        simplifiedIndices.insert(simplifiedIndices.end(), simplified->indices.begin(), simplified->indices.end());
+                    }
+                    simplifiedBase = base->second;
+                }
+                size_t submeshIndex = 0;
+                RoomSegmentMesh::forEachSubmeshOf(lodMesh, [&](const viscom::SubMesh* submesh, const glm::mat4& localTransform) {
+                    Draw draw;
+                    draw.source = s;
+                    draw.lod = lod;
+                    draw.count = submesh->GetNumberOfIndices();
+                    draw.firstIndex = resources[r].indexBase + submesh->GetIndexOffset();
+                    draw.baseVertex = resources[r].vertexBase;
+                    // empty simplification: keep the full submesh
+                    if (simplified && submeshIndex < simplified->submeshes.size() && simplified->submeshes[submeshIndex].second > 0) {
+                        draw.firstIndex = simplifiedBase + simplified->submeshes[submeshIndex].first;
+                        draw.count = simplified->submeshes[submeshIndex].second;
+                        simplifiedDraws.push_back(draws_.size());
+                    }
+                    submeshIndex++;
+                    draws_.push_back(draw);
+                    const auto key = std::make_pair(r, static_cast<GLuint>(submesh->GetIndexOffset()));
+                    auto data = drawDataOfSubmesh.find(key);
+                    if (data == drawDataOfSubmesh.end()) {
+                        DrawData entry;
+                        entry.subMeshLocalMatrix = localTransform;
+                        entry.ambientAlpha = glm::vec4(0, 0, 0, 1);
+                        entry.diffuse = glm::vec4(1);
+                        entry.specularExponent = glm::vec4(0, 0, 0, 1);
+                        const viscom::Material* mat = submesh->GetMaterial();
+                        if (mat) {
+                            entry.ambientAlpha = glm::vec4(mat->ambient, mat->alpha);
+                            entry.diffuse = glm::vec4(mat->diffuse, 1);
+                            entry.specularExponent = glm::vec4(mat->specular, mat->specularExponent);
+                        }
+                        data = drawDataOfSubmesh.emplace(key, static_cast<GLuint>(drawData.size())).first;
+                        drawData.push_back(entry);
+                    }
+                    drawDataIndices.push_back(data->second);
+                });
+            }
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        if (draws_.size() > MAX_DRAWS || drawData.size() > MAX_DRAW_DATA) {
+            std::cerr << "Multi draw of the mesh pool needs " << draws_.size() << " draws (max " << MAX_DRAWS << ") and "
+                << drawData.size() << " submeshes (max " << MAX_DRAW_DATA << "), meshes are drawn one by one" << std::endl;
+        }
+        if (draws_.empty() || draws_.size() > MAX_DRAWS || drawData.size() > MAX_DRAW_DATA) {
+            for (const Resource& res : resources) {
+                if (res.ownsVbo) glDeleteBuffers(1, &res.vbo);
+            }
+            cleanup();
+            return false;
+        }
+        for (size_t i : simplifiedDraws) draws_[i].firstIndex += static_cast<GLuint>(totalIndices);
+
+        // Shared vertex and index buffer (copied on the GPU from the buffers of each mesh)
+        glGenBuffers(1, &vbo_);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vbo_);
+        glBufferData(GL_COPY_WRITE_BUFFER, totalVertices * sizeof(viscom::SimpleMeshVertex), nullptr, GL_STATIC_DRAW);
+        for (const Resource& res : resources) {
+            glBindBuffer(GL_COPY_READ_BUFFER, res.vbo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+                res.vertexBase * sizeof(viscom::SimpleMeshVertex), res.numVertices * sizeof(viscom::SimpleMeshVertex));
+            if (res.ownsVbo) glDeleteBuffers(1, &res.vbo);
+        }
+        glGenBuffers(1, &ibo_);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, ibo_);
+        glBufferData(GL_COPY_WRITE_BUFFER, (totalIndices + simplifiedIndices.size()) * sizeof(unsigned int), nullptr, GL_STATIC_DRAW);
+        for (const Resource& res : resources) {
+            glBindBuffer(GL_COPY_READ_BUFFER, res.ibo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+                res.indexBase * sizeof(unsigned int), res.numIndices * sizeof(unsigned int));
+        }
+        if (!simplifiedIndices.empty())
+            glBufferSubData(GL_COPY_WRITE_BUFFER, totalIndices * sizeof(unsigned int), simplifiedIndices.size() * sizeof(unsigned int), simplifiedIndices.data());
+
+        // Per-submesh data and the entry of each draw (whole block is allocated, unused entries stay zero)
+        glGenBuffers(1, &draw_data_buffer_);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, draw_data_buffer_);
+        std::unique_ptr<DrawDataBlock> block(new DrawDataBlock());
+        std::copy(drawData.begin(), drawData.end(), block->drawData);
+        for (size_t i = 0; i < drawDataIndices.size(); i++) block->drawDataIndex[i / 4][i % 4] = drawDataIndices[i];
+        glBufferData(GL_COPY_WRITE_BUFFER, sizeof(DrawDataBlock), block.get(), GL_STATIC_DRAW);
+        glUniformBlockBinding(program->getProgramId(), blockIndex, DRAW_DATA_BINDING);
+
+        glGenBuffers(1, &instance_buffer_);
+        glGenBuffers(1, &indirect_buffer_);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        // VAO with per-vertex attributes from the shared vertex buffer and instance attributes from the shared instance buffer
+        glGenVertexArrays(1, &vao_);
+        GLStateCache::current().bindVertexArray(vao_);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_);
+        viscom::SimpleMeshVertex::SetVertexAttributes(program);
+        RoomSegmentMesh::Instance::setAttribFormat();
+        RoomSegmentMesh::Instance::bindBuffer(instance_buffer_);
+        GLStateCache::current().bindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+        commands_.resize(draws_.size());
+        source_versions_.assign(sources_.size(), ~0ull); // repack before the first draw
+        return true;
+    }
+
+    void MultiDrawRenderer::update() {
+        if (hasGeneratedInstances()) return; // written by the generator
+        for (size_t s = 0; s < sources_.size(); s++) {
+            if (sources_[s]->getGPUVersion() != source_versions_[s]) {
+                repackInstances();
+                return;
+            }
+        }
+    }
+
+    void MultiDrawRenderer::repackInstances() {
+        std::vector<GLuint> baseInstances(sources_.size(), 0);
+        size_t total = 0;
+        max_source_instances_ = 0;
+        for (size_t s = 0; s < sources_.size(); s++) {
+            baseInstances[s] = static_cast<GLuint>(total);
+            const size_t n = static_cast<size_t>(sources_[s]->getNumInstances());
+            if (n > max_source_instances_) max_source_instances_ = n;
+            total += n;
+            source_versions_[s] = sources_[s]->getGPUVersion();
+        }
+        const size_t instanceBytes = sizeof(RoomSegmentMesh::Instance);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, instance_buffer_);
+        if (total > instance_capacity_) {
+            // same buffer name, so the VAO stays valid
+            instance_capacity_ = total > 2 * instance_capacity_ ? total : 2 * instance_capacity_;
+            glBufferData(GL_COPY_WRITE_BUFFER, instance_capacity_ * instanceBytes, nullptr, GL_DYNAMIC_COPY);
+        }
+        for (size_t s = 0; s < sources_.size(); s++) {
+            const int n = sources_[s]->getNumInstances();
+            if (n <= 0) continue;
+            glBindBuffer(GL_COPY_READ_BUFFER, sources_[s]->getInstanceBufferId());
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                sources_[s]->getBaseInstance() * instanceBytes, baseInstances[s] * instanceBytes, n * instanceBytes);
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        for (size_t i = 0; i < draws_.size(); i++) {
+            const Draw& draw = draws_[i];
+            DrawElementsIndirectCommand& cmd = commands_[i];
+            cmd.count = draw.count;
+            cmd.instanceCount = drawInstanceCount(draw, static_cast<GLuint>(sources_[draw.source]->getNumInstances()));
+            cmd.firstIndex = draw.firstIndex;
+            cmd.baseVertex = draw.baseVertex;
+            cmd.baseInstance = baseInstances[draw.source];
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer_);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, commands_.size() * sizeof(DrawElementsIndirectCommand), commands_.data(), GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    void MultiDrawRenderer::useGeneratedInstances(size_t capacityPerSource) {
+        generated_capacity_ = capacityPerSource;
+        instance_capacity_ = capacityPerSource * sources_.size();
+        glBindBuffer(GL_COPY_WRITE_BUFFER, instance_buffer_);
+        glBufferData(GL_COPY_WRITE_BUFFER, instance_capacity_ * sizeof(RoomSegmentMesh::Instance), nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        // commands are static apart from the instance count (no instances until the first generation)
+        for (size_t i = 0; i < draws_.size(); i++) {
+            const Draw& draw = draws_[i];
+            DrawElementsIndirectCommand& cmd = commands_[i];
+            cmd.count = draw.count;
+            cmd.instanceCount = 0;
+            cmd.firstIndex = draw.firstIndex;
+            cmd.baseVertex = draw.baseVertex;
+            cmd.baseInstance = static_cast<GLuint>(draw.source * capacityPerSource);
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer_);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, commands_.size() * sizeof(DrawElementsIndirectCommand), commands_.data(), GL_DYNAMIC_COPY);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    void MultiDrawRenderer::render() {
+        render(instance_buffer_, indirect_buffer_);
+    }
+
+    void MultiDrawRenderer::render(GLuint instanceBuffer, GLuint indirectBuffer) {
+        render(instanceBuffer, indirectBuffer, 0, draws_.size());
+    }
+
+    void MultiDrawRenderer::render(GLuint instanceBuffer, GLuint indirectBuffer, size_t firstDraw, size_t numDraws) {
+        if (!isReady() || numDraws == 0) return;
+        GLStateCache::current().bindVertexArray(vao_);
+        if (instanceBuffer != instance_buffer_) RoomSegmentMesh::Instance::bindBuffer(instanceBuffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glBindBufferBase(GL_UNIFORM_BUFFER, DRAW_DATA_BINDING, draw_data_buffer_);
+        const size_t commandOffset = firstDraw * sizeof(DrawElementsIndirectCommand);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, reinterpret_cast<const void*>(commandOffset), static_cast<GLsizei>(numDraws), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        if (instanceBuffer != instance_buffer_) RoomSegmentMesh::Instance::bindBuffer(instance_buffer_);
+        GLStateCache::current().bindVertexArray(0);
+    }
+
+    void MultiDrawRenderer::cleanup() {
+        if (vao_ != 0) GLStateCache::current().deleteVertexArray(vao_);
+        GLuint buffers[] = { vbo_, ibo_, instance_buffer_, indirect_buffer_, draw_data_buffer_ };
+        for (GLuint b : buffers) {
+            if (b != 0) glDeleteBuffers(1, &b);
+        }
+        vao_ = vbo_ = ibo_ = instance_buffer_ = indirect_buffer_ = draw_data_buffer_ = 0;
+        instance_capacity_ = 0;
+        generated_capacity_ = 0;
+        max_source_instances_ = 0;
+        sources_.clear();
+        source_versions_.clear();
+        draws_.clear();
+        commands_.clear();
+        lod_levels_ = 0;
+    }
+}
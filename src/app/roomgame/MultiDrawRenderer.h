@@ -0,0 +1,114 @@
+#pragma once
+
+#include <vector>
+#include "RoomSegmentMesh.h"
+
+namespace roomgame
+{
+    /* Draws all meshes of a mesh pool with a single glMultiDrawElementsIndirect.
+     * All meshes share one vertex buffer, one index buffer and one instance buffer (own VAO):
+     * Vertices and indices are copied once at init, each draw command addresses its submesh by first index and base vertex.
+     * Live instances of all meshes (unordered and room-ordered) are packed into the shared instance buffer by GPU copies...
+     * ... and the command buffer is rebuilt only when a mesh wrote its instance buffer (per-mesh base instances).
+     * Submesh transforms and materials are read by the shader from a uniform block:
+     * One entry per submesh (shared by its levels of detail and the room-ordered mesh), gl_DrawIDARB looks up the entry of a draw.
+     * Everything else (lights, grid textures) is set once for the whole pool.
+     * Each submesh has a draw per level of detail (supplied by the mesh or simplified when it is added to the pool, see buildLODChain):
+     * The renderer's own commands only draw level 0, an InstanceCuller sorts instances into the levels by projected cell size.
+     * Requires multi draw indirect, shader draw parameters, base instance and vertex attrib binding (see isSupported).
+    */
+    class MultiDrawRenderer {
+    public:
+        static const size_t MAX_DRAWS = 1024; // must match MAX_DRAWS in renderMeshInstance.vert/.frag (multiple of 4)
+        static const size_t MAX_DRAW_DATA = 96; // must match MAX_DRAW_DATA in renderMeshInstance.vert/.frag
+        static const size_t LOD_LEVELS = 3; // levels of detail per submesh
+        static const GLuint DRAW_DATA_BINDING = 0; // uniform buffer binding point of DrawDataBlock
+
+        MultiDrawRenderer();
+        ~MultiDrawRenderer();
+
+        static bool isSupported();
+        // Simplify the levels of detail the mesh does not supply (when the mesh is added to the pool, nothing if unsupported)
+        static void buildLODChain(RoomSegmentMesh* mesh);
+        // Build shared buffers and draw data for the given meshes (false if unsupported, too many draws are reported as an error)
+        bool init(const std::vector<RoomSegmentMesh*>& meshes, viscom::GPUProgram* program);
+        // Repack instances and rebuild draw commands if any mesh changed its GPU instance buffer
+        void update();
+        // Issue the draw call (program and pass uniforms must be set, isMultiDraw must be 1)
+        void render();
+        void cleanup();
+        bool isReady() const { return vao_ != 0; }
+
+        /* Instances written on the GPU (GPUInstanceGenerator) instead of packed from the meshes:
+         * Each source owns a fixed region of capacityPerSource instances (base instance source * capacity)...
+         * ... and the generator writes instances and instance counts, update no longer repacks.
+        */
+        void useGeneratedInstances(size_t capacityPerSource);
+        bool hasGeneratedInstances() const { return generated_capacity_ != 0; }
+        size_t getNumSources() const { return sources_.size(); }
+        RoomSegmentMesh* getSource(size_t s) const { return sources_[s]; }
+        size_t getNumDraws() const { return draws_.size(); }
+        size_t getDrawSource(size_t i) const { return draws_[i].source; }
+        size_t getDrawLOD(size_t i) const { return draws_[i].lod; }
+        size_t getNumLODLevels() const { return lod_levels_; }
+        GLuint getInstanceBuffer() const { return instance_buffer_; }
+        GLuint getIndirectBuffer() const { return indirect_buffer_; }
+        size_t getCommandBytes() const { return commands_.size() * sizeof(DrawElementsIndirectCommand); }
+        size_t getInstanceCapacity() const { return instance_capacity_; }
+        // Upper bound of the instances of any source (packed: largest source at the last repack)
+        size_t getMaxSourceInstances() const { return hasGeneratedInstances() ? generated_capacity_ : max_source_instances_; }
+        // Draw with other instances and commands of the same layout (e.g. culled copies, see InstanceCuller)
+        void render(GLuint instanceBuffer, GLuint indirectBuffer);
+        // Draw only numDraws draws from firstDraw (firstDraw in the shader must be set to it, see renderMeshInstance.vert)
+        void render(GLuint instanceBuffer, GLuint indirectBuffer, size_t firstDraw, size_t numDraws);
+
+    private:
+        struct DrawElementsIndirectCommand {
+            GLuint count;
+            GLuint instanceCount;
+            GLuint firstIndex;
+            GLint baseVertex;
+            GLuint baseInstance;
+        };
+        // std140 layout of DrawData in the shader
+        struct DrawData {
+            glm::mat4 subMeshLocalMatrix;
+            glm::vec4 ambientAlpha;
+            glm::vec4 diffuse;
+            glm::vec4 specularExponent; // specular color and exponent
+        };
+        // std140 layout of DrawDataBlock in the shader
+        struct DrawDataBlock {
+            DrawData drawData[MAX_DRAW_DATA];
+            glm::uvec4 drawDataIndex[MAX_DRAWS / 4]; // entry in drawData of each draw (four per vector)
+        };
+        static_assert(MAX_DRAWS % 4 == 0, "Draw data indices are packed by four");
+        static_assert(sizeof(DrawDataBlock) <= 16384, "DrawDataBlock exceeds the minimum GL_MAX_UNIFORM_BLOCK_SIZE");
+        // One draw command per submesh and level of detail of each instance source (sorted by source, then level)
+        struct Draw {
+            size_t source;
+            size_t lod;
+            GLuint count;
+            GLuint firstIndex;
+            GLint baseVertex;
+        };
+        std::vector<RoomSegmentMesh*> sources_; // meshes and their room-ordered meshes
+        std::vector<unsigned long long> source_versions_; // GPU version of each source at the last repack
+        std::vector<Draw> draws_;
+        std::vector<DrawElementsIndirectCommand> commands_;
+        size_t lod_levels_;
+        GLuint vao_;
+        GLuint vbo_;
+        GLuint ibo_;
+        GLuint instance_buffer_;
+        size_t instance_capacity_; // in instances
+        size_t generated_capacity_; // instances per source if generated on the GPU (0 if packed)
+        size_t max_source_instances_;
+        GLuint indirect_buffer_;
+        GLuint draw_data_buffer_;
+
+        void repackInstances();
+        // Level 0 draws all instances of its source, coarser levels nothing (filled by culling)
+        GLuint drawInstanceCount(const Draw& draw, GLuint sourceInstances) const { return draw.lod == 0 ? sourceInstances : 0; }
+    };
+}
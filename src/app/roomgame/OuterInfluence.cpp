@@ -11,6 +11,9 @@ namespace roomgame {
     const float ROT_SPEED_MULTIPLIER = 50.0f;
     const int DEFAULT_MIN_PATROL_TIME = 2;
     const int DEFAULT_MAX_PATROL_TIME = 11;
+    const double KEYFRAME_INTERVAL = 1.0; // seconds between drift-correcting keyframes
+    const double MAX_CATCH_UP_TIME = 1.0; // slaves integrate at most this far to catch up with a late state
+    const double MAX_STEP = 0.25; // same step limit as the master's update loop
 
 	OuterInfluence::OuterInfluence(std::shared_ptr<SourceLightManager> sourceLightManager): MeshComponent(nullptr), distance_(0), targetCell_(nullptr), deltaTime_(0)
     {
@@ -40,8 +43,8 @@ namespace roomgame {
 	void OuterInfluence::CalcPositions(bool init = false) {
 		for (auto i = 0; i < 5; i++) {
 		    const auto tmpI = i + 0.1f;
-		    const auto transPat = glm::translate(glm::vec3(sinf(tmpI*static_cast<float>(glfwGetTime())), cosf(tmpI*static_cast<float>(glfwGetTime()))*0.5f, cosf(tmpI*static_cast<float>(glfwGetTime()))*0.5f));
-		    const auto transAtt = glm::translate(glm::vec3(cosf(tmpI*static_cast<float>(glfwGetTime()))*0.05f, sinf(tmpI*static_cast<float>(glfwGetTime()))*0.1, cosf(tmpI*static_cast<float>(glfwGetTime()))*0.05f));
+		    const auto transPat = glm::translate(glm::vec3(sinf(tmpI*static_cast<float>(syncedTime_)), cosf(tmpI*static_cast<float>(syncedTime_))*0.5f, cosf(tmpI*static_cast<float>(syncedTime_))*0.5f));
+		    const auto transAtt = glm::translate(glm::vec3(cosf(tmpI*static_cast<float>(syncedTime_))*0.05f, sinf(tmpI*static_cast<float>(syncedTime_))*0.1, cosf(tmpI*static_cast<float>(syncedTime_))*0.05f));
 		    const auto translation = glm::mix(transPat, transAtt, movementType_);
             if (i<MeshComponent->influencePositions_.size()) {
                 MeshComponent->influencePositions_[i] = MeshComponent->model_matrix_*translation;
@@ -63,11 +66,16 @@ namespace roomgame {
         }
 	}
 
-	void OuterInfluence::Update(double deltaTime)
+	void OuterInfluence::Integrate(double deltaTime)
 	{
 		this->deltaTime_ = deltaTime;
 		Move();
 		CalcPositions();
+	}
+
+	void OuterInfluence::Update(double deltaTime)
+	{
+		Integrate(deltaTime);
         if (mode_ == ATTACK) {
             Attack();
         }
@@ -76,6 +84,11 @@ namespace roomgame {
         }
 	}
 
+	void OuterInfluence::UpdateLocal(double deltaTime)
+	{
+		Integrate(deltaTime);
+	}
+
 	//Change Position
 	void OuterInfluence::Move() const
 	{
@@ -134,6 +147,7 @@ namespace roomgame {
     void OuterInfluence::setBaseSpeed(float speed)
     {
         baseSpeed_ = glm::clamp(speed, 0.2f, 1.0f);
+        transitionPending_ = true;
     }
 
     void OuterInfluence::resetValues()
@@ -141,6 +155,125 @@ namespace roomgame {
         minPatrolTime_ = DEFAULT_MIN_PATROL_TIME;
         maxPatrolTime_ = DEFAULT_MAX_PATROL_TIME;
         baseSpeed_ = DEFAULT_BASE_SPEED;
+        transitionPending_ = true;
+    }
+
+    OuterInfluence::MotionState OuterInfluence::captureState() const
+    {
+        MotionState state;
+        state.nr = stateNr_;
+        state.time = syncedTime_;
+        state.modelMatrix = quantizeTransform(MeshComponent->model_matrix_);
+        state.oldPosition = oldPosition_;
+        state.targetPosition = targetPosition_;
+        state.posDiff = posDiff_;
+        state.movementType = movementType_;
+        state.speed = speed_;
+        state.baseSpeed = baseSpeed_;
+        state.distance = distance_;
+        state.mode = mode_;
+        state.targetCol = targetCell_ ? static_cast<int32_t>(targetCell_->getCol()) : -1;
+        state.targetRow = targetCell_ ? static_cast<int32_t>(targetCell_->getRow()) : -1;
+        return state;
+    }
+
+    void OuterInfluence::applyState(const MotionState& state)
+    {
+        stateNr_ = state.nr;
+        MeshComponent->model_matrix_ = dequantizeTransform(state.modelMatrix);
+        oldPosition_ = state.oldPosition;
+        targetPosition_ = state.targetPosition;
+        posDiff_ = state.posDiff;
+        movementType_ = state.movementType;
+        speed_ = state.speed;
+        baseSpeed_ = state.baseSpeed;
+        distance_ = state.distance;
+        mode_ = state.mode;
+        targetCell_ = (Grid && state.targetCol >= 0 && state.targetRow >= 0) ? Grid->getCellAt(state.targetCol, state.targetRow) : nullptr;
+    }
+
+    /* Master captures a new state only after a transition or if the last keyframe is too old
+     * (the sync registry sends it if the state number changed)
+    */
+    void OuterInfluence::preSync()
+    {
+        const bool keyframeDue = syncedTime_ - lastKeyframeTime_ >= KEYFRAME_INTERVAL;
+        if (!transitionPending_ && !keyframeDue) return;
+        stateNr_++;
+        sharedState_.setVal(captureState());
+        transitionPending_ = false;
+        lastKeyframeTime_ = syncedTime_;
+    }
+
+    void OuterInfluence::encode(SyncStream& out)
+    {
+        out.writeObj(&sharedState_);
+    }
+
+    void OuterInfluence::decode(SyncStream& in)
+    {
+        in.readObj(&sharedState_);
+    }
+
+    /* Slaves jump to a newly received state and integrate the time that passed since it was captured */
+    void OuterInfluence::updateSyncedSlave()
+    {
+        const auto state = sharedState_.getVal();
+        if (state.nr == stateNr_) return;
+        applyState(state);
+        auto catchUp = glm::clamp(syncedTime_ - state.time, 0.0, MAX_CATCH_UP_TIME);
+        while (catchUp > 0.0) {
+            const auto step = min(catchUp, MAX_STEP);
+            Integrate(step);
+            catchUp -= step;
+        }
+    }
+
+    bool OuterInfluence::matchesLive(const OuterInfluence& master) const
+    {
+        return stateNr_ == master.stateNr_ && mode_ == master.mode_ && targetCell_ == master.targetCell_;
+    }
+
+    void OuterInfluence::encodeSnapshot(SyncStream& out)
+    {
+        out.writeValue<uint32_t>(stateNr_);
+        out.writeValue<int32_t>(mode_);
+        out.writeValue<float>(movementType_);
+        out.writeValue<float>(speed_);
+        out.writeValue<float>(baseSpeed_);
+        out.writeValue<float>(distance_);
+        out.writeValue<int32_t>(currentPatrolTime_);
+        out.writeValue<int32_t>(patrolTime_);
+        out.writeValue<int32_t>(minPatrolTime_);
+        out.writeValue<int32_t>(maxPatrolTime_);
+        out.writeValue<glm::vec3>(oldPosition_);
+        out.writeValue<glm::vec3>(targetPosition_);
+        out.writeValue<glm::vec3>(posDiff_);
+        out.writeValue<int32_t>(targetCell_ ? static_cast<int32_t>(targetCell_->getCol()) : -1);
+        out.writeValue<int32_t>(targetCell_ ? static_cast<int32_t>(targetCell_->getRow()) : -1);
+        MeshComponent->encodeSnapshot(out);
+    }
+
+    void OuterInfluence::loadSnapshot(SyncStream& in)
+    {
+        stateNr_ = in.readValue<uint32_t>();
+        mode_ = in.readValue<int32_t>();
+        movementType_ = in.readValue<float>();
+        speed_ = in.readValue<float>();
+        baseSpeed_ = in.readValue<float>();
+        distance_ = in.readValue<float>();
+        currentPatrolTime_ = in.readValue<int32_t>();
+        patrolTime_ = in.readValue<int32_t>();
+        minPatrolTime_ = in.readValue<int32_t>();
+        maxPatrolTime_ = in.readValue<int32_t>();
+        distributor100_ = std::uniform_int_distribution<int>(minPatrolTime_, maxPatrolTime_);
+        oldPosition_ = in.readValue<glm::vec3>();
+        targetPosition_ = in.readValue<glm::vec3>();
+        posDiff_ = in.readValue<glm::vec3>();
+        const auto targetCol = in.readValue<int32_t>();
+        const auto targetRow = in.readValue<int32_t>();
+        targetCell_ = (Grid && targetCol >= 0 && targetRow >= 0) ? Grid->getCellAt(targetCol, targetRow) : nullptr;
+        MeshComponent->loadSnapshot(in);
     }
 
 	void OuterInfluence::CheckForPatrolEnd() {
@@ -160,6 +293,7 @@ namespace roomgame {
         mode_ = PATROL;
         const auto randNumber = distributor100_(rndGenerator_);
         patrolTime_ = randNumber;
+        transitionPending_ = true;
     }
 
     void OuterInfluence::ChooseTarget() {
@@ -171,6 +305,8 @@ namespace roomgame {
         auto tmp = Grid->getCellAt(glm::vec2(ndcCoords.x, ndcCoords.y));
         if (tmp == nullptr) {
             std::cout << "nullptr when choosing cell where Outer Influence is positioned" << std::endl;
+            // no target: Attack() must not run on a stale targetCell_
+            EngageInNewRandomPatrol();
             return;
         }
         auto cellDistance = 9999.0f;
@@ -202,6 +338,7 @@ namespace roomgame {
             posDiff_ = targetPosition_ - glm::vec3(MeshComponent->model_matrix_[3][0], MeshComponent->model_matrix_[3][1], 0.0f);
             distance_ = glm::length(posDiff_);
             targetCell_ = closestWallCell;
+            transitionPending_ = true;
         }
         else {
             EngageInNewRandomPatrol();
@@ -219,9 +356,10 @@ namespace roomgame {
             posDiff_ = targetPosition_ - currentPos;
             distance_ = glm::length(posDiff_);
             mode_ = RETREAT;
+            transitionPending_ = true;
             auto bs = targetCell_->getBuildState();
             if (bs == GridCell::EMPTY || bs & GridCell::INSIDE_ROOM) return;
-            targetCell_->updateHealthPoints(Grid->vbo_, GridCell::MIN_HEALTH);
+            targetCell_->updateHealthPoints(GridCell::MIN_HEALTH);
             Grid->roomInteractionManager_->meshInstanceBuilder_->buildAt(targetCell_->getCol(), targetCell_->getRow(), GridCell::SOURCE, MeshInstanceBuilder::BuildMode::Additive);
             Grid->roomInteractionManager_->meshInstanceBuilder_->buildAt(targetCell_->getCol(), targetCell_->getRow(), GridCell::WALL, MeshInstanceBuilder::BuildMode::RemoveSpecific);
             const auto wPos = Grid->getWorldCoordinates(targetCell_->getPosition());
@@ -1,5 +1,6 @@
 #pragma once
 #include "app/roomgame/IUpdateable.h"
+#include "app/roomgame/SyncQuantization.h"
 #include <random>
 
 namespace roomgame {
@@ -27,10 +28,56 @@ namespace roomgame {
 
         void resetValues();
 
+        /* Cluster sync: only state machine transitions and low-rate keyframes are sent
+         * Between them, slaves integrate the motion locally with the synced time (UpdateLocal)
+         * Attacks (building sources, damaging cells) are executed by the master only
+        */
+        void preSync(); // master
+        uint32_t getStateNr() const { return stateNr_; } // changes with each new state (sync generation)
+        void encode(SyncStream& out); // master
+        void decode(SyncStream& in); // slave
+        void updateSyncedSlave();
+        // Loopback slave: applied the master's last sent state (state machine and target, see SyncRegistry::Replica)
+        bool matchesLive(const OuterInfluence& master) const;
+        // Slave: integrate motion without triggering state transitions
+        void UpdateLocal(double deltaTime);
+        // Synced time of the current frame (drives the wobbling of the influence parts)
+        void setSyncedTime(double time) { syncedTime_ = time; }
+
+        // Late-join snapshot: state machine and movement parameters
+        void encodeSnapshot(SyncStream& out); // master
+        void loadSnapshot(SyncStream& in); // slave
+
         glm::mat4 ViewPersMat;
 		SynchronizedGameMesh* MeshComponent;
 		std::shared_ptr<InteractiveGrid> Grid;
 	private:
+        /* Complete motion state at a point in synced time
+         * Sent on each state machine transition and as keyframe (drift correction)
+        */
+        struct MotionState {
+            uint32_t nr; // increases with each sent state
+            double time; // synced time at which the state was captured
+            QuantizedTransform modelMatrix; // 14 instead of 64 bytes
+            glm::vec3 oldPosition;
+            glm::vec3 targetPosition;
+            glm::vec3 posDiff;
+            float movementType;
+            float speed;
+            float baseSpeed;
+            float distance;
+            int32_t mode;
+            int32_t targetCol; // -1 if there is no target
+            int32_t targetRow;
+        };
+        MotionState captureState() const;
+        void applyState(const MotionState& state);
+        sgct::SharedObject<MotionState> sharedState_;
+        uint32_t stateNr_ = 0; // last sent (master) or applied (slave) state
+        bool transitionPending_ = true; // master: state machine changed since the last sync (first sync sends initial state)
+        double lastKeyframeTime_ = 0;
+        double syncedTime_ = 0;
+
         std::shared_ptr<SourceLightManager> sourceLightManager_;
         float movementType_ = 0; // 0 is patrolling movement, 1 is attacking movement
         float changeSpeed_ = 1.f; // How fast the influence changes its movement pattern
@@ -51,6 +98,7 @@ namespace roomgame {
 		glm::vec3 oldPosition_;
 		glm::vec3 targetPosition_;
 		glm::vec3 posDiff_;
+		void Integrate(double deltaTime);
 		void CalcPositions(bool init);
 		void CheckForPatrolEnd();
 	    void EngageInNewRandomPatrol();
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "core/open_gl.h"
+
+namespace roomgame
+{
+    /* GPU buffer split into a ring of equally sized regions, persistently and coherently mapped (glBufferStorage).
+     * Each write goes to the next region of the ring, so the CPU never writes into a region the GPU may still read:
+     * Switching regions fences the region written before (all draw calls reading it are issued by then)...
+     * ... and waits for the fence of the region written next (three frames back, so usually no wait at all).
+     * Draw calls select the current region with a base instance (regionIndex * region capacity in elements).
+     * No driver copies and no implicit synchronization as with glBufferSubData on buffers in use.
+    */
+    class PersistentRingBuffer {
+    public:
+        static const int NUM_REGIONS = 3;
+
+        PersistentRingBuffer() :
+            id_(0), ptr_(nullptr), region_bytes_(0), region_(0), fences_{ 0, 0, 0 }
+        {}
+        PersistentRingBuffer(const PersistentRingBuffer&) = delete;
+        PersistentRingBuffer& operator=(const PersistentRingBuffer&) = delete;
+        ~PersistentRingBuffer() {
+            free();
+        }
+
+        // Persistent mapping and drawing from a region (base instance) need GL 4.4 resp. 4.2 features
+        static bool isSupported() {
+            return GLEW_ARB_buffer_storage && GLEW_ARB_base_instance;
+        }
+
+        /* (Re)create the ring with the given region size (previous content is discarded) */
+        bool alloc(size_t regionBytes) {
+            free();
+            return allocStorage(regionBytes);
+        }
+
+        /* Change the region size, the content of the latest region is copied on the GPU into the first region of the new ring
+         * The old buffer is deleted without waiting for its fences (GL keeps it alive until pending commands have read it).
+         * Keeps the old ring if the new one cannot be created.
+        */
+        bool resize(size_t regionBytes) {
+            if (id_ == 0) return alloc(regionBytes);
+            const GLuint oldId = id_;
+            unsigned char* oldPtr = ptr_;
+            const size_t oldRegionBytes = region_bytes_;
+            const int oldRegion = region_;
+            const GLintptr oldOffset = regionOffset();
+            GLsync oldFences[NUM_REGIONS];
+            for (int i = 0; i < NUM_REGIONS; i++) {
+                oldFences[i] = fences_[i];
+                fences_[i] = 0;
+            }
+            if (!allocStorage(regionBytes)) {
+                id_ = oldId;
+                ptr_ = oldPtr;
+                region_bytes_ = oldRegionBytes;
+                region_ = oldRegion;
+                for (int i = 0; i < NUM_REGIONS; i++) fences_[i] = oldFences[i];
+                return false;
+            }
+            glBindBuffer(GL_COPY_READ_BUFFER, oldId);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, id_);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, oldOffset, 0,
+                static_cast<GLsizeiptr>(oldRegionBytes < regionBytes ? oldRegionBytes : regionBytes));
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            glDeleteBuffers(1, &oldId);
+            for (int i = 0; i < NUM_REGIONS; i++) {
+                if (oldFences[i]) glDeleteSync(oldFences[i]);
+            }
+            return true;
+        }
+
+        void free() {
+            for (int i = 0; i < NUM_REGIONS; i++) waitForRegion(i);
+            if (id_ != 0) {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, id_);
+                glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+                glDeleteBuffers(1, &id_);
+            }
+            id_ = 0;
+            ptr_ = nullptr;
+            region_bytes_ = 0;
+        }
+
+        /* Advance to the next region and return its mapped memory (CPU writes) or use regionOffset (GPU copies) */
+        unsigned char* beginWrite() {
+            if (fences_[region_]) glDeleteSync(fences_[region_]);
+            fences_[region_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            region_ = (region_ + 1) % NUM_REGIONS;
+            waitForRegion(region_);
+            return ptr_ + regionOffset();
+        }
+
+        bool isAllocated() const { return id_ != 0; }
+        GLuint id() const { return id_; }
+        size_t regionBytes() const { return region_bytes_; }
+        int region() const { return region_; }
+        GLintptr regionOffset() const { return static_cast<GLintptr>(region_ * region_bytes_); }
+
+    private:
+        // Create and map the buffer (no buffer allocated before)
+        bool allocStorage(size_t regionBytes) {
+            if (!isSupported()) return false;
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            const GLsizeiptr bytes = static_cast<GLsizeiptr>(regionBytes * NUM_REGIONS);
+            glGenBuffers(1, &id_);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, id_);
+            glBufferStorage(GL_COPY_WRITE_BUFFER, bytes, nullptr, flags);
+            ptr_ = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, bytes, flags));
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            if (!ptr_) {
+                glDeleteBuffers(1, &id_);
+                id_ = 0;
+                return false;
+            }
+            region_bytes_ = regionBytes;
+            region_ = 0;
+            return true;
+        }
+
+        GLuint id_;
+        unsigned char* ptr_; // mapped pointer to the first region
+        size_t region_bytes_;
+        int region_; // region holding the latest data
+        GLsync fences_[NUM_REGIONS]; // GPU reads pending on each region
+
+        void waitForRegion(int region) {
+            if (!fences_[region]) return;
+            glClientWaitSync(fences_[region], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+            glDeleteSync(fences_[region]);
+            fences_[region] = 0;
+        }
+    };
+}
@@ -0,0 +1,61 @@
+#include "ProgramReflection.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace roomgame
+{
+    void ProgramReflection::reflect(GLuint program) {
+        program_ = program;
+        entries_.clear();
+        if (program == 0) return;
+        GLint numUniforms = 0, maxNameLength = 0;
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numUniforms);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+        std::vector<GLchar> nameBuffer(static_cast<size_t>(maxNameLength) + 1);
+        for (GLint i = 0; i < numUniforms; i++) {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(program, static_cast<GLuint>(i), static_cast<GLsizei>(nameBuffer.size()), &length, &size, &type, nameBuffer.data());
+            std::string name(nameBuffer.data(), static_cast<size_t>(length));
+            GLint location = glGetUniformLocation(program, name.c_str());
+            if (location == -1) continue; // member of a uniform block
+            // arrays are reported once as "name[0]", list every element
+            const std::string arraySuffix = "[0]";
+            if (name.size() > arraySuffix.size() && name.compare(name.size() - arraySuffix.size(), arraySuffix.size(), arraySuffix) == 0) {
+                std::string base = name.substr(0, name.size() - arraySuffix.size());
+                entries_.push_back({ base, location, type });
+                for (GLint e = 0; e < size; e++) {
+                    std::string element = base + "[" + std::to_string(e) + "]";
+                    entries_.push_back({ element, glGetUniformLocation(program, element.c_str()), type });
+                }
+            }
+            else entries_.push_back({ name, location, type });
+        }
+        std::sort(entries_.begin(), entries_.end(), [](const Entry& a, const Entry& b) { return a.name < b.name; });
+    }
+
+    const ProgramReflection::Entry* ProgramReflection::find(const std::string& name) const {
+        auto it = std::lower_bound(entries_.begin(), entries_.end(), name, [](const Entry& e, const std::string& n) { return e.name < n; });
+        if (it == entries_.end() || it->name != name) return nullptr;
+        return &(*it);
+    }
+
+    bool ProgramReflection::isSampler(GLenum type) {
+        switch (type) {
+        case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+        case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_2D_ARRAY_SHADOW:
+        case GL_SAMPLER_BUFFER: case GL_SAMPLER_2D_RECT:
+        case GL_INT_SAMPLER_2D: case GL_INT_SAMPLER_3D: case GL_INT_SAMPLER_BUFFER:
+        case GL_UNSIGNED_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_3D: case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+        case GL_IMAGE_2D: case GL_INT_IMAGE_2D: case GL_UNSIGNED_INT_IMAGE_2D:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    void ProgramReflection::reportTypeMismatch(const std::string& name, GLenum type) const {
+        printf("Uniform %s of program %u has GL type 0x%x, which does not match the requested handle type\n", name.c_str(), program_, type);
+    }
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cassert>
+#include <glm/glm.hpp>
+#include "core/open_gl.h"
+
+namespace roomgame
+{
+    /* Upload of one uniform value (the overload picks the glUniform call of the type) */
+    namespace uniform_upload {
+        inline void set(GLint location, GLint value) { glUniform1i(location, value); }
+        inline void set(GLint location, GLuint value) { glUniform1ui(location, value); }
+        inline void set(GLint location, float value) { glUniform1f(location, value); }
+        inline void set(GLint location, const glm::vec2& value) { glUniform2f(location, value.x, value.y); }
+        inline void set(GLint location, const glm::vec3& value) { glUniform3f(location, value.x, value.y, value.z); }
+        inline void set(GLint location, const glm::vec4& value) { glUniform4f(location, value.x, value.y, value.z, value.w); }
+        inline void set(GLint location, const glm::ivec4& value) { glUniform4i(location, value.x, value.y, value.z, value.w); }
+        inline void set(GLint location, const glm::mat3& value) { glUniformMatrix3fv(location, 1, GL_FALSE, &value[0][0]); }
+        inline void set(GLint location, const glm::mat4& value) { glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]); }
+    }
+
+    /* Handle of a uniform of one program, resolved once by its ProgramReflection.
+     * T is the C++ type of the value (GLint also for bool and sampler uniforms).
+     * Handles of uniforms the program does not have are invalid, setting them does nothing (like location -1 in GL).
+     * Debug builds check that the program of the handle is in use when it is set.
+    */
+    template <typename T>
+    class Uniform {
+    public:
+        Uniform() : location_(-1), program_(0) {}
+        Uniform(GLint location, GLuint program) : location_(location), program_(program) {}
+
+        bool isValid() const { return location_ != -1; }
+        GLint getLocation() const { return location_; }
+        GLuint getProgram() const { return program_; }
+
+        void set(const T& value) const {
+            checkBound();
+            if (location_ != -1) uniform_upload::set(location_, value);
+        }
+
+    private:
+        void checkBound() const {
+#ifdef _DEBUG
+            if (location_ == -1) return;
+            GLint current = 0;
+            glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+            assert(static_cast<GLuint>(current) == program_ && "uniform handle set while another program is in use");
+#endif
+        }
+
+        GLint location_;
+        GLuint program_;
+    };
+
+    /* Flat table of the active uniforms of a linked program.
+     * Built once (when the owner receives the program), all names are resolved against it instead of the driver.
+     * Arrays are listed per element ("name[i]", "name" is element 0), struct members by their full name ("light.ambient").
+     * uniform<T>(name) returns a typed handle, names of a wrong type give an invalid handle and a message.
+    */
+    class ProgramReflection {
+    public:
+        struct Entry {
+            std::string name;
+            GLint location;
+            GLenum type;
+        };
+
+        ProgramReflection() : program_(0) {}
+        explicit ProgramReflection(GLuint program) : program_(0) { reflect(program); }
+
+        // Enumerate the active uniforms of the program (replaces the previous table)
+        void reflect(GLuint program);
+        GLuint getProgram() const { return program_; }
+        const std::vector<Entry>& getEntries() const { return entries_; }
+
+        // Entry of an active uniform (nullptr if the program does not have it)
+        const Entry* find(const std::string& name) const;
+        GLint getLocation(const std::string& name) const {
+            const Entry* entry = find(name);
+            return entry ? entry->location : -1;
+        }
+
+        template <typename T>
+        Uniform<T> uniform(const std::string& name) const {
+            const Entry* entry = find(name);
+            if (entry == nullptr) return Uniform<T>();
+            if (!matches(entry->type, static_cast<const T*>(nullptr))) {
+                reportTypeMismatch(name, entry->type);
+                return Uniform<T>();
+            }
+            return Uniform<T>(entry->location, program_);
+        }
+
+    private:
+        static bool isSampler(GLenum type);
+        static bool matches(GLenum type, const GLint*) { return type == GL_INT || type == GL_BOOL || isSampler(type); }
+        static bool matches(GLenum type, const GLuint*) { return type == GL_UNSIGNED_INT; }
+        static bool matches(GLenum type, const float*) { return type == GL_FLOAT; }
+        static bool matches(GLenum type, const glm::vec2*) { return type == GL_FLOAT_VEC2; }
+        static bool matches(GLenum type, const glm::vec3*) { return type == GL_FLOAT_VEC3; }
+        static bool matches(GLenum type, const glm::vec4*) { return type == GL_FLOAT_VEC4; }
+        static bool matches(GLenum type, const glm::ivec4*) { return type == GL_INT_VEC4; }
+        static bool matches(GLenum type, const glm::mat3*) { return type == GL_FLOAT_MAT3; }
+        static bool matches(GLenum type, const glm::mat4*) { return type == GL_FLOAT_MAT4; }
+        void reportTypeMismatch(const std::string& name, GLenum type) const;
+
+        GLuint program_;
+        std::vector<Entry> entries_; // sorted by name
+    };
+}
@@ -67,14 +67,11 @@ namespace roomgame
 
     void Room::finish() {
         isFinished_ = true;
-        //TODO Move mesh instances from unordered to room-ordered buffers (for each mesh that is part of the room)
-        // 1) Get instance buffer range for each cell of this room
-        // 2) Copy instance to ordered buffer
-        // 3) Remove instance from unordered buffer
-        // 4) Update cell's mesh instance buffer range
-        // 5) Get the whole ordered buffer range and push into mesh_instances_ vector
-        // 6) Prevent growing/shrinking/spanning of finished rooms
-        // 7) Clearing a finished room should update build state for each cell but remove only 1 buffer range in the ordered buffer! How to do this?
+        // Move mesh instances from unordered to room-ordered buffers (into the contiguous range of this room)
+        // Cells that change later on are removed from the room's range and re-added to the unordered buffers
+        grid_->forEachCellInRange(leftLowerCorner_, rightUpperCorner_, [&](GridCell* cell) {
+            cell->moveMeshInstancesToRoomOrderedBuffers(this);
+        });
     }
 
 
@@ -45,7 +45,7 @@ namespace roomgame
         GLuint updatedHealth = min(currentHealth + static_cast<GLuint>((GridCell::MAX_HEALTH - GridCell::MIN_HEALTH) * healAmount_), GridCell::MAX_HEALTH);
 
         if (touchedCell->getBuildState() & GridCell::SOURCE) {
-            touchedCell->updateHealthPoints(interactiveGrid_->vbo_, updatedHealth);
+            touchedCell->updateHealthPoints(updatedHealth);
             automatonUpdater_->updateAutomatonAt(touchedCell, touchedCell->getBuildState(), touchedCell->getHealthPoints());
             if (currentHealth >= GridCell::MAX_HEALTH) {
                 meshInstanceBuilder_->buildAt(touchedCell->getCol(), touchedCell->getRow(), GridCell::WALL, MeshInstanceBuilder::BuildMode::Additive);
@@ -70,7 +70,7 @@ namespace roomgame
                     currentHealth + static_cast<GLuint>((GridCell::MAX_HEALTH - GridCell::MIN_HEALTH) * dampedHeal),
                     GridCell::MAX_HEALTH);
                 // update HP on master CPU-side grid
-                c->updateHealthPoints(interactiveGrid_->vbo_, updatedHealth);
+                c->updateHealthPoints(updatedHealth);
                 // update HP and Build State on master CPU-side grid, automaton (GPU-side) grid and in mesh instance shader
                 meshInstanceBuilder_->buildAt(c->getCol(), c->getRow(), GridCell::REPAIRING, MeshInstanceBuilder::BuildMode::Additive);
                 if (updatedHealth >= GridCell::MAX_HEALTH)
@@ -224,7 +224,7 @@ namespace roomgame
     }
 
     void RoomInteractionManager::updateHealthPoints(GridCell* cell, unsigned int hp) {
-        cell->updateHealthPoints(interactiveGrid_->vbo_, hp);
+        cell->updateHealthPoints(hp);
     }
 
 
@@ -1,133 +1,161 @@
 #include "RoomSegmentMesh.h"
+#include "GridCell.h"
 
-RoomSegmentMesh::RoomSegmentMesh(viscom::Mesh* mesh, viscom::GPUProgram* program, size_t pool_allocation_bytes) :
-    SynchronizedInstancedMesh(mesh, program, pool_allocation_bytes),
-	//room_ordered_buffer_(pool_allocation_bytes),
-	next_free_offset_(0), last_free_offset_(0)
+RoomSegmentMesh::RoomSegmentMesh(viscom::Mesh* mesh, viscom::GPUProgram* program, size_t pool_allocation_bytes, bool room_ordered) :
+    SynchronizedInstancedMesh(mesh, program, pool_allocation_bytes)
 {
-	// Connect instance buffers
-	glBindVertexArray(vao_);
-	//glBindBuffer(GL_ARRAY_BUFFER, room_ordered_buffer_.id_);
-	//Instance::setAttribPointer();
-	glBindBuffer(GL_ARRAY_BUFFER, gpu_instance_buffer_.id_);
-	Instance::setAttribPointer();
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	// instance buffer is connected by the base class
+	if (!room_ordered) room_ordered_mesh_.reset(new RoomSegmentMesh(mesh, program, pool_allocation_bytes, true));
 }
 
 RoomSegmentMesh::~RoomSegmentMesh() {
-	//glDeleteBuffers(1, &room_ordered_buffer_.id_);
-	while (next_free_offset_) {
-		NextFreeOffsetQueueElem* tmp = next_free_offset_->el_;
-		delete next_free_offset_;
-		next_free_offset_ = tmp;
-	}
 }
 
-RoomSegmentMesh::InstanceBufferRange RoomSegmentMesh::addInstanceUnordered(Instance i) {
-    int offset; // the buffer offset where instance should be added
-    // if there are no holes in the instance buffer, add instance at the end
-    if (!next_free_offset_) offset = gpu_instance_buffer_.num_instances_;
-    else { // else get hole offset and remove hole from queue
-        offset = next_free_offset_->offset_;
-        NextFreeOffsetQueueElem* tmp = next_free_offset_->el_;
-        delete next_free_offset_;
-        next_free_offset_ = tmp;
-    }
-    // insert instance into a hole or to the end of the buffer
+RoomSegmentMesh::InstanceBufferRange RoomSegmentMesh::addInstanceUnordered(Instance i, GridCell* owner) {
+    // append instance to the end of the buffer (there are no holes)
     // data remains on CPU side
     // upload to GPU is deferred until SGCT does a synch (see base class SynchronizedInstancedMesh)
-    if (offset >= instance_buffer_.size()) {
-        instance_buffer_.push_back(i);
-    }
-    else {
-        instance_buffer_[offset] = i;
-    }
+    int offset = gpu_instance_buffer_.num_instances_;
+    instance_buffer_.push_back(i);
+    owners_.push_back(owner);
     RoomSegmentMesh::InstanceBufferRange range;
     range.buffer_ = &gpu_instance_buffer_;
     range.mesh_ = this;
     range.num_instances_ = 1;
     range.offset_instances_ = offset;
-    if (offset == gpu_instance_buffer_.num_instances_)
-        gpu_instance_buffer_.num_instances_++;
+    gpu_instance_buffer_.num_instances_++;
+    markInstancesChanged();
     return range; // return buffer range so that the caller can remove the instance again later
 }
 
-RoomSegmentMesh::InstanceBufferRange RoomSegmentMesh::addInstanceUnordered_IMMEDIATE_GPU_UPLOAD(Instance i) {
-	int offset; // the buffer offset where instance should be added
-    // if there are no holes in the instance buffer, add instance at the end
-	if (!next_free_offset_) offset = gpu_instance_buffer_.num_instances_;
-	else { // else get hole offset and remove hole from queue
-        offset = next_free_offset_->offset_;
-		NextFreeOffsetQueueElem* tmp = next_free_offset_->el_;
-		delete next_free_offset_;
-		next_free_offset_ = tmp;
+void RoomSegmentMesh::removeInstanceUnordered(int offset_instances) {
+	if (!room_ordered_mesh_) {
+		removeInstanceOfRoom(offset_instances);
+		return;
 	}
-    // instance buffer reached current capacity?
-	if ((offset + 1) * sizeof(Instance) > gpu_instance_buffer_.pool_allocation_bytes_ * gpu_instance_buffer_.num_reallocations_) {
-		// allocate new buffer and and copy data
-		glBindBuffer(GL_COPY_READ_BUFFER, gpu_instance_buffer_.id_);
-		GLuint tmpBuffer;
-		glGenBuffers(1, &tmpBuffer);
-		glBindBuffer(GL_COPY_WRITE_BUFFER, tmpBuffer);
-		gpu_instance_buffer_.num_reallocations_++;
-		glBufferData(GL_COPY_WRITE_BUFFER, gpu_instance_buffer_.pool_allocation_bytes_ * gpu_instance_buffer_.num_reallocations_, 0, GL_STATIC_COPY);
-		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, gpu_instance_buffer_.num_instances_ * sizeof(Instance));
-		// THIS IS WHAT MAKES REALLOCATION APPROACH ***UGLY***:
-		glDeleteBuffers(1, &gpu_instance_buffer_.id_); // Delete old instance buffer
-		glDeleteVertexArrays(1, &vao_); // Delete old VAO
-		resetShader(); // Create new VAO and connect old vertex buffer
-		// Connect new instance buffer
-		gpu_instance_buffer_.id_ = tmpBuffer;
-		glBindVertexArray(vao_);
-		glBindBuffer(GL_ARRAY_BUFFER, gpu_instance_buffer_.id_);
-		Instance::setAttribPointer();
+	markInstancesChanged();
+	int last = gpu_instance_buffer_.num_instances_ - 1;
+	// fill the gap with the last instance and tell its owner about the new offset
+	if (offset_instances != last) {
+		instance_buffer_[offset_instances] = instance_buffer_[last];
+		owners_[offset_instances] = owners_[last];
+		if (owners_[offset_instances])
+			owners_[offset_instances]->moveMeshInstance(this, last, offset_instances);
 	}
-    // insert instance into a hole or to the end of the buffer
-	glBindBuffer(GL_ARRAY_BUFFER, gpu_instance_buffer_.id_);
-	glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(Instance), sizeof(Instance), &i);
-    RoomSegmentMesh::InstanceBufferRange range;
-    range.buffer_ = &gpu_instance_buffer_;
-    range.mesh_ = this;
-    range.num_instances_ = 1;
-    range.offset_instances_ = offset;
-	if (offset == gpu_instance_buffer_.num_instances_)
-		gpu_instance_buffer_.num_instances_++;
-	return range; // return buffer range so that the caller can remove the instance again later
+	instance_buffer_.resize(last);
+	owners_.resize(last);
+	gpu_instance_buffer_.num_instances_ = last;
 }
 
+void RoomSegmentMesh::moveInstance(int from, int to) {
+	instance_buffer_[to] = instance_buffer_[from];
+	owners_[to] = owners_[from];
+	if (owners_[to]) owners_[to]->moveMeshInstance(this, from, to);
+}
 
-void RoomSegmentMesh::removeInstanceUnordered(int offset_instances) {
-    // removing last offset in buffer is done by simply decrementing instance count
-	if (offset_instances == gpu_instance_buffer_.num_instances_ - 1) {
-		gpu_instance_buffer_.num_instances_--;
-		return;
+RoomSegmentMesh::InstanceBufferRange RoomSegmentMesh::addInstanceOfRoom(Instance i, GridCell* owner, const roomgame::Room* room) {
+	size_t r = 0;
+	while (r < room_ranges_.size() && room_ranges_[r].room_ != room) r++;
+	if (r == room_ranges_.size()) {
+		// new room: append its range
+		room_ranges_.push_back(RoomRange{ room, gpu_instance_buffer_.num_instances_, 0 });
+	}
+	// open a slot at the end of the buffer and pass it down to the end of the room's range:
+	// each following room moves its first instance into the slot behind its last one
+	int slot = gpu_instance_buffer_.num_instances_;
+	instance_buffer_.push_back(i);
+	owners_.push_back(nullptr);
+	for (size_t k = room_ranges_.size() - 1; k > r; k--) {
+		RoomRange& following = room_ranges_[k];
+		if (following.first_ != slot) moveInstance(following.first_, slot);
+		slot = following.first_;
+		following.first_++;
 	}
-    // removing instance from the middle of the buffer creates a hole
-	if (!next_free_offset_) { // create the first hole
-		next_free_offset_ = new NextFreeOffsetQueueElem(offset_instances);
-		last_free_offset_ = next_free_offset_;
+	instance_buffer_[slot] = i;
+	owners_[slot] = owner;
+	room_ranges_[r].count_++;
+	gpu_instance_buffer_.num_instances_++;
+	markInstancesChanged();
+	RoomSegmentMesh::InstanceBufferRange range;
+	range.buffer_ = &gpu_instance_buffer_;
+	range.mesh_ = this;
+	range.num_instances_ = 1;
+	range.offset_instances_ = slot;
+	return range;
+}
+
+void RoomSegmentMesh::removeInstanceOfRoom(int offset_instances) {
+	markInstancesChanged();
+	// range containing the instance (ranges are sorted by first and have no gaps)
+	size_t r = 0;
+	while (r + 1 < room_ranges_.size() && room_ranges_[r + 1].first_ <= offset_instances) r++;
+	// fill the gap with the last instance of the room, then pass the gap on to the end of the buffer:
+	// each following room moves its last instance into the gap in front of its first one
+	RoomRange& range = room_ranges_[r];
+	int gap = range.first_ + range.count_ - 1;
+	if (offset_instances != gap) moveInstance(gap, offset_instances);
+	range.count_--;
+	for (size_t k = r + 1; k < room_ranges_.size(); k++) {
+		RoomRange& following = room_ranges_[k];
+		const int last = following.first_ + following.count_ - 1;
+		moveInstance(last, gap);
+		following.first_ = gap;
+		gap = last;
 	}
-	else { // append a hole to the queue
-		last_free_offset_->el_ = new NextFreeOffsetQueueElem(offset_instances);
-		last_free_offset_ = last_free_offset_->el_;
+	if (range.count_ == 0) room_ranges_.erase(room_ranges_.begin() + r);
+	const int num_instances = gpu_instance_buffer_.num_instances_ - 1;
+	instance_buffer_.resize(num_instances);
+	owners_.resize(num_instances);
+	gpu_instance_buffer_.num_instances_ = num_instances;
+}
+
+const std::vector<RoomSegmentMesh::RoomRange>& RoomSegmentMesh::getRoomRanges() const {
+	return room_ranges_;
+}
+
+RoomSegmentMesh::InstanceBufferRange RoomSegmentMesh::moveInstanceToRoomOrderedBuffer(int offset_instances, const roomgame::Room* room) {
+	RoomSegmentMesh::InstanceBufferRange range;
+	if (!room_ordered_mesh_) { // already room-ordered
+		range.buffer_ = &gpu_instance_buffer_;
+		range.mesh_ = this;
+		range.num_instances_ = 1;
+		range.offset_instances_ = offset_instances;
+		return range;
 	}
-	// cannot prevent GL from rendering holes too: insert a zero scaled instance into the hole (bad hack)
-	Instance zeroScaledInstance;
-	/*glBindBuffer(GL_ARRAY_BUFFER, gpu_instance_buffer_.id_); // no more immediate GPU upload
-	glBufferSubData(GL_ARRAY_BUFFER, offset_instances * sizeof(Instance), sizeof(Instance), &zeroScaledInstance);*/
-    instance_buffer_[offset_instances] = zeroScaledInstance;
+	// add to the room's range in the room-ordered buffer first, then close the gap in this buffer (may move another instance)
+	range = room_ordered_mesh_->addInstanceOfRoom(instance_buffer_[offset_instances], owners_[offset_instances], room);
+	removeInstanceUnordered(offset_instances);
+	return range;
 }
 
-RoomSegmentMesh::InstanceBufferRange RoomSegmentMesh::moveInstancesToRoomOrderedBuffer(std::initializer_list<int> offsets) {
-	//TODO copy and remove instances at given offsets
-	return RoomSegmentMesh::InstanceBufferRange();
+RoomSegmentMesh* RoomSegmentMesh::getRoomOrderedMesh() {
+	return room_ordered_mesh_.get();
 }
 
+void RoomSegmentMesh::setLODMeshes(const std::vector<viscom::Mesh*>& lod_meshes) {
+	lod_meshes_ = lod_meshes;
+	if (room_ordered_mesh_) room_ordered_mesh_->setLODMeshes(lod_meshes);
+}
+
+viscom::Mesh* RoomSegmentMesh::getLODMesh(size_t level) const {
+	if (level == 0) return mesh_;
+	return level <= lod_meshes_.size() ? lod_meshes_[level - 1] : nullptr;
+}
 
+void RoomSegmentMesh::setSimplifiedLODs(std::vector<SimplifiedLOD> lods) {
+	simplified_lods_ = std::make_shared<const std::vector<SimplifiedLOD>>(std::move(lods));
+	if (room_ordered_mesh_) room_ordered_mesh_->simplified_lods_ = simplified_lods_;
+}
+
+const RoomSegmentMesh::SimplifiedLOD* RoomSegmentMesh::getSimplifiedLOD(size_t level) const {
+	if (level == 0 || !simplified_lods_ || level >= simplified_lods_->size()) return nullptr;
+	const SimplifiedLOD& lod = (*simplified_lods_)[level];
+	return lod.submeshes.empty() ? nullptr : &lod;
+}
 
 void RoomSegmentMesh::renderAllInstances(std::function<void(void)> uniformSetter, const glm::mat4& view_projection, GLint isDebugMode, LightInfo* lightInfo, glm::vec3& viewPos) {
-	//TODO Seperately draw unordered and ordered buffers
+	// room-ordered instances are drawn separately with their own buffer
+	if (room_ordered_mesh_) room_ordered_mesh_->renderAllInstances(uniformSetter, view_projection, isDebugMode, lightInfo, viewPos);
 	if (gpu_instance_buffer_.num_instances_ == 0) return;
-	MeshBase::render(view_projection, gpu_instance_buffer_.num_instances_,uniformSetter,glm::mat4(1),false,lightInfo,viewPos, isDebugMode);
+	MeshBase::render(view_projection, gpu_instance_buffer_.num_instances_,uniformSetter,glm::mat4(1),false,lightInfo,viewPos, isDebugMode, getBaseInstance());
 }
\ No newline at end of file
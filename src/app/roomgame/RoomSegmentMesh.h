@@ -10,13 +10,23 @@
 #include "core/gfx/Texture.h"
 #include "../Vertices.h"
 
+class GridCell;
+namespace roomgame { class Room; }
+
 
 
 
 /* Class for instanced meshes.
  * Especially intended for segments of rooms on a grid.
  * However usable for all instanced meshes on the grid so far.
- * 
+ * Instances only hold their cell and build state bits, so health changes never touch the instance buffers.
+ * The instance buffer has no holes (draw cost tracks live instances):
+ * Removing an instance moves the last instance into its place...
+ * ... and updates the buffer range held by the owning grid cell of the moved instance (back-reference).
+ * Each mesh has a companion mesh with a room-ordered buffer (own VAO, instance buffer and sync object):
+ * Instances of finished rooms are moved there, each room keeps a contiguous range [first, first + count).
+ * Adding or removing an instance re-packs the buffer room by room (one instance moves per following room).
+ * It only changes when rooms are finished or their cells change, the unordered buffer keeps previews and infection.
 */
 class RoomSegmentMesh : public SynchronizedInstancedMesh<roomgame::PerInstanceData> {
 public:
@@ -28,23 +38,44 @@ public:
         int offset_instances_ = -1; // offset in units of instances
         int num_instances_ = -1; // instances in the range
     };
-    /* Queue data structure for managing holes in buffers */
-	struct NextFreeOffsetQueueElem {
-		int offset_; // offset of the hole
-		NextFreeOffsetQueueElem* el_; // next queue element
-		NextFreeOffsetQueueElem(int off) : offset_(off), el_(0) {} // constructor
-	};
+    /* Level of detail simplified from the mesh when it is added to the pool (indices into the vertices of the mesh) */
+    struct SimplifiedLOD {
+        std::vector<unsigned int> indices;
+        std::vector<std::pair<GLuint, GLuint>> submeshes; // first index and count of each submesh (forEachSubmeshOf order, count 0: keep the full submesh)
+    };
+    /* Range of a finished room in the room-ordered buffer */
+    struct RoomRange {
+        const roomgame::Room* room_;
+        int first_;
+        int count_;
+    };
 private:
-    //roomgame::InstanceBuffer room_ordered_buffer_; // instance buffer for finished room segments (feature not implemented yet)
-	NextFreeOffsetQueueElem* next_free_offset_; // beginning of the hole offset queue
-	NextFreeOffsetQueueElem* last_free_offset_; // end of the hole offset queue
+    std::unique_ptr<RoomSegmentMesh> room_ordered_mesh_; // instances of finished rooms (null for room-ordered meshes)
+    std::vector<GridCell*> owners_; // master: owning grid cell of each instance (same order as instance buffer)
+    std::vector<viscom::Mesh*> lod_meshes_; // supplied coarser levels of detail (from level 1, shared with the room-ordered mesh)
+    std::shared_ptr<const std::vector<SimplifiedLOD>> simplified_lods_; // by level (empty for level 0 and supplied levels, shared with the room-ordered mesh)
+    std::vector<RoomRange> room_ranges_; // master, room-ordered meshes: ranges of the rooms in buffer order (no gaps)
+    // Move an instance within the buffer and tell its owner
+    void moveInstance(int from, int to);
+    InstanceBufferRange addInstanceOfRoom(Instance, GridCell* owner, const roomgame::Room* room);
+    void removeInstanceOfRoom(int offset_instances);
 public:
-	RoomSegmentMesh(viscom::Mesh* mesh, viscom::GPUProgram* program, size_t pool_allocation_bytes);
+	RoomSegmentMesh(viscom::Mesh* mesh, viscom::GPUProgram* program, size_t pool_allocation_bytes, bool room_ordered = false);
 	~RoomSegmentMesh();
-    InstanceBufferRange addInstanceUnordered(Instance);
-    InstanceBufferRange addInstanceUnordered_IMMEDIATE_GPU_UPLOAD(Instance); // deprecated because uncompatible with synchronization
+    InstanceBufferRange addInstanceUnordered(Instance, GridCell* owner);
+    // Remove an instance (keeps the room ranges of room-ordered meshes contiguous)
 	void removeInstanceUnordered(int offset_instances);
-    InstanceBufferRange moveInstancesToRoomOrderedBuffer(std::initializer_list<int> offsets); // (feature not implemented yet)
+    // Move an instance of a finished room to the room-ordered mesh (returns its new range, same range if already there)
+    InstanceBufferRange moveInstanceToRoomOrderedBuffer(int offset_instances, const roomgame::Room* room);
+    const std::vector<RoomRange>& getRoomRanges() const;
+    RoomSegmentMesh* getRoomOrderedMesh();
+    // Meshes for the coarser levels of detail (levels that are not supplied are simplified, see MultiDrawRenderer::buildLODChain)
+    void setLODMeshes(const std::vector<viscom::Mesh*>& lod_meshes);
+    // Mesh of a level of detail (level 0 is the mesh itself, null if the level is not supplied)
+    viscom::Mesh* getLODMesh(size_t level) const;
+    void setSimplifiedLODs(std::vector<SimplifiedLOD> lods);
+    // Simplified level of detail (null if the level is supplied or was not simplified)
+    const SimplifiedLOD* getSimplifiedLOD(size_t level) const;
 	void renderAllInstances(std::function<void(void)> uniformSetter, const glm::mat4& view_projection, GLint isDebugMode, LightInfo* lightInfo = nullptr, glm::vec3& viewPos = glm::vec3(0, 0, 4));
 };
 
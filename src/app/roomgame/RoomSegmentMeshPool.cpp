@@ -10,11 +10,20 @@ namespace roomgame
         POOL_ALLOC_BYTES_DEFAULT(MAX_INSTANCES * sizeof(RoomSegmentMesh::Instance))
     {
         shader_ = 0;
+        multi_draw_initialized_ = false;
+        animated_first_draw_ = 0;
+        dispatch_dirty_ = true;
+        frame_uniforms_dirty_ = true;
+        generated_version_ = 0;
+        culling_grid_ = InstanceCuller::Grid{ glm::vec2(0), 0.0f, 0, 0, 0.0f, 0.0f };
     }
 
     RoomSegmentMeshPool::~RoomSegmentMeshPool() {}
 
     void RoomSegmentMeshPool::cleanup() {
+        culler_.cleanup();
+        instance_generator_.cleanup();
+        multi_draw_.cleanup();
         for (GLuint i : render_list_)
             for (RoomSegmentMesh* mesh : meshes_[i])
                 delete mesh;
@@ -23,20 +32,47 @@ namespace roomgame
 
     void RoomSegmentMeshPool::loadShader(viscom::GPUProgramManager mgr, std::shared_ptr<viscom::GPUProgram> instanceShader) {
         shader_ = instanceShader;
-        depth_pass_flag_uniform_location_ = shader_->getUniformLocation("isDepthPass");
-        debug_mode_flag_uniform_location_ = shader_->getUniformLocation("isDebugMode");
+        reflection_.reflect(shader_->getProgramId());
+        depth_pass_flag_uniform_ = reflection_.uniform<GLint>("isDepthPass");
+        debug_mode_flag_uniform_ = reflection_.uniform<GLint>("isDebugMode");
+        multi_draw_flag_uniform_ = reflection_.uniform<GLint>("isMultiDraw");
+        first_draw_uniform_ = reflection_.uniform<GLint>("firstDraw");
+        if (VISCOM_GPU_INSTANCE_GENERATION) {
+            if (GPUInstanceGenerator::isSupported())
+                generator_shader_ = mgr.GetResource("generateMeshInstances",
+                    std::initializer_list<std::string>{ "generateMeshInstances.comp" });
+            else
+                printf("GPU instance generation is not supported, no room meshes will be rendered\n");
+        }
+        if (InstanceCuller::isSupported())
+            culling_shader_ = mgr.GetResource("cullMeshInstances",
+                std::initializer_list<std::string>{ "cullMeshInstances.comp" });
+    }
+
+    void RoomSegmentMeshPool::setCullingGrid(const InstanceCuller::Grid& grid) {
+        culling_grid_ = grid;
     }
 
-    void RoomSegmentMeshPool::addMesh(std::vector<GLuint> types, std::shared_ptr<viscom::Mesh> mesh) {
+    void RoomSegmentMeshPool::addMesh(std::vector<GLuint> types, std::shared_ptr<viscom::Mesh> mesh, std::vector<std::shared_ptr<viscom::Mesh>> lod_meshes) {
         // Map one mesh to possibly multiple build states
         // (first build state is considered representative for the mesh)
         size_t pool_allocation_bytes = determinePoolAllocationBytes(types[0]); // use pool alloc bytes of representative build state
         RoomSegmentMesh* meshptr = new RoomSegmentMesh(mesh.get(), shader_.get(), pool_allocation_bytes);
+        // Supplied levels of detail, the missing ones are simplified from the mesh now (draws are built on first render)
+        std::vector<viscom::Mesh*> lods;
+        for (std::shared_ptr<viscom::Mesh> lod : lod_meshes) {
+            lods.push_back(lod.get());
+            owned_resources_.insert(lod);
+        }
+        meshptr->setLODMeshes(lods);
+        MultiDrawRenderer::buildLODChain(meshptr);
         for (GLuint type : types) {
             // Copy the mesh pointer for each build state
             // (ensures that a mesh for a requested build state can quickly be found)
             meshes_[type].push_back(meshptr);
+            if ((type & GridCell::INFECTED) != 0) animated_meshes_.insert(meshptr);
         }
+        dispatch_dirty_ = true;
         if (owned_resources_.find(mesh) == owned_resources_.end()) {
             // Store representative build state in render list
             // (ensures each mesh is only rendered once)
@@ -54,110 +90,266 @@ namespace roomgame
     }
 
     void RoomSegmentMeshPool::updateUniformEveryFrame(std::string uniform_name, std::function<void(GLint)> update_func) {
-        uniform_locations_.push_back(shader_->getUniformLocation(uniform_name));
+        uniform_locations_.push_back(reflection_.getLocation(uniform_name));
         uniform_callbacks_.push_back(update_func);
+        frame_uniforms_dirty_ = true;
     }
 
-    RoomSegmentMesh* RoomSegmentMeshPool::getMeshOfType(GLuint type) {
-        // Ignore orientation bits (so that walls and corners can be added once and reused)
-        type &= ~(GridCell::TOP | GridCell::BOTTOM | GridCell::RIGHT | GridCell::LEFT);
-        // Request mapped mesh(es)
-        std::vector<RoomSegmentMesh*> mesh_variations;
-        try {
-            mesh_variations = meshes_.at(type);
+    void RoomSegmentMeshPool::bindTextureEveryPass(std::string sampler_name, GLuint unit, const SamplerDesc& sampler, std::function<GLuint(void)> texture_func) {
+        GLStateCache::current().useProgram(shader_->getProgramId());
+        reflection_.uniform<GLint>(sampler_name).set(static_cast<GLint>(unit));
+        pass_textures_.push_back({ unit, sampler, texture_func });
+    }
+
+    void RoomSegmentMeshPool::beginFrame() {
+        frame_uniforms_dirty_ = true;
+    }
+
+    void RoomSegmentMeshPool::bindPassState(GLint isDepthPass) {
+        GLStateCache::current().useProgram(shader_->getProgramId());
+        if (frame_uniforms_dirty_) {
+            for (unsigned int i = 0; i < uniform_locations_.size(); i++) uniform_callbacks_[i](uniform_locations_[i]);
+            frame_uniforms_dirty_ = false;
         }
-        catch (std::out_of_range) {
+        // other programs may use the same units between passes (binds still current are skipped by the state cache)
+        for (const PassTexture& tex : pass_textures_) {
+            GLStateCache::current().bindTexture(tex.unit, tex.texture(), tex.sampler);
+        }
+        depth_pass_flag_uniform_.set(isDepthPass);
+    }
+
+    RoomSegmentMesh* RoomSegmentMeshPool::getMeshOfType(GLuint type, size_t cellHash) {
+        if (dispatch_dirty_) buildDispatchTables();
+        // Ignore orientation bits (so that walls and corners can be added once and reused)
+        type &= ~ORIENTATION_BITS;
+        const DispatchRange& variations = type_dispatch_[type & (NUM_BUILD_STATES - 1)];
+        if (type >= NUM_BUILD_STATES || variations.count == 0) {
             // If the pool does not have the requested type
             printf("Pool has no mesh for type %d\n", (int)type);
             return 0;
         }
-        unsigned int variation = 0;
-        if (mesh_variations.size() > 1) {
-            srand((unsigned int)time(0));
-            variation = rand() % mesh_variations.size();
-        }
-        return mesh_variations[variation];
+        return variations_[variations.first + cellHash % variations.count];
     }
 
     void RoomSegmentMeshPool::filter(GLuint buildStateBits, std::function<void(GLuint)> callback) {
-        // Aggregate buildstate bits of all mesh mappings, that overlap with the filter
+        forEachMeshOfState(buildStateBits, 0, [&](RoomSegmentMesh*, GLuint renderableBuildState) {
+            callback(renderableBuildState);
+        });
+    }
+
+    void RoomSegmentMeshPool::forEachMeshOfState(GLuint buildStateBits, size_t cellHash, std::function<void(RoomSegmentMesh*, GLuint)> callback) {
+        if (dispatch_dirty_) buildDispatchTables();
+        const DispatchRange& meshes = state_dispatch_[buildStateBits & (NUM_BUILD_STATES - 1)];
+        for (uint32_t i = meshes.first; i < meshes.first + meshes.count; i++) {
+            const MeshDispatch& mesh = mesh_dispatch_[i];
+            callback(variations_[mesh.variations.first + cellHash % mesh.variations.count], mesh.renderable_build_state);
+        }
+    }
+
+    size_t RoomSegmentMeshPool::cellHash(size_t col, size_t row) {
+        // spatial hash: neighbouring cells pick different variations, the same cell always the same
+        return ((col * 73856093u) ^ (row * 19349663u)) >> 4;
+    }
+
+    void RoomSegmentMeshPool::buildDispatchTables() {
+        // Exact build state -> mesh variations (getMeshOfType)
+        variations_.clear();
+        type_dispatch_.assign(static_cast<size_t>(NUM_BUILD_STATES), DispatchRange{ 0, 0 });
+        for (std::pair<const GLuint, std::vector<RoomSegmentMesh*>>& stateMeshMapping : meshes_) {
+            if (stateMeshMapping.first >= NUM_BUILD_STATES) {
+                printf("Pool type %d exceeds the build state bits\n", (int)stateMeshMapping.first);
+                continue;
+            }
+            type_dispatch_[stateMeshMapping.first] = DispatchRange{
+                static_cast<uint32_t>(variations_.size()), static_cast<uint32_t>(stateMeshMapping.second.size()) };
+            variations_.insert(variations_.end(), stateMeshMapping.second.begin(), stateMeshMapping.second.end());
+        }
+        // Any build state -> meshes to instantiate and the state bits each mesh sees (filter)
+        // Aggregate buildstate bits of all mesh mappings, that overlap with the state
         // Example 1: If meshpool has one mesh for buildstates A and B,
-        //            A|B is formed and the overlap with buildStateBits returned in callback
+        //            A|B is formed and the overlap with the state is the renderable build state
         // Example 2: If meshpool has different meshes for buildstates A and B,
-        //            callback is called twice with an overlap of each builstate with buildStateBits
-        std::unordered_map<RoomSegmentMesh*, GLuint> aggregatedBuildStates;
-        for (std::pair<GLuint, std::vector<RoomSegmentMesh*>> stateMeshMapping : meshes_) {
-            GLuint mappedBuildStateBits = stateMeshMapping.first;
-            RoomSegmentMesh* mappedMesh = stateMeshMapping.second[0];
-            GLuint overlap = mappedBuildStateBits & buildStateBits;
-            if (overlap)
-                aggregatedBuildStates[mappedMesh] |= overlap; // aggregation
-        }
-        // Attach present orientation bits (so that shader can rotate room segments)
-        GLuint orientationBits = buildStateBits & (GridCell::TOP | GridCell::BOTTOM | GridCell::RIGHT | GridCell::LEFT);
-        for (std::pair<RoomSegmentMesh*, GLuint> aggBuildStateBits : aggregatedBuildStates)
-            callback(aggBuildStateBits.second | orientationBits);
-    }
-
-    void RoomSegmentMeshPool::renderAllMeshes(glm::mat4& view_projection, GLint isDepthPass, GLint isDebugMode, LightInfo* lightInfo, glm::vec3& viewPos) {
+        //            the state instantiates two meshes with an overlap of each builstate with the state
+        mesh_dispatch_.clear();
+        state_dispatch_.assign(static_cast<size_t>(NUM_BUILD_STATES), DispatchRange{ 0, 0 });
+        std::vector<std::pair<RoomSegmentMesh*, GLuint>> aggregatedBuildStates;
+        for (GLuint state = 0; state < NUM_BUILD_STATES; state++) {
+            aggregatedBuildStates.clear();
+            for (std::pair<const GLuint, std::vector<RoomSegmentMesh*>>& stateMeshMapping : meshes_) {
+                GLuint overlap = stateMeshMapping.first & state;
+                if (!overlap) continue;
+                RoomSegmentMesh* mappedMesh = stateMeshMapping.second[0];
+                size_t m = 0;
+                while (m < aggregatedBuildStates.size() && aggregatedBuildStates[m].first != mappedMesh) m++;
+                if (m == aggregatedBuildStates.size()) aggregatedBuildStates.push_back({ mappedMesh, 0 });
+                aggregatedBuildStates[m].second |= overlap; // aggregation
+            }
+            state_dispatch_[state].first = static_cast<uint32_t>(mesh_dispatch_.size());
+            for (std::pair<RoomSegmentMesh*, GLuint>& aggBuildStateBits : aggregatedBuildStates) {
+                // aggregated state must be mapped exactly (orientation bits ignored), otherwise nothing is instantiated
+                const DispatchRange& variations = type_dispatch_[aggBuildStateBits.second & ~ORIENTATION_BITS];
+                if (variations.count == 0) continue;
+                // Attach present orientation bits (so that shader can rotate room segments)
+                mesh_dispatch_.push_back(MeshDispatch{ aggBuildStateBits.second | (state & ORIENTATION_BITS), variations });
+            }
+            state_dispatch_[state].count = static_cast<uint32_t>(mesh_dispatch_.size()) - state_dispatch_[state].first;
+        }
+        dispatch_dirty_ = false;
+    }
+
+    void RoomSegmentMeshPool::initMultiDraw() {
+        if (multi_draw_initialized_) return;
+        // all meshes are added by now, animated meshes last (their draws form one range)
+        std::vector<RoomSegmentMesh*> meshes;
+        for (bool animated : { false, true })
+            for (GLuint i : render_list_)
+                for (RoomSegmentMesh* mesh : meshes_[i])
+                    if ((animated_meshes_.count(mesh) != 0) == animated) meshes.push_back(mesh);
+        if (multi_draw_flag_uniform_.isValid()) multi_draw_.init(meshes, shader_.get());
+        // draws are sorted by source (a mesh, then its room-ordered mesh)
+        animated_first_draw_ = 0;
+        while (animated_first_draw_ < multi_draw_.getNumDraws()
+            && !isAnimated(multi_draw_.getSource(multi_draw_.getDrawSource(animated_first_draw_)))) animated_first_draw_++;
+        multi_draw_initialized_ = true;
+    }
+
+    void RoomSegmentMeshPool::generateInstances(GLuint gridStateTexture, GLsizei numCols, GLsizei numRows) {
+        if (!generator_shader_) return;
+        initMultiDraw();
+        if (!instance_generator_.isReady()) {
+            // same mapping as filter: each build state maps to the first mesh added for it
+            std::vector<GPUInstanceGenerator::Mapping> mappings;
+            for (std::pair<GLuint, std::vector<RoomSegmentMesh*>> stateMeshMapping : meshes_)
+                mappings.push_back({ stateMeshMapping.first, stateMeshMapping.second[0] });
+            if (!instance_generator_.init(generator_shader_.get(), multi_draw_, mappings, numCols * numRows)) {
+                printf("GPU instance generation failed to initialize, no room meshes will be rendered\n");
+                generator_shader_ = nullptr;
+                return;
+            }
+        }
+        instance_generator_.generate(gridStateTexture, numCols, numRows);
+        generated_version_++;
+    }
+
+    unsigned long long RoomSegmentMeshPool::getInstanceVersion() {
+        // all versions only grow, so their sum changes with each of them
+        unsigned long long version = generated_version_;
         for (GLuint i : render_list_) {
             for (RoomSegmentMesh* mesh : meshes_[i]) {
-                mesh->renderAllInstances([&]() {
-                    for (unsigned int i = 0; i < uniform_locations_.size(); i++) uniform_callbacks_[i](uniform_locations_[i]);
-                    glUniform1i(depth_pass_flag_uniform_location_, isDepthPass);
-                }, view_projection, isDebugMode, lightInfo, viewPos);
+                version += mesh->getGPUVersion();
+                if (mesh->getRoomOrderedMesh()) version += mesh->getRoomOrderedMesh()->getGPUVersion();
             }
         }
+        return version;
     }
 
-    void RoomSegmentMeshPool::renderAllMeshesExcept(glm::mat4& view_projection, GLuint type_not_to_render, GLint isDepthPass, GLint isDebugMode, LightInfo* lightInfo, glm::vec3& viewPos) {
+    bool RoomSegmentMeshPool::isAnimated(RoomSegmentMesh* mesh) const {
+        for (RoomSegmentMesh* animated : animated_meshes_) {
+            if (mesh == animated || mesh == animated->getRoomOrderedMesh()) return true;
+        }
+        return false;
+    }
+
+    void RoomSegmentMeshPool::renderAllMeshes(glm::mat4& view_projection, GLint isDepthPass, GLint isDebugMode, LightInfo* lightInfo, glm::vec3& viewPos, Subset subset) {
+        initMultiDraw();
+        if (multi_draw_.isReady()) {
+            // range of draws of the subset
+            size_t firstDraw = (subset == Subset::ANIMATED) ? animated_first_draw_ : 0;
+            size_t numDraws = (subset == Subset::NOT_ANIMATED) ? animated_first_draw_ : multi_draw_.getNumDraws() - firstDraw;
+            if (numDraws == 0) return;
+            // per-pass uniforms once for the whole pool, submesh transforms and materials come from per-draw data
+            multi_draw_.update();
+            // cull against the cells in view of this pass (each viewport of a cluster sees a part of the grid)
+            bool culled = false;
+            if (culling_shader_ && culling_grid_.numCols > 0) {
+                if (!culler_.isReady() && !culler_.init(culling_shader_.get(), multi_draw_)) culling_shader_ = nullptr;
+                glm::ivec4 cellRect;
+                if (culler_.isReady()) {
+                    if (!InstanceCuller::visibleCellRect(view_projection, culling_grid_, cellRect)) return; // grid not in view
+                    // levels of detail are only selected by culling, so the whole grid in view still needs the pass
+                    if (!InstanceCuller::coversGrid(cellRect, culling_grid_) || multi_draw_.getNumLODLevels() > 1) {
+                        GLint viewport[4];
+                        glGetIntegerv(GL_VIEWPORT, viewport);
+                        culler_.cull(cellRect, view_projection, culling_grid_, glm::vec2(viewport[2], viewport[3]));
+                        culled = true;
+                    }
+                }
+            }
+            meshes_[render_list_[0]][0]->bindPassUniforms(view_projection, lightInfo, viewPos, isDebugMode);
+            bindPassState(isDepthPass);
+            multi_draw_flag_uniform_.set(1);
+            first_draw_uniform_.set(static_cast<GLint>(firstDraw));
+            glPolygonMode(GL_FRONT_AND_BACK, isDebugMode == 1 ? GL_LINE : GL_FILL);
+            if (culled) multi_draw_.render(culler_.getInstanceBuffer(), culler_.getIndirectBuffer(), firstDraw, numDraws);
+            else multi_draw_.render(multi_draw_.getInstanceBuffer(), multi_draw_.getIndirectBuffer(), firstDraw, numDraws);
+            first_draw_uniform_.set(0);
+            multi_draw_flag_uniform_.set(0);
+            return;
+        }
+        bindPassState(isDepthPass);
         for (GLuint i : render_list_) {
-            if ((i & type_not_to_render) != 0) continue;
             for (RoomSegmentMesh* mesh : meshes_[i]) {
-                mesh->renderAllInstances([&]() {
-                    for (unsigned int i = 0; i < uniform_locations_.size(); i++) uniform_callbacks_[i](uniform_locations_[i]);
-                    glUniform1i(depth_pass_flag_uniform_location_, isDepthPass);
-                }, view_projection, isDebugMode, lightInfo, viewPos);
+                if (subset != Subset::ALL && isAnimated(mesh) != (subset == Subset::ANIMATED)) continue;
+                // only submesh transforms and materials differ between meshes (set by the mesh)
+                mesh->renderAllInstances(nullptr, view_projection, isDebugMode, lightInfo, viewPos);
             }
         }
     }
 
-    void RoomSegmentMeshPool::preSync() { // master
+    void RoomSegmentMeshPool::renderAllMeshesExcept(glm::mat4& view_projection, GLuint type_not_to_render, GLint isDepthPass, GLint isDebugMode, LightInfo* lightInfo, glm::vec3& viewPos) {
+        bindPassState(isDepthPass);
         for (GLuint i : render_list_) {
+            if ((i & type_not_to_render) != 0) continue;
             for (RoomSegmentMesh* mesh : meshes_[i]) {
-                mesh->preSync();
+                // only submesh transforms and materials differ between meshes (set by the mesh)
+                mesh->renderAllInstances(nullptr, view_projection, isDebugMode, lightInfo, viewPos);
             }
         }
     }
 
-    void RoomSegmentMeshPool::encode() { // master
+    void RoomSegmentMeshPool::registerSyncObjects(SyncRegistry& registry) {
+        // generated instances: every node builds its instances from the synced grid state
+        if (VISCOM_GPU_INSTANCE_GENERATION) return;
         for (GLuint i : render_list_) {
-            for (RoomSegmentMesh* mesh : meshes_[i]) {
-                mesh->encode();
+            for (RoomSegmentMesh* unorderedMesh : meshes_[i]) {
+                // room-ordered buffer is a separate object (mostly static, changes only with finished rooms)
+                for (RoomSegmentMesh* mesh : { unorderedMesh, unorderedMesh->getRoomOrderedMesh() }) {
+                    registry.add({ (mesh == unorderedMesh ? "mesh " : "room-ordered mesh ") + std::to_string(i),
+                        [mesh]() { return mesh->getInstanceGeneration(); },
+                        [mesh]() { mesh->preSync(); },
+                        [mesh](SyncStream& out) { mesh->encode(out); },
+                        [mesh](SyncStream& in) { mesh->decode(in); },
+                        [mesh]() { mesh->updateSyncedSlave(); },
+                        [mesh]() { return mesh->replicate(); } });
+                }
             }
         }
     }
 
-    void RoomSegmentMeshPool::decode() { // slave
+    void RoomSegmentMeshPool::updateSyncedMaster() {
+        if (VISCOM_GPU_INSTANCE_GENERATION) return; // CPU instances are not rendered
         for (GLuint i : render_list_) {
             for (RoomSegmentMesh* mesh : meshes_[i]) {
-                mesh->decode();
+                mesh->updateSyncedMaster();
+                mesh->getRoomOrderedMesh()->updateSyncedMaster();
             }
         }
     }
 
-    void RoomSegmentMeshPool::updateSyncedSlave() {
+    void RoomSegmentMeshPool::encodeSnapshot(SyncStream& out) { // master
         for (GLuint i : render_list_) {
             for (RoomSegmentMesh* mesh : meshes_[i]) {
-                mesh->updateSyncedSlave();
+                mesh->encodeSnapshot(out);
+                mesh->getRoomOrderedMesh()->encodeSnapshot(out);
             }
         }
     }
 
-    void RoomSegmentMeshPool::updateSyncedMaster() {
+    void RoomSegmentMeshPool::loadSnapshot(SyncStream& in) { // slave
         for (GLuint i : render_list_) {
             for (RoomSegmentMesh* mesh : meshes_[i]) {
-                mesh->updateSyncedMaster();
+                mesh->loadSnapshot(in);
+                mesh->getRoomOrderedMesh()->loadSnapshot(in);
             }
         }
     }
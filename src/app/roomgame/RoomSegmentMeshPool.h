@@ -3,10 +3,24 @@
 #include <memory>
 #include <stdexcept>
 #include <functional>
+#include <cstdint>
 #include "core/gfx/mesh/MeshRenderable.h"
 #include "../Vertices.h"
 #include "InteractiveGrid.h"
 #include "RoomSegmentMesh.h"
+#include "SyncRegistry.h"
+#include "MultiDrawRenderer.h"
+#include "GPUInstanceGenerator.h"
+#include "InstanceCuller.h"
+#include "ProgramReflection.h"
+#include "GLStateCache.h"
+
+/* Generate mesh instances from the grid state on each node instead of syncing instance buffers
+ * (must be the same on all nodes, needs compute shaders, see GPUInstanceGenerator) */
+#ifndef VISCOM_GPU_INSTANCE_GENERATION
+#define VISCOM_GPU_INSTANCE_GENERATION 0
+#endif
+
 namespace roomgame
 {
     /* Management class for room segment meshes and mesh instance shader
@@ -16,6 +30,10 @@ namespace roomgame
     * The build state bitfield is treated as simple numeric index into the mesh container.
     * An interactive grid that received a build call uses the pool to get an appropriate mesh for a build state.
     * Since build state is a bitfield, a filter method is provided, that finds mapped meshes in a given bitfield.
+    * Both lookups go through flat tables over all build states (13 bits), built on first use after the last addMesh:
+    * One load gives the meshes to instantiate for a state and the state bits each mesh sees.
+    * Mesh variations are chosen by a hash of the cell (stable per cell, no random numbers).
+    * Each mesh has a chain of levels of detail, the culling pass picks one per instance by its projected cell size.
     * Usage notes:
     * Mesh pool exists on all SGCT nodes
     * Used by nodes to create meshes (each including vertex and instance buffer)
@@ -25,42 +43,98 @@ namespace roomgame
     class RoomSegmentMeshPool {
         // Map build state to mesh variations (different build states can point to the same mesh)
         std::unordered_map<GLuint, std::vector<RoomSegmentMesh*>> meshes_;
+        // Dispatch tables (derived from meshes_, indexed by build state)
+        struct DispatchRange {
+            uint32_t first;
+            uint32_t count;
+        };
+        struct MeshDispatch {
+            GLuint renderable_build_state; // state bits the mesh sees (incl. orientation)
+            DispatchRange variations; // range in variations_
+        };
+        std::vector<RoomSegmentMesh*> variations_; // variations of all mapped build states
+        std::vector<DispatchRange> type_dispatch_; // exact build state -> range in variations_
+        std::vector<MeshDispatch> mesh_dispatch_; // meshes to instantiate of all build states
+        std::vector<DispatchRange> state_dispatch_; // any build state -> range in mesh_dispatch_
+        bool dispatch_dirty_; // meshes were added since the tables were built
         // Store a unique build state as key for each mesh
         std::vector<GLuint> render_list_;
         // Hold pointers to all meshes to control cleanup
         std::set<std::shared_ptr<viscom::Mesh>> owned_resources_;
         // The shader used by all meshes
         std::shared_ptr<viscom::GPUProgram> shader_;
-        // Uniforms
+        ProgramReflection reflection_; // uniforms of shader_, all names are resolved against it once
+        // Uniforms (program state, so evaluated once per frame for all passes, viewports and meshes)
         std::vector<GLint> uniform_locations_;
         std::vector<std::function<void(GLint)>> uniform_callbacks_;
-        GLint depth_pass_flag_uniform_location_;
-        GLint debug_mode_flag_uniform_location_;
+        bool frame_uniforms_dirty_;
+        // Textures bound once per render pass (sampler uniforms are set once)
+        struct PassTexture {
+            GLuint unit;
+            SamplerDesc sampler;
+            std::function<GLuint(void)> texture;
+        };
+        std::vector<PassTexture> pass_textures_;
+        Uniform<GLint> depth_pass_flag_uniform_;
+        Uniform<GLint> debug_mode_flag_uniform_;
+        Uniform<GLint> multi_draw_flag_uniform_;
+        Uniform<GLint> first_draw_uniform_;
+        // Meshes with infected instances, which the shader moves with the automaton time (mapped to a build state with INFECTED)
+        std::set<RoomSegmentMesh*> animated_meshes_;
+        size_t animated_first_draw_; // multi draws of animated meshes come last (from this draw on)
+        // Draws the whole pool with one indirect multi draw (initialized on first render, per-mesh rendering if unsupported)
+        MultiDrawRenderer multi_draw_;
+        bool multi_draw_initialized_;
+        // Fills the multi draw buffers from the grid state (only with VISCOM_GPU_INSTANCE_GENERATION)
+        GPUInstanceGenerator instance_generator_;
+        std::shared_ptr<viscom::GPUProgram> generator_shader_;
+        unsigned long long generated_version_; // bumped on each generation
+        // Culls the multi draw instances per render pass against the cells in view (if supported and the grid is known)
+        InstanceCuller culler_;
+        std::shared_ptr<viscom::GPUProgram> culling_shader_;
+        InstanceCuller::Grid culling_grid_;
     public:
+        // Part of the pool to render: animated meshes change every frame, the others only with their instances
+        enum class Subset { ALL, NOT_ANIMATED, ANIMATED };
+
         RoomSegmentMeshPool(const size_t MAX_INSTANCES);
         ~RoomSegmentMeshPool();
         // Functions for initialization
         void loadShader(viscom::GPUProgramManager mgr, std::shared_ptr<viscom::GPUProgram> instanceShader);
         // Map a mesh to (multiple) build states, or (multiple) comibinations
         // (note: if actually occuring combinations are forgotten, getMesh will fail, except combinations with orientation bits, which are ignored)
-        void addMesh(std::vector<GLuint> types, std::shared_ptr<viscom::Mesh> mesh);
+        // Optional coarser levels of detail of the mesh (from level 1, levels not given are simplified here, see MultiDrawRenderer::buildLODChain)
+        void addMesh(std::vector<GLuint> types, std::shared_ptr<viscom::Mesh> mesh, std::vector<std::shared_ptr<viscom::Mesh>> lod_meshes = {});
         void addMeshVariations(std::vector<GLuint> types, std::vector<std::shared_ptr<viscom::Mesh>> mesh_variations);
-        // Function for uniform shader data
+        // Function for uniform shader data (called with the shader in use, once per frame before the first pass)
         void updateUniformEveryFrame(std::string uniform_name, std::function<void(GLint)> update_func);
+        // Bind a texture to a unit before each pass (sampled through the sampler object of sampler)
+        void bindTextureEveryPass(std::string sampler_name, GLuint unit, const SamplerDesc& sampler, std::function<GLuint(void)> texture_func);
+        // Mark the per-frame uniforms for evaluation (once per frame, before rendering)
+        void beginFrame();
         // Get mapped mesh from build state (since build state is treated as simple index, combinations must match exactly)
-        RoomSegmentMesh* getMeshOfType(GLuint type);
+        RoomSegmentMesh* getMeshOfType(GLuint type, size_t cellHash = 0);
         // Finds overlaps of given buildstate bits with available mesh mappings and calls back for each mesh
         void filter(GLuint buildStateBits, std::function<void(GLuint)> callback);
+        // Same as filter, but also calls back with the mesh (variation chosen by cellHash) to instantiate for each overlap
+        void forEachMeshOfState(GLuint buildStateBits, size_t cellHash, std::function<void(RoomSegmentMesh*, GLuint)> callback);
+        static size_t cellHash(size_t col, size_t row);
         // Functions for rendering
-        void renderAllMeshes(glm::mat4& view_projection, GLint isDepthPass = 0, GLint isDebugMode = 0, LightInfo* lightInfo = nullptr, glm::vec3& viewPos = glm::vec3(0, 0, 4));
+        void renderAllMeshes(glm::mat4& view_projection, GLint isDepthPass = 0, GLint isDebugMode = 0, LightInfo* lightInfo = nullptr, glm::vec3& viewPos = glm::vec3(0, 0, 4), Subset subset = Subset::ALL);
         void renderAllMeshesExcept(glm::mat4& view_projection, GLuint type_not_to_render, GLint isDepthPass = 0, GLint isDebugMode = 0, LightInfo* lightInfo = nullptr, glm::vec3& viewPos = glm::vec3(0, 0, 4));
         void cleanup();
-        // Functions for SGCT synchronization
-        void preSync(); // master
-        void encode(); // master
-        void decode(); // slave
-        void updateSyncedSlave();
+        // Layout of the grid for culling (no culling before it is set)
+        void setCullingGrid(const InstanceCuller::Grid& grid);
+        // Rebuild all instances on the GPU after the grid state texture changed (VISCOM_GPU_INSTANCE_GENERATION)
+        void generateInstances(GLuint gridStateTexture, GLsizei numCols, GLsizei numRows);
+        // Changes whenever instances of any mesh change on the GPU (for caches of rendered meshes, e.g. shadows)
+        // Animated meshes also change with the automaton time and grid translation moves all meshes, neither is part of the version
+        unsigned long long getInstanceVersion();
+        // Functions for SGCT synchronization (each mesh is a separate object in the sync registry)
+        void registerSyncObjects(SyncRegistry& registry);
         void updateSyncedMaster();
+        void encodeSnapshot(SyncStream& out); // master
+        void loadSnapshot(SyncStream& in); // slave
         // Getter
         GLint getUniformLocation(size_t index);
         GLuint getShaderID();
@@ -72,5 +146,13 @@ namespace roomgame
         const size_t POOL_ALLOC_BYTES_OUTER_INFLUENCE;
         const size_t POOL_ALLOC_BYTES_DEFAULT;
         size_t determinePoolAllocationBytes(GLuint type);
+        static const GLuint NUM_BUILD_STATES = 8192; // all combinations of the build state bits up to REPAIRING
+        static const GLuint ORIENTATION_BITS = GridCell::TOP | GridCell::BOTTOM | GridCell::RIGHT | GridCell::LEFT;
+        void buildDispatchTables();
+        void initMultiDraw();
+        // Use the shader and set everything shared by all meshes of a pass
+        void bindPassState(GLint isDepthPass);
+        // Mesh (or room-ordered mesh of a mesh) in animated_meshes_
+        bool isAnimated(RoomSegmentMesh* mesh) const;
     };
 }
\ No newline at end of file
@@ -0,0 +1,82 @@
+#include "SceneUniforms.h"
+#include <cstring>
+
+namespace roomgame
+{
+    namespace {
+        SceneUniforms::PointLightPropsData pointLightProps(const PointLight& light) {
+            SceneUniforms::PointLightPropsData data;
+            std::memset(&data, 0, sizeof(data));
+            data.ambient = glm::vec4(light.ambient, 0);
+            data.diffuse = glm::vec4(light.diffuse, 0);
+            data.specular = light.specular;
+            data.constant = light.constant;
+            data.linear = light.linear;
+            data.quadratic = light.quadratic;
+            return data;
+        }
+    }
+
+    SceneUniforms::SceneUniforms() :
+        light_buffer_(0)
+    {
+        std::memset(&light_data_, 0, sizeof(light_data_));
+    }
+
+    SceneUniforms::~SceneUniforms() {
+        cleanup();
+    }
+
+    void SceneUniforms::init() {
+        cleanup();
+        glGenBuffers(1, &light_buffer_);
+        glBindBuffer(GL_UNIFORM_BUFFER, light_buffer_);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(LightData), &light_data_, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void SceneUniforms::updateLights(const glm::vec3& viewPos, const DirLight& sun,
+        const PointLight& outerInfLights, const std::vector<glm::vec3>& outerInfPositions,
+        const PointLight& sourceLights, const std::vector<glm::vec3>& sourcePositions) {
+        if (light_buffer_ == 0) return;
+        light_data_.viewPos = glm::vec4(viewPos, 1);
+        light_data_.dirLight.direction = glm::vec4(sun.direction, 0);
+        light_data_.dirLight.ambient = glm::vec4(sun.ambient, 0);
+        light_data_.dirLight.diffuse = glm::vec4(sun.diffuse, 0);
+        light_data_.dirLight.specular = glm::vec4(sun.specular, 0);
+        light_data_.outerInfLightProps = pointLightProps(outerInfLights);
+        light_data_.sourceLightProps = pointLightProps(sourceLights);
+        for (size_t i = 0; i < NUM_OUTER_INFLUENCE_LIGHTS; i++)
+            light_data_.outerInfLights[i] = glm::vec4(i < outerInfPositions.size() ? outerInfPositions[i] : glm::vec3(0), 1);
+        const size_t numSources = sourcePositions.size() < MAX_SOURCE_LIGHTS ? sourcePositions.size() : MAX_SOURCE_LIGHTS;
+        for (size_t i = 0; i < numSources; i++) light_data_.sourceLights[i] = glm::vec4(sourcePositions[i], 1);
+        light_data_.numSourceLights = static_cast<GLint>(numSources);
+
+        // whole block in one upload, bound once for all programs
+        glBindBuffer(GL_UNIFORM_BUFFER, light_buffer_);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LightData), &light_data_);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_BLOCK_BINDING, light_buffer_);
+    }
+
+    void SceneUniforms::cleanup() {
+        if (light_buffer_ != 0) glDeleteBuffers(1, &light_buffer_);
+        light_buffer_ = 0;
+    }
+
+    void SceneUniforms::bindBlocks(GLuint program, bool& hasLightBlock, bool& hasMaterialBlock) {
+        GLuint lightBlock = glGetUniformBlockIndex(program, "LightBlock");
+        GLuint materialBlock = glGetUniformBlockIndex(program, "MaterialBlock");
+        hasLightBlock = lightBlock != GL_INVALID_INDEX;
+        hasMaterialBlock = materialBlock != GL_INVALID_INDEX;
+        if (hasLightBlock) glUniformBlockBinding(program, lightBlock, LIGHT_BLOCK_BINDING);
+        if (hasMaterialBlock) glUniformBlockBinding(program, materialBlock, MATERIAL_BLOCK_BINDING);
+    }
+
+    size_t SceneUniforms::materialStride() {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        const size_t align = static_cast<size_t>(alignment);
+        return (sizeof(MaterialData) + align - 1) / align * align;
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "core/open_gl.h"
+#include "LightBase.h"
+
+namespace roomgame
+{
+    /* Uniform buffers shared by all programs of the roomgame (std140, see underwater.frag and renderMeshInstance.frag)
+     * LightBlock: camera position and all lights, written once per frame and bound to its binding point for all programs.
+     * MaterialBlock: material values, each mesh writes its materials once at load and binds them by index (see MeshBase).
+     * Programs without these blocks keep receiving plain uniforms.
+    */
+    class SceneUniforms {
+    public:
+        static const GLuint LIGHT_BLOCK_BINDING = 1; // 0 is DrawDataBlock (see MultiDrawRenderer)
+        static const GLuint MATERIAL_BLOCK_BINDING = 2;
+        static const size_t NUM_OUTER_INFLUENCE_LIGHTS = 5; // must match NR_OUT_INF_LIGHTS in the shaders
+        static const size_t MAX_SOURCE_LIGHTS = 15; // must match MAX_NR_SOURCE_LIGHTS in the shaders
+
+        // std140 layout of DirLight
+        struct DirLightData {
+            glm::vec4 direction;
+            glm::vec4 ambient;
+            glm::vec4 diffuse;
+            glm::vec4 specular;
+        };
+        // std140 layout of PointLightProps (attenuation is packed behind specular)
+        struct PointLightPropsData {
+            glm::vec4 ambient;
+            glm::vec4 diffuse;
+            glm::vec3 specular;
+            float constant;
+            float linear;
+            float quadratic;
+            float padding[2];
+        };
+        // std140 layout of LightBlock
+        struct LightData {
+            glm::vec4 viewPos;
+            DirLightData dirLight;
+            PointLightPropsData outerInfLightProps;
+            PointLightPropsData sourceLightProps;
+            glm::vec4 outerInfLights[NUM_OUTER_INFLUENCE_LIGHTS]; // PointLight (position only)
+            glm::vec4 sourceLights[MAX_SOURCE_LIGHTS];
+            GLint numSourceLights;
+            GLint padding[3];
+        };
+        // std140 layout of Material in MaterialBlock (samplers stay plain uniforms)
+        struct MaterialData {
+            float alpha;
+            float padding[3];
+            glm::vec3 ambient;
+            float bumpMultiplier;
+            glm::vec3 diffuse;
+            float refraction;
+            glm::vec3 specular;
+            float specularExponent;
+        };
+
+        SceneUniforms();
+        ~SceneUniforms();
+
+        void init();
+        // Write the lights of this frame (binds the light block for all programs)
+        void updateLights(const glm::vec3& viewPos, const DirLight& sun,
+            const PointLight& outerInfLights, const std::vector<glm::vec3>& outerInfPositions,
+            const PointLight& sourceLights, const std::vector<glm::vec3>& sourcePositions);
+        void cleanup();
+
+        // Connect the blocks of a program to their binding points (false for blocks the program does not have)
+        static void bindBlocks(GLuint program, bool& hasLightBlock, bool& hasMaterialBlock);
+        // Offset between two materials in a material buffer (uniform buffer offset alignment)
+        static size_t materialStride();
+
+    private:
+        GLuint light_buffer_;
+        LightData light_data_;
+    };
+}
@@ -0,0 +1,183 @@
+#include "ShadowMapCache.h"
+#include <cmath>
+#include <glm/gtc/matrix_transform.hpp>
+#include "InstanceCuller.h"
+
+namespace roomgame
+{
+    namespace {
+        // Corner i of a box (bits 0, 1, 2 select max in x, y, z)
+        glm::vec3 corner(const ShadowMapCache::Bounds& b, int i) {
+            return glm::vec3((i & 1) ? b.max.x : b.min.x, (i & 2) ? b.max.y : b.min.y, (i & 4) ? b.max.z : b.min.z);
+        }
+        bool contains(const ShadowMapCache::Bounds& b, const ShadowMapCache::Bounds& inner) {
+            return b.min.x <= inner.min.x && b.min.y <= inner.min.y && b.min.z <= inner.min.z
+                && b.max.x >= inner.max.x && b.max.y >= inner.max.y && b.max.z >= inner.max.z;
+        }
+        // Side of the square in x and y holding the box
+        float squareExtent(const ShadowMapCache::Bounds& b) {
+            const glm::vec3 size = b.max - b.min;
+            return size.x > size.y ? size.x : size.y;
+        }
+    }
+
+    ShadowMapCache::ShadowMapCache() :
+        size_(0),
+        valid_(false),
+        light_matrix_(1),
+        cached_state_{ 0, glm::vec3(0) },
+        fit_valid_(false),
+        fit_view_(1),
+        fit_box_{ glm::vec3(0), glm::vec3(0) },
+        stats_{ 0, 0, 0, 0 }
+    {
+        for (int l = 0; l < NUM_LAYERS; l++) fbos_[l] = nullptr;
+    }
+
+    ShadowMapCache::~ShadowMapCache() {
+        cleanup();
+    }
+
+    void ShadowMapCache::init(GLsizei size) {
+        cleanup();
+        size_ = size;
+        for (int l = 0; l < NUM_LAYERS; l++) {
+            layers_[l] = GPUBuffer::Tex{ 0, GL_DEPTH_ATTACHMENT, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT };
+            fbos_[l] = new GPUBuffer(size, size, { &layers_[l] });
+        }
+        fit_valid_ = false; // texels of the last fit have a different size
+        invalidate();
+    }
+
+    void ShadowMapCache::cleanup() {
+        for (int l = 0; l < NUM_LAYERS; l++) {
+            delete fbos_[l];
+            fbos_[l] = nullptr;
+            if (layers_[l].id != 0) glDeleteTextures(1, &layers_[l].id);
+            layers_[l].id = 0;
+        }
+        size_ = 0;
+        invalidate();
+    }
+
+    void ShadowMapCache::invalidate() {
+        valid_ = false;
+    }
+
+    glm::mat4 ShadowMapCache::fitLightMatrix(const glm::vec3& sunDirection, const glm::mat4& cameraViewProjection, const Bounds& terrain, const Bounds& grid) {
+        if (size_ == 0) return light_matrix_;
+        // Light view at the terrain center (its position along the sun direction does not matter for an orthographic projection)
+        const glm::vec3 dir = glm::normalize(sunDirection);
+        const glm::vec3 center = 0.5f * (terrain.min + terrain.max);
+        const glm::vec3 up = std::abs(dir.y) > 0.99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+        const glm::mat4 view = glm::lookAt(center - dir, center, up);
+        if (view != fit_view_) fit_valid_ = false;
+
+        Bounds scene = terrain;
+        scene.extend(grid.min);
+        scene.extend(grid.max);
+        // Receivers: camera frustum between lowest and highest point of the scene (clamped to it), and the whole grid
+        Bounds receivers = grid;
+        glm::vec2 lo, hi;
+        if (InstanceCuller::frustumSlabBounds(cameraViewProjection, scene.min.z, scene.max.z, lo, hi)) {
+            receivers.extend(glm::vec3(glm::clamp(lo, glm::vec2(scene.min), glm::vec2(scene.max)), scene.min.z));
+            receivers.extend(glm::vec3(glm::clamp(hi, glm::vec2(scene.min), glm::vec2(scene.max)), scene.max.z));
+        }
+
+        // Box needed in light view space: x and y of the receivers, depth of the whole scene
+        Bounds needed = { glm::vec3(INFINITY), glm::vec3(-INFINITY) };
+        Bounds depth = needed;
+        for (int i = 0; i < 8; i++) {
+            needed.extend(glm::vec3(view * glm::vec4(corner(receivers, i), 1)));
+            depth.extend(glm::vec3(view * glm::vec4(corner(scene, i), 1)));
+        }
+        needed.min.z = depth.min.z;
+        needed.max.z = depth.max.z;
+
+        const float step = glm::length(terrain.max - terrain.min) / EXTENT_STEPS;
+        const float maxExtent = 2.0f * squareExtent(needed) + step;
+        if (!fit_valid_ || !contains(fit_box_, needed) || squareExtent(fit_box_) > maxExtent) {
+            // a new fit of the needed box always stays within maxExtent, so it is kept in the next pass
+            Bounds box = needed;
+            snapBox(box, step);
+            if (fit_valid_) {
+                Bounds grown = fit_box_;
+                grown.extend(needed.min);
+                grown.extend(needed.max);
+                snapBox(grown, step);
+                if (squareExtent(grown) <= maxExtent) box = grown;
+            }
+            fit_view_ = view;
+            fit_box_ = box;
+            fit_valid_ = true;
+            stats_.fits++;
+        }
+        // view looks down -z: near and far plane are the negated maximum and minimum
+        return glm::ortho(fit_box_.min.x, fit_box_.max.x, fit_box_.min.y, fit_box_.max.y, -fit_box_.max.z, -fit_box_.min.z) * fit_view_;
+    }
+
+    void ShadowMapCache::snapBox(Bounds& box, float step) const {
+        // one texel larger than the box, so it is still covered after snapping its corner down
+        const float texels = static_cast<float>(size_);
+        float extent = std::ceil(squareExtent(box) * texels / (texels - 1.0f) / step) * step;
+        if (extent < step) extent = step;
+        const float texel = extent / texels;
+        box.min.x = std::floor(box.min.x / texel) * texel;
+        box.min.y = std::floor(box.min.y / texel) * texel;
+        box.max.x = box.min.x + extent;
+        box.max.y = box.min.y + extent;
+        box.min.z = std::floor(box.min.z / step) * step;
+        box.max.z = std::ceil(box.max.z / step) * step;
+    }
+
+    void ShadowMapCache::render(const glm::mat4& lightMatrix, const CachedState& cachedState,
+        const std::function<void(void)>& drawStatic, const std::function<void(void)>& drawCached,
+        const std::function<void(void)>& drawEveryPass) {
+        if (size_ == 0) return;
+        stats_.passes++;
+        glViewport(0, 0, size_, size_);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+
+        const bool lightChanged = !valid_ || lightMatrix != light_matrix_;
+        if (lightChanged) {
+            beginLayer(STATIC_LAYER, NUM_LAYERS);
+            drawStatic();
+            stats_.staticRenders++;
+        }
+        if (lightChanged || cachedState != cached_state_) {
+            beginLayer(CACHED_LAYER, STATIC_LAYER);
+            drawCached();
+            stats_.cachedRenders++;
+        }
+        light_matrix_ = lightMatrix;
+        cached_state_ = cachedState;
+        valid_ = true;
+
+        beginLayer(SHADOW_MAP, CACHED_LAYER);
+        drawEveryPass();
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void ShadowMapCache::beginLayer(Layer layer, Layer from) {
+        if (from == NUM_LAYERS) {
+            glBindFramebuffer(GL_FRAMEBUFFER, fbos_[layer]->id());
+            glClearDepth(1.0f);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            return;
+        }
+        // depth of the layer below as starting point (same format, no framebuffer or shader involved)
+        if (GLEW_ARB_copy_image) {
+            glCopyImageSubData(layers_[from].id, GL_TEXTURE_2D, 0, 0, 0, 0,
+                layers_[layer].id, GL_TEXTURE_2D, 0, 0, 0, 0,
+                size_, size_, 1);
+        }
+        else {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos_[from]->id());
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbos_[layer]->id());
+            glBlitFramebuffer(0, 0, size_, size_, 0, 0, size_, size_, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, fbos_[layer]->id());
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <functional>
+#include <glm/glm.hpp>
+#include "GPUBuffer.h"
+
+namespace roomgame
+{
+    /* Sun shadow map that renders again only what changed since the last pass.
+     * Kept in three depth layers of the same size:
+     * static layer: geometry that never moves (terrain), rendered when the light matrix changes
+     * cached layer: static layer plus instanced meshes, rendered when the light matrix or the state of the meshes changes
+     * shadow map: cached layer plus objects moving every frame, rendered in each pass (this is the texture the scene samples)
+     * Layers are copied on the GPU (or blitted without ARB_copy_image), so an unchanged layer costs a copy instead of its draw calls.
+     * The light matrix is fitted to what the camera sees (see fitLightMatrix) and changes only when that leaves the fitted box.
+    */
+    class ShadowMapCache {
+    public:
+        struct Stats {
+            unsigned long long passes;
+            unsigned long long staticRenders; // passes that rendered the static layer
+            unsigned long long cachedRenders; // passes that rendered the cached layer
+            unsigned long long fits; // changes of the light matrix
+        };
+        // Axis-aligned box (empty if min > max)
+        struct Bounds {
+            glm::vec3 min;
+            glm::vec3 max;
+            void extend(const glm::vec3& p) {
+                min = glm::vec3(p.x < min.x ? p.x : min.x, p.y < min.y ? p.y : min.y, p.z < min.z ? p.z : min.z);
+                max = glm::vec3(p.x > max.x ? p.x : max.x, p.y > max.y ? p.y : max.y, p.z > max.z ? p.z : max.z);
+            }
+        };
+        // State of the geometry drawn into the cached layer: version of the instances and translation of all of them
+        struct CachedState {
+            unsigned long long version;
+            glm::vec3 translation;
+            bool operator==(const CachedState& other) const { return version == other.version && translation == other.translation; }
+            bool operator!=(const CachedState& other) const { return !(*this == other); }
+        };
+        static const int EXTENT_STEPS = 32; // extent of the light frustum is a multiple of 1/EXTENT_STEPS of the terrain
+
+        ShadowMapCache();
+        ~ShadowMapCache();
+        // Allocate the layers (size x size texels each)
+        void init(GLsizei size);
+        void cleanup();
+        // Render all layers again in the next pass
+        void invalidate();
+        /* Orthographic light matrix of the sun fitted to the receivers: the part of the camera frustum within the scene and the whole grid
+         * Depth covers terrain and grid, so casters outside the view still cast into the map.
+         * The light view only depends on sun direction and terrain, the frustum is a box in it:
+         * Square, extent rounded up to steps, corner snapped to whole texels (no shimmering when it moves).
+         * The last box is kept while it holds the receivers and is at most twice their size...
+         * ...otherwise it grows to hold them if that stays within twice their size, or it is fitted anew.
+         * So small camera and grid moves and several viewports per node do not invalidate the layers.
+        */
+        glm::mat4 fitLightMatrix(const glm::vec3& sunDirection, const glm::mat4& cameraViewProjection, const Bounds& terrain, const Bounds& grid);
+        /* Bring the shadow map up to date (renders to its own framebuffers and viewport, default framebuffer bound afterwards)
+         * cachedState: changes whenever the geometry drawn by drawCached changes (anything changing every frame belongs to drawEveryPass)
+        */
+        void render(const glm::mat4& lightMatrix, const CachedState& cachedState,
+            const std::function<void(void)>& drawStatic, const std::function<void(void)>& drawCached,
+            const std::function<void(void)>& drawEveryPass);
+
+        GLuint getTexture() const { return layers_[SHADOW_MAP].id; }
+        GLsizei getSize() const { return size_; }
+        const Stats& getStats() const { return stats_; }
+
+    private:
+        enum Layer { STATIC_LAYER = 0, CACHED_LAYER, SHADOW_MAP, NUM_LAYERS };
+        // Bind the framebuffer of the layer and start it with a copy of another layer (or cleared if from == NUM_LAYERS)
+        // Copies with glCopyImageSubData if supported (GL 4.3), with a depth blit between the framebuffers otherwise
+        void beginLayer(Layer layer, Layer from);
+        // Square box in x and y snapped to whole texels, extent and depth range rounded to step
+        void snapBox(Bounds& box, float step) const;
+
+        GLsizei size_;
+        GPUBuffer::Tex layers_[NUM_LAYERS];
+        GPUBuffer* fbos_[NUM_LAYERS];
+        bool valid_; // static and cached layer belong to light_matrix_ and cached_state_
+        glm::mat4 light_matrix_;
+        CachedState cached_state_;
+        // Last fit: light view and box in light view space (looking down -z)
+        bool fit_valid_;
+        glm::mat4 fit_view_;
+        Bounds fit_box_;
+        Stats stats_;
+    };
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include "core/open_gl.h"
+#include "SyncStream.h"
+
+namespace roomgame
+{
+    /* Cluster-synchronized vector of memcpy-able elements without intermediate copies.
+     * sgct::SharedVector copies each element at least three times per frame
+     * (setVal + writeVector on the master, readVector + getVal + assignment on the slaves).
+     * Master: encode() serializes straight from the live std::vector storage into the sync stream.
+     * Slave: decode() copies the received bytes exactly once, either...
+     * ... into a persistently mapped GPU staging buffer (if allocStaging was called and the data fits), or
+     * ... into a CPU-side back buffer that can be swapped with the live vector in O(1).
+     * Decoding runs on the SGCT network thread, consuming runs on the render thread:
+     * The staging buffer has two slots, the decoder writes into one while the GPU may still read from the other.
+     * The render thread waits for GPU reads of a slot without holding the lock, the decoder uses the back buffer meanwhile.
+     * GL objects are released by cleanup (render thread, before the context is destroyed), not by the destructor.
+     * Usage on the render thread of a slave:
+     *   if (buf.acquireStaged(id, offset, count)) { issue GL commands reading id at offset; buf.releaseStaged(); }
+     *   else if (buf.swapReceived(liveVector)) { use liveVector; }
+    */
+    template <class T>
+    class SharedBuffer {
+        static const int NUM_STAGING_SLOTS = 2;
+        mutable std::mutex mtx_; // guards everything written by the decoder
+        std::vector<T> received_; // CPU-side back buffer (slave)
+        GLuint staging_id_; // persistently mapped staging buffer (0 if not allocated)
+        unsigned char* staging_ptr_; // mapped pointer to the first slot
+        size_t staging_capacity_; // capacity of one slot in elements
+        bool staging_unsupported_; // set if persistent mapping is not available
+        GLsync staging_fences_[NUM_STAGING_SLOTS]; // GPU reads pending on each slot
+        int write_slot_; // slot the decoder writes into
+        bool write_slot_ready_; // GPU finished reading the write slot (otherwise the decoder uses the back buffer)
+        int acquired_slot_; // slot handed out by acquireStaged (-1 if none)
+        size_t num_received_; // element count of the last decoded frame
+        bool has_new_data_; // decoded data that was not consumed yet
+        bool is_staged_; // last decoded frame landed in the staging buffer
+        bool staging_overflow_; // last decoded frame did not fit into the staging buffer
+
+    public:
+        SharedBuffer() :
+            staging_id_(0), staging_ptr_(nullptr), staging_capacity_(0), staging_unsupported_(false),
+            staging_fences_{ 0, 0 }, write_slot_(0), write_slot_ready_(true), acquired_slot_(-1), num_received_(0),
+            has_new_data_(false), is_staged_(false), staging_overflow_(false)
+        {}
+        SharedBuffer(const SharedBuffer&) = delete;
+        SharedBuffer& operator=(const SharedBuffer&) = delete;
+        ~SharedBuffer() = default;
+
+        /* Render thread: release all GL objects (from the GL cleanup of the owner) */
+        void cleanup() {
+            freeStaging();
+        }
+
+        /* Render thread: allocate a persistently mapped staging buffer with two slots of the given capacity (in elements) */
+        bool allocStaging(size_t capacity) {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (staging_unsupported_) return false;
+            if (staging_id_ != 0 && capacity <= staging_capacity_) return true;
+            if (!GLEW_ARB_buffer_storage) {
+                staging_unsupported_ = true;
+                return false;
+            }
+            releaseStagingUnlocked();
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            const GLsizeiptr bytes = static_cast<GLsizeiptr>(capacity * sizeof(T) * NUM_STAGING_SLOTS);
+            glGenBuffers(1, &staging_id_);
+            glBindBuffer(GL_COPY_READ_BUFFER, staging_id_);
+            glBufferStorage(GL_COPY_READ_BUFFER, bytes, nullptr, flags);
+            staging_ptr_ = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, bytes, flags));
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            if (!staging_ptr_) {
+                glDeleteBuffers(1, &staging_id_);
+                staging_id_ = 0;
+                staging_unsupported_ = true;
+                return false;
+            }
+            staging_capacity_ = capacity;
+            write_slot_ = 0;
+            return true;
+        }
+
+        /* Render thread: release the staging buffer (decoding falls back to the CPU-side back buffer) */
+        void freeStaging() {
+            std::lock_guard<std::mutex> lock(mtx_);
+            releaseStagingUnlocked();
+        }
+
+        bool hasStaging() const {
+            std::lock_guard<std::mutex> lock(mtx_);
+            return staging_id_ != 0;
+        }
+
+        bool isStagingUnsupported() const {
+            std::lock_guard<std::mutex> lock(mtx_);
+            return staging_unsupported_;
+        }
+
+        /* Master: write element count and raw bytes of the live vector into the sync stream */
+        void encode(SyncStream& out, const std::vector<T>& live) const {
+            out.writeSize(live.size());
+            if (!live.empty()) {
+                out.write(live.data(), live.size() * sizeof(T));
+            }
+        }
+
+        /* Slave: read element count and copy raw bytes once, into the staging buffer if possible */
+        void decode(SyncStream& in) {
+            const size_t count = in.readSize();
+            const size_t bytes = count * sizeof(T);
+            const unsigned char* src = (bytes > 0) ? in.read(bytes) : nullptr;
+            std::lock_guard<std::mutex> lock(mtx_);
+            num_received_ = count;
+            has_new_data_ = true;
+            if (staging_ptr_ && write_slot_ready_ && count <= staging_capacity_) {
+                if (bytes > 0) std::memcpy(staging_ptr_ + write_slot_ * staging_capacity_ * sizeof(T), src, bytes);
+                is_staged_ = true;
+                staging_overflow_ = false;
+            }
+            else {
+                received_.resize(count); // keeps capacity of earlier frames, so usually no reallocation
+                if (bytes > 0) std::memcpy(received_.data(), src, bytes);
+                is_staged_ = false;
+                staging_overflow_ = (staging_ptr_ != nullptr && count > staging_capacity_);
+            }
+        }
+
+        /* Render thread: get the staging range holding the latest frame
+         * Switches the decoder to the other slot, so the acquired range stays untouched until releaseStaged.
+        */
+        bool acquireStaged(GLuint& buffer, GLintptr& offset, size_t& count) {
+            GLsync fence = 0;
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                if (!has_new_data_ || !is_staged_) return false;
+                buffer = staging_id_;
+                offset = static_cast<GLintptr>(write_slot_ * staging_capacity_ * sizeof(T));
+                count = num_received_;
+                acquired_slot_ = write_slot_;
+                write_slot_ = (write_slot_ + 1) % NUM_STAGING_SLOTS;
+                // the decoder writes into this slot next: not before the GPU finished reading from it
+                fence = staging_fences_[write_slot_];
+                staging_fences_[write_slot_] = 0;
+                write_slot_ready_ = (fence == 0);
+                has_new_data_ = false;
+                is_staged_ = false;
+            }
+            if (fence) {
+                // waiting without the lock, so the decoder does not stall on the GPU
+                glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+                glDeleteSync(fence);
+                std::lock_guard<std::mutex> lock(mtx_);
+                write_slot_ready_ = true;
+            }
+            return true;
+        }
+
+        /* Render thread: call after all GL commands reading the acquired range have been issued */
+        void releaseStaged() {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (acquired_slot_ < 0) return;
+            if (staging_fences_[acquired_slot_]) glDeleteSync(staging_fences_[acquired_slot_]);
+            staging_fences_[acquired_slot_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            acquired_slot_ = -1;
+        }
+
+        /* Render thread: swap the CPU-side back buffer into front if the latest frame landed there (no copy)
+         * Grows the staging buffer if the frame did not fit into it.
+        */
+        bool swapReceived(std::vector<T>& front) {
+            size_t overflow_count = 0;
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                if (!has_new_data_ || is_staged_) return false;
+                front.swap(received_);
+                has_new_data_ = false;
+                if (staging_overflow_) overflow_count = num_received_;
+                staging_overflow_ = false;
+            }
+            if (overflow_count > 0) allocStaging(overflow_count * 2);
+            return true;
+        }
+
+        /* Element count of the last decoded frame */
+        size_t size() const {
+            std::lock_guard<std::mutex> lock(mtx_);
+            return num_received_;
+        }
+
+    private:
+        void waitForSlotUnlocked(int slot) {
+            if (!staging_fences_[slot]) return;
+            glClientWaitSync(staging_fences_[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+            glDeleteSync(staging_fences_[slot]);
+            staging_fences_[slot] = 0;
+        }
+
+        void releaseStagingUnlocked() {
+            for (int i = 0; i < NUM_STAGING_SLOTS; i++) waitForSlotUnlocked(i);
+            if (staging_id_ != 0) {
+                glBindBuffer(GL_COPY_READ_BUFFER, staging_id_);
+                glUnmapBuffer(GL_COPY_READ_BUFFER);
+                glBindBuffer(GL_COPY_READ_BUFFER, 0);
+                glDeleteBuffers(1, &staging_id_);
+            }
+            staging_id_ = 0;
+            staging_ptr_ = nullptr;
+            staging_capacity_ = 0;
+            is_staged_ = false;
+            acquired_slot_ = -1;
+            write_slot_ready_ = true;
+        }
+    };
+}
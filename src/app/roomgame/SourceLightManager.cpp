@@ -30,24 +30,5 @@ namespace roomgame
             sourcePositions_.erase(sourcePositions_.begin() + counter);
         }
     }
-
-
-    void SourceLightManager::updateSourcePos() {
-        glUseProgram(instanceShader_->getProgramId());
-        uploadSourcePos(instanceShader_, sourcePositions_);
-        glUseProgram(terrainShader_->getProgramId());
-        uploadSourcePos(terrainShader_, sourcePositions_);
-    }
-
-    void SourceLightManager::uploadSourcePos(std::shared_ptr<viscom::GPUProgram> shad, std::vector<glm::vec3> sourcePositions) {
-        GLint lightNum = (GLint)min(static_cast<int>(sourcePositions.size()), MAX_VISIBLE_SOURCE_LIGHTS);
-        glUniform1i(shad->getUniformLocation((std::string)("numSourceLights")), lightNum);
-        for (int i = 0; i < lightNum; i++) {
-            std::string number = "" + std::to_string(i);
-            std::string loc = sourceString + "[" + number + "].position";
-            GLint uniLoc = shad->getUniformLocation(loc);
-            glUniform3fv(uniLoc, 1, glm::value_ptr(sourcePositions[i]));
-        }
-    }
 }
 
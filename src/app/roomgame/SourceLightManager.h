@@ -1,46 +1,65 @@
 #pragma once
 #include <memory>
 #include "core/gfx/GPUProgram.h"
+#include "SharedBuffer.h"
+#include "SyncQuantization.h"
+#include "SyncRegistry.h"
 
 namespace roomgame
 {
     class SourceLightManager
     {
-    private:
-        std::string outerInfString = "outerInfLights";
-        std::string sourceString = "sourceLights";
-
     public:
         SourceLightManager();
         ~SourceLightManager();
         
-        static const int MAX_VISIBLE_SOURCE_LIGHTS = 15; //When changing this, don't forget to change the values in the underwater.frag and renderMeshInstance.frag too
+        static const int MAX_VISIBLE_SOURCE_LIGHTS = 15; //When changing this, don't forget to change the values in the underwater.frag and renderMeshInstance.frag too (and SceneUniforms)
 
         void DeleteClosestSourcePos(glm::vec3 curedSourcePos);
-        void updateSourcePos();
-
-        void uploadSourcePos(std::shared_ptr<viscom::GPUProgram> shad, std::vector<glm::vec3> sourcePositions);
-
-        std::shared_ptr<viscom::GPUProgram> instanceShader_ = nullptr;
-        std::shared_ptr<viscom::GPUProgram> terrainShader_ = nullptr;
 
         std::vector<glm::vec3> sourcePositions_;
-        sgct::SharedVector<glm::vec3> sharedSourceLightPositions_;
+        std::vector<QuantizedPosition> quantizedSourcePositions_; // wire format of sourcePositions_
+        SharedBuffer<QuantizedPosition> sharedSourceLightPositions_;
+        ChangeTracker<std::vector<glm::vec3>> sourcePositionChanges_; // positions are modified from several classes
 
+        unsigned long long generation() { // master
+            return sourcePositionChanges_.update(sourcePositions_);
+        }
         void preSync() { // master
-            sharedSourceLightPositions_.setVal(sourcePositions_);
+            quantizedSourcePositions_.resize(sourcePositions_.size());
+            for (size_t i = 0; i < sourcePositions_.size(); i++) {
+                quantizedSourcePositions_[i] = quantizePosition(sourcePositions_[i]);
+            }
         }
-        void encode() { // master
-            sgct::SharedData::instance()->writeVector(&sharedSourceLightPositions_);
+        void encode(SyncStream& out) { // master
+            sharedSourceLightPositions_.encode(out, quantizedSourcePositions_);
         }
-        void decode() { // slave
-            sgct::SharedData::instance()->readVector(&sharedSourceLightPositions_);
+        void decode(SyncStream& in) { // slave
+            sharedSourceLightPositions_.decode(in);
         }
         void updateSyncedSlave() {
-            sourcePositions_ = sharedSourceLightPositions_.getVal();
+            if (!sharedSourceLightPositions_.swapReceived(quantizedSourcePositions_)) return;
+            sourcePositions_.resize(quantizedSourcePositions_.size());
+            for (size_t i = 0; i < quantizedSourcePositions_.size(); i++) {
+                sourcePositions_[i] = dequantizePosition(quantizedSourcePositions_[i]);
+            }
+        }
+        // Loopback slave: applied positions match the master's live positions (see SyncRegistry::Replica)
+        bool matchesLive(const SourceLightManager& master) const {
+            if (sourcePositions_.size() != master.sourcePositions_.size()) return false;
+            for (size_t i = 0; i < sourcePositions_.size(); i++) {
+                if (!matchesQuantized(sourcePositions_[i], master.sourcePositions_[i])) return false;
+            }
+            return true;
         }
         void updateSyncedMaster() {
             //Can maybe stay empty
         }
+        void encodeSnapshot(SyncStream& out) { // master
+            out.writeArray(sourcePositions_);
+        }
+        void loadSnapshot(SyncStream& in) { // slave
+            in.readArray(sourcePositions_);
+        }
     };
 }
@@ -0,0 +1,77 @@
+#include "SyncInterpolator.h"
+#include <cmath>
+#include <iostream>
+
+namespace roomgame
+{
+    SyncInterpolator::SyncInterpolator(double delaySeconds, double maxExtrapolationSeconds) :
+        delay_(delaySeconds),
+        max_extrapolation_(maxExtrapolationSeconds)
+    {
+    }
+
+    void SyncInterpolator::push(double masterTime, double localTime, const State& state) {
+        if (num_samples_ > 0 && masterTime <= samples_[1].master_time) {
+            // same master frame again (or older): only refresh the state
+            samples_[1].state = state;
+            return;
+        }
+        samples_[0] = samples_[1];
+        samples_[1] = Sample{ masterTime, localTime, state };
+        if (num_samples_ < 2) num_samples_++;
+        if (num_samples_ == 1) samples_[0] = samples_[1];
+    }
+
+    void SyncInterpolator::confirm(double masterTime, double localTime) {
+        if (num_samples_ == 0) return;
+        push(masterTime, localTime, samples_[1].state);
+    }
+
+    bool SyncInterpolator::sample(double localTime, State& state) {
+        if (num_samples_ == 0) return false;
+        stats_.frames++;
+        const Sample& older = samples_[0];
+        const Sample& latest = samples_[1];
+        const double interval = latest.master_time - older.master_time;
+        const double sinceArrival = localTime - latest.local_time;
+        const double renderTime = latest.master_time + sinceArrival - delay_;
+        if (interval <= 0.0) {
+            state = latest.state;
+            return true;
+        }
+        double ahead = renderTime - latest.master_time;
+        if (ahead <= 0.0) {
+            stats_.interpolated++;
+        }
+        else if (ahead <= max_extrapolation_) {
+            stats_.extrapolated++;
+            if (sinceArrival > interval) stats_.late++;
+        }
+        else {
+            stats_.held++;
+            ahead = max_extrapolation_;
+        }
+        const double alpha = (latest.master_time + ahead - older.master_time) / interval;
+        state = mix(older.state, latest.state, static_cast<float>(alpha < 0.0 ? 0.0 : alpha));
+        return true;
+    }
+
+    SyncInterpolator::State SyncInterpolator::mix(const State& a, const State& b, float alpha) {
+        State result;
+        result.grid_translation = a.grid_translation + (b.grid_translation - a.grid_translation) * alpha;
+        // a new automaton transition started in between: continue from the end of the previous one
+        float from = a.automaton_time_delta;
+        if (b.automaton_time_delta < from) from -= 1.0f;
+        float t = from + (b.automaton_time_delta - from) * alpha;
+        if (t < 0.0f) t += 1.0f;
+        result.automaton_time_delta = glm::clamp(t, 0.0f, 1.0f);
+        return result;
+    }
+
+    void SyncInterpolator::printStats(std::ostream& out) const {
+        out << "Sync interpolation (delay " << 1000.0 * delay_ << " ms): " << stats_.frames << " frames"
+            << ", interpolated " << stats_.interpolated
+            << ", extrapolated " << stats_.extrapolated << " (late sync " << stats_.late << ")"
+            << ", held " << stats_.held << std::endl;
+    }
+}
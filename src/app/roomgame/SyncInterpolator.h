@@ -0,0 +1,60 @@
+#pragma once
+
+#include <iosfwd>
+#include <glm/glm.hpp>
+
+namespace roomgame
+{
+    /* Decouples the render rate of a slave from the rate at which sync data arrives.
+     * Keeps the last two received states, each stamped with the master time it belongs to.
+     * Each rendered frame samples the state at (time of the latest state + local time since its arrival - delay):
+     * Up to the latest state the two states are interpolated,
+     * beyond it (sync late or delay smaller than the sync interval) the state is extrapolated linearly...
+     * ... for at most maxExtrapolation seconds, after that it is held.
+     * A delay of about one sync interval lets regular frames interpolate, so only late syncs extrapolate.
+     * The outer influence is not handled here, slaves simulate it locally between synced states.
+    */
+    class SyncInterpolator {
+    public:
+        struct State {
+            glm::vec3 grid_translation;
+            float automaton_time_delta; // normalized time in the current automaton transition (wraps to 0)
+        };
+        struct Stats {
+            unsigned long long frames = 0;
+            unsigned long long interpolated = 0;
+            unsigned long long extrapolated = 0;
+            unsigned long long late = 0; // extrapolated frames in which the next sync was overdue
+            unsigned long long held = 0; // extrapolation limit reached, latest state was held
+        };
+
+        SyncInterpolator(double delaySeconds, double maxExtrapolationSeconds);
+
+        // Slave: store a received state with its master time and the local time of arrival
+        void push(double masterTime, double localTime, const State& state);
+        // Slave: a master frame arrived without a new state, the latest state still holds at its master time
+        // (no extrapolation beyond a state that stopped changing)
+        void confirm(double masterTime, double localTime);
+        // Slave: state to render at the given local time (false until a state was received)
+        bool sample(double localTime, State& state);
+
+        double getDelay() const { return delay_; }
+        void setDelay(double delaySeconds) { delay_ = delaySeconds; }
+        const Stats& stats() const { return stats_; }
+        void printStats(std::ostream& out) const;
+
+    private:
+        struct Sample {
+            double master_time;
+            double local_time;
+            State state;
+        };
+        Sample samples_[2]; // older, latest
+        int num_samples_ = 0;
+        double delay_;
+        double max_extrapolation_;
+        Stats stats_;
+
+        static State mix(const State& a, const State& b, float alpha);
+    };
+}
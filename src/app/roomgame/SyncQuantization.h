@@ -0,0 +1,207 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtx/transform.hpp>
+
+namespace roomgame
+{
+    /* Quantized wire formats for synced positions and transforms
+     * Position: 16 bit fixed point per axis within the known world bounds (6 bytes instead of 12)
+     * Rotation: smallest-three quaternion, 15 bit per component (6 bytes)
+     * Uniform scale: half float (2 bytes)
+     * A rigid transform with uniform scale takes 14 bytes instead of 64 for a mat4.
+     * The error bounds below are checked at compile time against the size of a pixel,
+     * maxRoundTripError measures them (tests/SyncQuantizationTest.cpp, run with ctest).
+     * Values outside the bounds are clamped and counted (clampCount, reported by the loopback harness).
+    */
+    namespace quantization
+    {
+        // World bounds of all synced positions (grid spans [-4,6], the outer influence patrols around it)
+        constexpr float BOUNDS_MIN_XY = -16.0f;
+        constexpr float BOUNDS_MAX_XY = 16.0f;
+        constexpr float BOUNDS_MIN_Z = -4.0f;
+        constexpr float BOUNDS_MAX_Z = 4.0f;
+        constexpr float POSITION_STEPS = 65535.0f;
+        constexpr float ROTATION_RANGE = 0.70710678f; // smallest three components lie in [-1/sqrt(2), 1/sqrt(2)]
+        constexpr float ROTATION_STEPS = 32767.0f;
+        constexpr float MAX_SCALE = 65504.0f; // largest finite half float
+
+        // Worst case pixel size: grid height (10) spread over four stacked 1920x1080 viewports
+        constexpr float WORLD_UNITS_PER_PIXEL = 10.0f / (4 * 1080);
+        // Largest synced mesh radius after scaling (outer influence parts are scaled to 0.1-0.2)
+        constexpr float MAX_MESH_RADIUS = 1.0f;
+
+        // Half of one quantization step
+        constexpr float MAX_POSITION_ERROR = (BOUNDS_MAX_XY - BOUNDS_MIN_XY) / POSITION_STEPS / 2.0f;
+        // Per component error, the reconstructed largest component (>= 1/2) at most doubles the error norm,
+        // angle error <= 4 * |dq| with |dq| <= 2 * sqrt(3) * component error
+        constexpr float MAX_ROTATION_ERROR_RAD = 4.0f * 2.0f * 1.7320508f * (2.0f * ROTATION_RANGE / ROTATION_STEPS / 2.0f);
+        // Half float: 11 bit significand
+        constexpr float MAX_RELATIVE_SCALE_ERROR = 1.0f / 2048.0f;
+        // Largest displacement of any vertex of a synced mesh
+        constexpr float MAX_TRANSFORM_ERROR = MAX_POSITION_ERROR
+            + MAX_MESH_RADIUS * MAX_ROTATION_ERROR_RAD
+            + MAX_MESH_RADIUS * MAX_RELATIVE_SCALE_ERROR;
+
+        // Grid and the scales of synced meshes must lie within the quantized ranges
+        constexpr float GRID_MIN = -4.0f;
+        constexpr float GRID_MAX = 6.0f;
+        static_assert(BOUNDS_MIN_XY <= GRID_MIN && GRID_MAX <= BOUNDS_MAX_XY, "Grid exceeds the quantized position bounds");
+        static_assert(BOUNDS_MIN_Z < BOUNDS_MAX_Z, "Empty quantized position bounds");
+        static_assert(MAX_MESH_RADIUS <= MAX_SCALE, "Mesh scales exceed the half float range");
+
+        static_assert(MAX_POSITION_ERROR < WORLD_UNITS_PER_PIXEL, "Quantized positions may be off by a pixel");
+        static_assert(MAX_MESH_RADIUS * MAX_ROTATION_ERROR_RAD < WORLD_UNITS_PER_PIXEL, "Quantized rotations may be off by a pixel");
+        static_assert(MAX_MESH_RADIUS * MAX_RELATIVE_SCALE_ERROR < WORLD_UNITS_PER_PIXEL, "Quantized scales may be off by a pixel");
+        static_assert(MAX_TRANSFORM_ERROR < WORLD_UNITS_PER_PIXEL, "Quantized transforms may be off by a pixel");
+
+        // Number of positions and scales clamped to the bounds so far (should stay 0)
+        inline unsigned long long& clampCount() {
+            static unsigned long long count = 0;
+            return count;
+        }
+
+        inline float countedClamp(float value, float minValue, float maxValue) {
+            if (value >= minValue && value <= maxValue) return value;
+            clampCount()++;
+            return glm::clamp(value, minValue, maxValue);
+        }
+    }
+
+    struct QuantizedPosition {
+        uint16_t x, y, z;
+    };
+
+    struct QuantizedRotation {
+        uint16_t c[3]; // 15 bit per component, index of the dropped component in the top bits of c[0] and c[1]
+    };
+
+    struct QuantizedTransform {
+        QuantizedPosition position;
+        QuantizedRotation rotation;
+        uint16_t scale; // half float
+    };
+    static_assert(sizeof(QuantizedTransform) == 14, "QuantizedTransform must not be padded");
+
+    inline uint16_t quantizeUnit(float value, float minValue, float maxValue, float steps) {
+        const float t = glm::clamp((value - minValue) / (maxValue - minValue), 0.0f, 1.0f);
+        return static_cast<uint16_t>(std::lround(t * steps));
+    }
+
+    inline float dequantizeUnit(uint16_t value, float minValue, float maxValue, float steps) {
+        return minValue + (maxValue - minValue) * (static_cast<float>(value) / steps);
+    }
+
+    inline QuantizedPosition quantizePosition(const glm::vec3& p) {
+        using namespace quantization;
+        return QuantizedPosition{
+            quantizeUnit(countedClamp(p.x, BOUNDS_MIN_XY, BOUNDS_MAX_XY), BOUNDS_MIN_XY, BOUNDS_MAX_XY, POSITION_STEPS),
+            quantizeUnit(countedClamp(p.y, BOUNDS_MIN_XY, BOUNDS_MAX_XY), BOUNDS_MIN_XY, BOUNDS_MAX_XY, POSITION_STEPS),
+            quantizeUnit(countedClamp(p.z, BOUNDS_MIN_Z, BOUNDS_MAX_Z), BOUNDS_MIN_Z, BOUNDS_MAX_Z, POSITION_STEPS) };
+    }
+
+    inline glm::vec3 dequantizePosition(const QuantizedPosition& q) {
+        using namespace quantization;
+        return glm::vec3(
+            dequantizeUnit(q.x, BOUNDS_MIN_XY, BOUNDS_MAX_XY, POSITION_STEPS),
+            dequantizeUnit(q.y, BOUNDS_MIN_XY, BOUNDS_MAX_XY, POSITION_STEPS),
+            dequantizeUnit(q.z, BOUNDS_MIN_Z, BOUNDS_MAX_Z, POSITION_STEPS));
+    }
+
+    // Position applied by a slave is the master's position up to the quantization error (loopback divergence check)
+    inline bool matchesQuantized(const glm::vec3& applied, const glm::vec3& live) {
+        const float bound = quantization::MAX_POSITION_ERROR + 1e-5f; // float rounding of the round trip
+        const glm::vec3 error = glm::abs(applied - live);
+        return error.x <= bound && error.y <= bound && error.z <= bound;
+    }
+
+    inline QuantizedRotation quantizeRotation(const glm::quat& rotation) {
+        using namespace quantization;
+        const glm::quat q = glm::normalize(rotation);
+        float c[4] = { q.x, q.y, q.z, q.w };
+        int largest = 0;
+        for (int i = 1; i < 4; i++) {
+            if (std::abs(c[i]) > std::abs(c[largest])) largest = i;
+        }
+        // q and -q are the same rotation: make the dropped component positive
+        const float sign = (c[largest] < 0.0f) ? -1.0f : 1.0f;
+        QuantizedRotation result;
+        for (int i = 0, k = 0; i < 4; i++) {
+            if (i == largest) continue;
+            result.c[k++] = quantizeUnit(sign * c[i], -ROTATION_RANGE, ROTATION_RANGE, ROTATION_STEPS);
+        }
+        result.c[0] |= static_cast<uint16_t>((largest & 1) << 15);
+        result.c[1] |= static_cast<uint16_t>((largest >> 1) << 15);
+        return result;
+    }
+
+    inline glm::quat dequantizeRotation(const QuantizedRotation& r) {
+        using namespace quantization;
+        const int largest = (r.c[0] >> 15) | ((r.c[1] >> 15) << 1);
+        float c[4];
+        float sumSq = 0.0f;
+        for (int i = 0, k = 0; i < 4; i++) {
+            if (i == largest) continue;
+            c[i] = dequantizeUnit(r.c[k++] & 0x7FFF, -ROTATION_RANGE, ROTATION_RANGE, ROTATION_STEPS);
+            sumSq += c[i] * c[i];
+        }
+        c[largest] = (sumSq < 1.0f) ? std::sqrt(1.0f - sumSq) : 0.0f;
+        return glm::normalize(glm::quat(c[3], c[0], c[1], c[2]));
+    }
+
+    /* Model matrices must be rigid transforms with uniform scale */
+    inline QuantizedTransform quantizeTransform(const glm::mat4& m) {
+        const float scale = glm::length(glm::vec3(m[0]));
+        const glm::mat3 rotation = glm::mat3(m) / scale;
+        return QuantizedTransform{
+            quantizePosition(glm::vec3(m[3])),
+            quantizeRotation(glm::quat_cast(rotation)),
+            glm::packHalf1x16(quantization::countedClamp(scale, 0.0f, quantization::MAX_SCALE)) };
+    }
+
+    inline glm::mat4 dequantizeTransform(const QuantizedTransform& q) {
+        const float scale = glm::unpackHalf1x16(q.scale);
+        return glm::translate(dequantizePosition(q.position))
+            * glm::mat4_cast(dequantizeRotation(q.rotation))
+            * glm::scale(glm::vec3(scale));
+    }
+
+    namespace quantization
+    {
+        /* Round trip of positions and transforms sampled over the bounds (steps samples per axis, rotations and scales per position)
+         * Returns the largest displacement of a point at MAX_MESH_RADIUS from the origin of a transform (or of the position itself).
+         * Must stay below WORLD_UNITS_PER_PIXEL (checked by tests/SyncQuantizationTest.cpp).
+        */
+        inline float maxRoundTripError(int steps) {
+            const glm::vec3 boundsMin(BOUNDS_MIN_XY, BOUNDS_MIN_XY, BOUNDS_MIN_Z);
+            const glm::vec3 boundsMax(BOUNDS_MAX_XY, BOUNDS_MAX_XY, BOUNDS_MAX_Z);
+            const glm::vec3 axes[3] = { glm::vec3(1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, 0, 1) };
+            float maxError = 0.0f;
+            int sample = 0;
+            for (int x = 0; x < steps; x++) for (int y = 0; y < steps; y++) for (int z = 0; z < steps; z++, sample++) {
+                // off-grid positions (fraction of a step varies with the sample) within the bounds
+                const float jitter = static_cast<float>(sample % 97) / 97.0f;
+                const glm::vec3 t = (glm::vec3(x, y, z) + jitter) / static_cast<float>(steps);
+                const glm::vec3 p = boundsMin + t * (boundsMax - boundsMin);
+                const float positionError = glm::length(dequantizePosition(quantizePosition(p)) - p);
+                maxError = positionError > maxError ? positionError : maxError;
+
+                const float angle = 6.2831853f * jitter * 7.0f;
+                const glm::vec3 axis = glm::normalize(glm::vec3(1.0f + t.x, t.y - 0.5f, 0.25f - t.z));
+                const float scale = 0.1f + 0.1f * t.x + jitter;
+                const glm::mat4 m = glm::translate(p) * glm::rotate(angle, axis) * glm::scale(glm::vec3(scale));
+                const glm::mat4 mq = dequantizeTransform(quantizeTransform(m));
+                for (const glm::vec3& a : axes) {
+                    const glm::vec4 v(a * (MAX_MESH_RADIUS / scale), 1.0f);
+                    const float vertexError = glm::length(glm::vec3(mq * v) - glm::vec3(m * v));
+                    maxError = vertexError > maxError ? vertexError : maxError;
+                }
+            }
+            return maxError;
+        }
+    }
+}
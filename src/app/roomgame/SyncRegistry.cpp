@@ -0,0 +1,104 @@
+#include "SyncRegistry.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace roomgame
+{
+    void SyncRegistry::add(const Object& obj) {
+        objects_.push_back(obj);
+        sent_generation_.push_back(0);
+        const size_t maskBytes = (objects_.size() + 7) / 8;
+        changed_.resize(maskBytes, 0);
+        applied_.resize(maskBytes, 0);
+        std::lock_guard<std::mutex> lock(received_mtx_);
+        received_.resize(maskBytes, 0);
+    }
+
+    void SyncRegistry::invalidate() {
+        invalidated_ = true;
+    }
+
+    void SyncRegistry::preSync() {
+        std::fill(changed_.begin(), changed_.end(), 0);
+        full_frame_ = invalidated_;
+        for (size_t i = 0; i < objects_.size(); i++) {
+            const unsigned long long generation = objects_[i].generation();
+            if (!invalidated_ && generation == sent_generation_[i]) continue;
+            sent_generation_[i] = generation;
+            setBit(changed_, i);
+            if (objects_[i].preSync) objects_[i].preSync();
+        }
+        invalidated_ = false;
+    }
+
+    void SyncRegistry::encode(SyncStream& out) const {
+        if (!changed_.empty()) out.write(changed_.data(), changed_.size());
+        for (size_t i = 0; i < objects_.size(); i++) {
+            if (testBit(changed_, i)) objects_[i].encode(out);
+        }
+    }
+
+    void SyncRegistry::decode(SyncStream& in) {
+        const size_t maskBytes = (objects_.size() + 7) / 8;
+        std::vector<unsigned char> present(maskBytes, 0);
+        if (maskBytes > 0) {
+            const unsigned char* mask = in.read(maskBytes);
+            std::copy(mask, mask + maskBytes, present.begin());
+        }
+        for (size_t i = 0; i < objects_.size(); i++) {
+            if (testBit(present, i)) objects_[i].decode(in);
+        }
+        std::lock_guard<std::mutex> lock(received_mtx_);
+        for (size_t b = 0; b < maskBytes; b++) received_[b] |= present[b];
+    }
+
+    void SyncRegistry::updateSyncedSlave() {
+        std::vector<unsigned char> received;
+        {
+            std::lock_guard<std::mutex> lock(received_mtx_);
+            received = received_;
+            std::fill(received_.begin(), received_.end(), 0);
+        }
+        for (size_t i = 0; i < objects_.size(); i++) {
+            if (testBit(received, i)) objects_[i].updateSyncedSlave();
+        }
+        applied_ = received;
+    }
+
+    bool SyncRegistry::wasApplied(const std::string& name) const {
+        for (size_t i = 0; i < objects_.size(); i++) {
+            if (objects_[i].name == name) return testBit(applied_, i);
+        }
+        return false;
+    }
+
+    std::unique_ptr<SyncRegistry> SyncRegistry::replicate() const {
+        auto replica = std::make_unique<SyncRegistry>();
+        for (const Object& obj : objects_) {
+            if (!obj.replicate) throw std::runtime_error("SyncRegistry: no replica for sync object " + obj.name);
+            Replica state = obj.replicate();
+            Object replicaObj;
+            replicaObj.name = obj.name;
+            replicaObj.decode = state.decode;
+            replicaObj.updateSyncedSlave = state.updateSyncedSlave;
+            replicaObj.matchesLive = state.matchesLive;
+            replica->add(replicaObj);
+        }
+        return replica;
+    }
+
+    std::string SyncRegistry::findDivergent() const {
+        for (const Object& obj : objects_) {
+            if (obj.matchesLive && !obj.matchesLive()) return obj.name;
+        }
+        return std::string();
+    }
+
+    size_t SyncRegistry::numChanged() const {
+        size_t n = 0;
+        for (size_t i = 0; i < objects_.size(); i++) {
+            if (testBit(changed_, i)) n++;
+        }
+        return n;
+    }
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "SyncStream.h"
+
+namespace roomgame
+{
+    /* Registry of cluster-synchronized objects with per-object change tracking
+     * Each object reports a generation counter that changes whenever its live state changed on the master.
+     * Master: PreSync only copies objects whose generation changed since they were last sent,
+     * ... the encoded frame holds a presence bitmask followed by the changed objects (in registration order).
+     * Slave: decode reads the objects flagged in the bitmask,
+     * ... updateSyncedSlave applies only objects received since the last call (e.g. no instance re-upload).
+     * Relies on a reliable transport (every frame reaches every slave, as with SGCT):
+     * A slave that missed frames (late join) has to load a snapshot and request a full frame (invalidate).
+     * Master and slaves must register the same objects in the same order.
+    */
+    class SyncRegistry {
+    public:
+        /* Loopback harness: state of an in-process slave, separate from the master's objects (see LoopbackCluster)
+         * Decodes and applies with the code the slave node runs, but into the replica's own shared objects.
+        */
+        struct Replica {
+            std::function<void(SyncStream&)> decode;
+            std::function<void()> updateSyncedSlave;
+            std::function<bool()> matchesLive; // applied state equals the master's live state
+        };
+        struct Object {
+            std::string name;
+            std::function<unsigned long long()> generation; // master: changes whenever the live state changed
+            std::function<void()> preSync; // master: copy live state to shared objects (optional)
+            std::function<void(SyncStream&)> encode; // master
+            std::function<void(SyncStream&)> decode; // slave (may run on the network thread)
+            std::function<void()> updateSyncedSlave; // slave: apply received state
+            std::function<Replica()> replicate; // master: create the state of a loopback slave
+            std::function<bool()> matchesLive; // loopback slave: see Replica
+        };
+
+        // Register an object (master and slaves in the same order)
+        void add(const Object& obj);
+        // Master: send all objects in the next frame, regardless of their generation
+        void invalidate();
+
+        void preSync(); // master
+        void encode(SyncStream& out) const; // master
+        void decode(SyncStream& in); // slave
+        void updateSyncedSlave();
+        // Slave: the object was applied by the last updateSyncedSlave
+        bool wasApplied(const std::string& name) const;
+
+        /* Loopback harness: registry of an in-process slave, with a replica of every object (throws if one has none)
+         * It decodes the master's frames like a slave registry, findDivergent compares the applied state with the master.
+        */
+        std::unique_ptr<SyncRegistry> replicate() const; // master
+        // Loopback slave: name of the first object whose applied state differs from the master's live state (empty if none)
+        std::string findDivergent() const;
+
+        size_t size() const { return objects_.size(); }
+        // Master: number of objects sent in the current frame
+        size_t numChanged() const;
+        // Master: the current frame holds all objects (first frame or after invalidate)
+        bool isFullFrame() const { return full_frame_; }
+
+    private:
+        std::vector<Object> objects_;
+        std::vector<unsigned long long> sent_generation_; // master
+        std::vector<unsigned char> changed_; // master: presence bitmask of the current frame
+        bool invalidated_ = true; // first frame sends everything
+        bool full_frame_ = false; // master: current frame was invalidated
+        std::mutex received_mtx_;
+        std::vector<unsigned char> received_; // slave: objects decoded but not applied yet
+        std::vector<unsigned char> applied_; // slave: objects applied by the last updateSyncedSlave
+
+        static bool testBit(const std::vector<unsigned char>& mask, size_t i) {
+            return (mask[i / 8] & (1 << (i % 8))) != 0;
+        }
+        static void setBit(std::vector<unsigned char>& mask, size_t i) {
+            mask[i / 8] |= static_cast<unsigned char>(1 << (i % 8));
+        }
+    };
+
+    /* Generation counter for state that is compared with its last value instead of marking each mutation
+     * (used for small values that are written from many places, like scores)
+    */
+    template <class T>
+    class ChangeTracker {
+        T last_;
+        unsigned long long generation_ = 0;
+    public:
+        unsigned long long update(const T& value) {
+            if (generation_ == 0 || !(value == last_)) {
+                last_ = value;
+                generation_++;
+            }
+            return generation_;
+        }
+    };
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "sgct.h"
+
+namespace roomgame
+{
+    /* Byte stream that all synchronized objects encode to (master) and decode from (slaves).
+     * Decouples the sync code from the sgct::SharedData singleton, so the same encode/decode functions...
+     * ... run against the SGCT sync buffer (SGCTSyncStream) in cluster mode and
+     * ... run against an in-memory buffer (MemorySyncStream) for the loopback harness and state snapshots.
+     * The typed helpers mirror the sgct::SharedData interface and produce the same byte layout.
+    */
+    class SyncStream {
+    public:
+        virtual ~SyncStream() = default;
+        // Append raw bytes
+        virtual void write(const void* data, size_t bytes) = 0;
+        // Consume raw bytes, returns pointer to them (valid until the stream is written or destroyed)
+        virtual const unsigned char* read(size_t bytes) = 0;
+
+        void writeSize(size_t size) {
+            write(&size, sizeof(size_t));
+        }
+        size_t readSize() {
+            size_t size;
+            std::memcpy(&size, read(sizeof(size_t)), sizeof(size_t));
+            return size;
+        }
+        template <class T> void writeValue(const T& value) {
+            write(&value, sizeof(T));
+        }
+        template <class T> T readValue() {
+            T value;
+            std::memcpy(&value, read(sizeof(T)), sizeof(T));
+            return value;
+        }
+        // Plain vectors of memcpy-able elements (used by snapshots, which read/write live state)
+        template <class T> void writeArray(const std::vector<T>& values) {
+            writeSize(values.size());
+            if (!values.empty()) write(values.data(), values.size() * sizeof(T));
+        }
+        template <class T> void readArray(std::vector<T>& values) {
+            size_t size = readSize();
+            // the count comes from the wire: consume the bytes first, so a corrupt count throws instead of allocating
+            const unsigned char* data = size > 0 ? read(checkedBytes<T>(size)) : nullptr;
+            values.resize(size);
+            if (size > 0) std::memcpy(values.data(), data, size * sizeof(T));
+        }
+        template <class T> void writeObj(sgct::SharedObject<T>* obj) {
+            writeValue<T>(obj->getVal());
+        }
+        template <class T> void readObj(sgct::SharedObject<T>* obj) {
+            obj->setVal(readValue<T>());
+        }
+        template <class T> void writeVector(sgct::SharedVector<T>* vec) {
+            std::vector<T> values = vec->getVal();
+            writeSize(values.size());
+            if (!values.empty()) write(values.data(), values.size() * sizeof(T));
+        }
+        template <class T> void readVector(sgct::SharedVector<T>* vec) {
+            size_t size = readSize();
+            if (size == 0) {
+                vec->clear();
+                return;
+            }
+            const T* data = reinterpret_cast<const T*>(read(checkedBytes<T>(size)));
+            vec->setVal(std::vector<T>(data, data + size));
+        }
+        // Bytes of count elements (throws like a read past the end if that does not fit into size_t)
+        template <class T> static size_t checkedBytes(size_t count) {
+            if (count > static_cast<size_t>(-1) / sizeof(T)) throw std::out_of_range("SyncStream: element count out of range");
+            return count * sizeof(T);
+        }
+        void writeBool(sgct::SharedBool* b) {
+            writeValue<bool>(b->getVal());
+        }
+        void readBool(sgct::SharedBool* b) {
+            b->setVal(readValue<bool>());
+        }
+        void writeInt32(sgct::SharedInt32* i) {
+            writeValue<int32_t>(i->getVal());
+        }
+        void readInt32(sgct::SharedInt32* i) {
+            i->setVal(readValue<int32_t>());
+        }
+        void writeInt64(sgct::SharedInt64* i) {
+            writeValue<int64_t>(i->getVal());
+        }
+        void readInt64(sgct::SharedInt64* i) {
+            i->setVal(readValue<int64_t>());
+        }
+        void writeDouble(sgct::SharedDouble* d) {
+            writeValue<double>(d->getVal());
+        }
+        void readDouble(sgct::SharedDouble* d) {
+            d->setVal(readValue<double>());
+        }
+        void writeFloat(sgct::SharedFloat* f) {
+            writeValue<float>(f->getVal());
+        }
+        void readFloat(sgct::SharedFloat* f) {
+            f->setVal(readValue<float>());
+        }
+    };
+
+    /* Stream backed by the SGCT sync buffer (cluster mode) */
+    class SGCTSyncStream : public SyncStream {
+    public:
+        void write(const void* data, size_t bytes) override {
+            if (bytes == 0) return;
+            sgct::SharedData::instance()->writeUCharArray(
+                reinterpret_cast<unsigned char*>(const_cast<void*>(data)), bytes);
+        }
+        const unsigned char* read(size_t bytes) override {
+            if (bytes == 0) return nullptr;
+            // points into the SGCT receive buffer, no copy
+            return sgct::SharedData::instance()->readUCharArray(bytes);
+        }
+    };
+
+    /* Stream backed by a growable byte buffer (loopback harness, snapshots) */
+    class MemorySyncStream : public SyncStream {
+        std::vector<unsigned char> data_;
+        size_t read_pos_ = 0;
+    public:
+        MemorySyncStream() = default;
+        explicit MemorySyncStream(std::vector<unsigned char> data) : data_(std::move(data)) {}
+        void write(const void* data, size_t bytes) override {
+            const unsigned char* src = reinterpret_cast<const unsigned char*>(data);
+            data_.insert(data_.end(), src, src + bytes);
+        }
+        const unsigned char* read(size_t bytes) override {
+            if (bytes > data_.size() - read_pos_) { // no overflow with counts from the wire
+                throw std::out_of_range("MemorySyncStream: read past end of stream");
+            }
+            const unsigned char* p = data_.data() + read_pos_;
+            read_pos_ += bytes;
+            return p;
+        }
+        // Keeps capacity, so a stream reused each frame does not reallocate
+        void clear() {
+            data_.clear();
+            read_pos_ = 0;
+        }
+        void rewind() {
+            read_pos_ = 0;
+        }
+        size_t size() const { return data_.size(); }
+        size_t remaining() const { return data_.size() - read_pos_; }
+        const std::vector<unsigned char>& data() const { return data_; }
+        std::vector<unsigned char>& data() { return data_; }
+    };
+}
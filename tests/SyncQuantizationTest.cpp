@@ -0,0 +1,21 @@
+#include <iostream>
+#include "roomgame/SyncQuantization.h"
+
+/* Round trip of the quantized wire formats over the synced bounds (these contain the grid)
+ * Fails if a synced position or mesh vertex may be off by a pixel on the worst case display.
+*/
+int main() {
+    using namespace roomgame::quantization;
+    const float error = maxRoundTripError(32);
+    std::cout << "Quantization round trip: max error " << error
+        << " (pixel " << WORLD_UNITS_PER_PIXEL << ", bound " << MAX_TRANSFORM_ERROR << ")" << std::endl;
+    if (error >= WORLD_UNITS_PER_PIXEL) {
+        std::cerr << "Quantization round trip FAILED: synced positions may be off by a pixel" << std::endl;
+        return 1;
+    }
+    if (clampCount() != 0) {
+        std::cerr << "Quantization round trip FAILED: " << clampCount() << " samples were clamped to the bounds" << std::endl;
+        return 1;
+    }
+    return 0;
+}